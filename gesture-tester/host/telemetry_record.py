@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+"""
+Record the capture mode telemetry of the gesture-tester firmware.
+
+Sends "capture" to the board, decodes the binary frames (serial_frame.h,
+telemetry.h) and writes one CSV line per sample:
+    t_us,ax,ay,az,gx,gy,gz,roll,pitch,yaw
+in us since the first sample, g, deg/s and deg: the trace format of
+tello-hand/host/fusion_bench.cpp, with the on-board Mahony angles as the
+reference columns (--no-angles leaves them out). Stops after --seconds or
+on Ctrl-C, sends "stop" and reports the sample rate, the samples lost on
+the way (sequence gaps, CRC errors) and the board's own counts.
+
+The port is opened raw through termios, no pyserial needed.
+
+Usage:
+    python3 telemetry_record.py /dev/ttyUSB0 trace.csv [--baud 921600]
+                                [--seconds 0] [--no-angles]
+"""
+
+import argparse
+import os
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+
+FRAME_SYNC = 0xA5
+FRAME_MAX_PAYLOAD = 250
+
+TELEMETRY_INFO = 0x10
+TELEMETRY_SAMPLE = 0x11
+TELEMETRY_STATS = 0x12
+
+INFO = struct.Struct("<HHH")
+SAMPLE = struct.Struct("<HI3h3h3h")
+STATS = struct.Struct("<III")
+
+
+def open_port(path, baud):
+    speed = getattr(termios, f"B{baud}", None)
+    if speed is None:
+        sys.exit(f"baud rate {baud} not supported by termios here")
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(fd)
+    attributes = termios.tcgetattr(fd)
+    attributes[4] = attributes[5] = speed
+    termios.tcsetattr(fd, termios.TCSANOW, attributes)
+    termios.tcflush(fd, termios.TCIOFLUSH)
+    return fd
+
+
+def crc16(data, crc=0xFFFF):
+    """CRC-16/CCITT-FALSE, as frame_crc16()."""
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+class Decoder:
+    """Frame decoder; text outside frames (boot messages) is skipped."""
+
+    def __init__(self):
+        self.buffer = bytearray()
+        self.crc_errors = 0
+
+    def feed(self, data):
+        self.buffer += data
+        frames = []
+        while True:
+            start = self.buffer.find(FRAME_SYNC)
+            if start < 0:
+                self.buffer.clear()
+                return frames
+            del self.buffer[:start]
+            if len(self.buffer) < 3:
+                return frames
+            length = self.buffer[2]
+            if length > FRAME_MAX_PAYLOAD:
+                self.crc_errors += 1
+                del self.buffer[:1]
+                continue
+            if len(self.buffer) < length + 5:
+                return frames
+            body = bytes(self.buffer[1:3 + length])
+            crc = self.buffer[3 + length] | self.buffer[4 + length] << 8
+            if crc16(body) != crc:
+                # Resynchronize on the next sync byte
+                self.crc_errors += 1
+                del self.buffer[:1]
+                continue
+            frames.append((body[0], body[2:]))
+            del self.buffer[:length + 5]
+
+
+class Recorder:
+    def __init__(self, out, angles):
+        self.out = out
+        self.angles = angles
+        self.acc_scale = 16384.0
+        self.gyro_scale = 65.5
+        self.rate_hz = 0
+        self.samples = 0
+        self.lost = 0
+        self.last_seq = None
+        self.first_us = None
+        self.t_us = 0
+        self.last_raw_us = 0
+        self.board = None
+
+    def frame(self, frame_type, payload):
+        if frame_type == TELEMETRY_INFO and len(payload) == INFO.size:
+            self.rate_hz, acc_lsb, gyro_lsb_x10 = INFO.unpack(payload)
+            self.acc_scale = float(acc_lsb)
+            self.gyro_scale = gyro_lsb_x10 / 10.0
+        elif frame_type == TELEMETRY_STATS and len(payload) == STATS.size:
+            self.board = STATS.unpack(payload)
+        elif frame_type == TELEMETRY_SAMPLE and len(payload) == SAMPLE.size:
+            self.sample(SAMPLE.unpack(payload))
+
+    def sample(self, values):
+        seq, raw_us = values[0], values[1]
+        acc, gyro, angles = values[2:5], values[5:8], values[8:11]
+        if self.last_seq is not None:
+            self.lost += (seq - self.last_seq - 1) & 0xFFFF
+        self.last_seq = seq
+        # micros() wraps after 71 minutes
+        if self.first_us is None:
+            self.first_us = raw_us
+        else:
+            self.t_us += (raw_us - self.last_raw_us) & 0xFFFFFFFF
+        self.last_raw_us = raw_us
+        self.samples += 1
+
+        fields = [str(self.t_us)]
+        fields += [f"{a / self.acc_scale:.5f}" for a in acc]
+        fields += [f"{g / self.gyro_scale:.4f}" for g in gyro]
+        if self.angles:
+            fields += [f"{a / 100.0:.2f}" for a in angles]
+        self.out.write(",".join(fields) + "\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port")
+    parser.add_argument("output", help="CSV trace file")
+    parser.add_argument("--baud", type=int, default=921600)
+    parser.add_argument("--seconds", type=float, default=0.0, help="0: until Ctrl-C")
+    parser.add_argument("--no-angles", action="store_true",
+                        help="leave out the roll, pitch and yaw columns")
+    args = parser.parse_args()
+
+    fd = open_port(args.port, args.baud)
+    decoder = Decoder()
+    with open(args.output, "w") as out:
+        recorder = Recorder(out, not args.no_angles)
+        os.write(fd, b"capture\n")
+        start = time.monotonic()
+        try:
+            while args.seconds <= 0 or time.monotonic() - start < args.seconds:
+                ready, _, _ = select.select([fd], [], [], 0.2)
+                if not ready:
+                    continue
+                for frame_type, payload in decoder.feed(os.read(fd, 65536)):
+                    recorder.frame(frame_type, payload)
+        except KeyboardInterrupt:
+            pass
+        os.write(fd, b"stop\n")
+    os.close(fd)
+
+    seconds = recorder.t_us / 1e6
+    rate = (recorder.samples - 1) / seconds if seconds > 0 else 0.0
+    print(f"{recorder.samples} samples in {seconds:.1f} s, {rate:.1f} Hz "
+          f"(board rate {recorder.rate_hz} Hz) -> {args.output}")
+    print(f"lost: {recorder.lost} samples (sequence gaps), {decoder.crc_errors} crc errors")
+    if recorder.board:
+        samples, dropped, late = recorder.board
+        print(f"board: {samples} samples, {dropped} dropped (tx buffer full), {late} late")
+
+
+if __name__ == "__main__":
+    main()
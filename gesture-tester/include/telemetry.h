@@ -0,0 +1,41 @@
+/*
+ * Binary IMU telemetry of the capture mode, sent as `serial_frame.h`
+ * frames. Decoded by `host/telemetry_record.py`; keep both in step.
+ *
+ * Sent after "capture" was received on serial, until "stop":
+ *   TELEMETRY_INFO    once at the start, telemetry_info_t
+ *   TELEMETRY_SAMPLE  every sample, telemetry_sample_t
+ *   TELEMETRY_STATS   once per second, telemetry_stats_t
+ * Multi-byte values are little endian.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+#define TELEMETRY_INFO      0x10
+#define TELEMETRY_SAMPLE    0x11
+#define TELEMETRY_STATS     0x12
+
+typedef struct __attribute__((packed)) {
+    uint16_t rate_hz;            // Requested sample rate
+    uint16_t acc_lsb_per_g;
+    uint16_t gyro_lsb_per_dps_x10;
+} telemetry_info_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t seq;                // Gaps are samples the TX buffer had no room for
+    uint32_t t_us;               // micros() when the sample was read
+    int16_t acc[3];              // [1 / acc_lsb_per_g g], offsets removed
+    int16_t gyro[3];             // [10 / gyro_lsb_per_dps_x10 deg/s], offsets removed
+    int16_t roll, pitch, yaw;    // Mahony fusion [0.01 deg]
+} telemetry_sample_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t samples;            // Since the start of the capture
+    uint32_t dropped;            // TX buffer full
+    uint32_t late;               // Sampling fell more than a period behind
+} telemetry_stats_t;
+
+#endif
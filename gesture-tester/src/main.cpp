@@ -16,12 +16,25 @@
  * 
  * Code:
  *   https://github.com/jsolderitsch/ESP32Controller
+ *
+ * Serial commands (one per line):
+ *   "capture"  binary telemetry, see `telemetry.h`: every sample at
+ *              SAMPLE_RATE_HZ with the fused angles, until "stop"
+ *   "stop"     back to the text lines every TEXT_PERIOD_MS
+ * The display shows the angles in both modes. It is refreshed every
+ * DISPLAY_PERIOD_MS, only the rows that changed and a 32-byte chunk per
+ * loop() pass, so the sampling never waits for a 1 KB frame on the bus.
  */
 
 #include <Wire.h>
 #include <MPU6050_light.h>
 #include <Adafruit_GFX.h>
 #include <Adafruit_SH1106.h>
+#include <imu_fusion.h>
+#include <imu_calibration.h>
+#include <serial_frame.h>
+#include <Preferences.h>
+#include "telemetry.h"
 
 
 // Config LED pins
@@ -31,22 +44,289 @@
 #define LED_RIGHT    12
 #define LED_LEFT     12
 
+#ifndef SERIAL_BAUD
+#define SERIAL_BAUD          921600
+#endif
+// About 70 ms of capture frames, writes never wait for the UART
+#define SERIAL_TX_BUFFER     2048
+#define COMMAND_LENGTH       16
+
+#ifndef SAMPLE_RATE_HZ
+#define SAMPLE_RATE_HZ       500
+#endif
+#define SAMPLE_PERIOD_US     (1000000 / SAMPLE_RATE_HZ)
+#define TEXT_PERIOD_MS       100
+#define DISPLAY_PERIOD_MS    100
+#define STATS_PERIOD_MS      1000
+
+// MPU6050_light defaults: +-2 g, +-500 deg/s
+#define ACC_LSB_PER_G        16384
+#define GYRO_LSB_PER_DPS     65.5f
+
+#define OLED_WIDTH           128
+#define OLED_ROWS            4
+#define OLED_I2C_ADDRESS     0x3C
+// SH1106 RAM is 132 columns wide, the visible 128 start at column 2
+#define OLED_COLUMN_OFFSET   2
+#define OLED_CHUNK_LENGTH    32
+#define I2C_CLOCK_HZ         400000
+
 // Declaration for an SH1106 display connected to I2C (SDA, SCL pins)
 #define OLED_RESET 4  // Reset pin
 Adafruit_SH1106 display(OLED_RESET);
 
 MPU6050 mpu(Wire);
 
+// Quaternion fusion of the accel/gyro samples, see lib/imu_fusion
+mahony_t fusion;
+euler_t angles;
+uint32_t lastSampleUs = 0;
+uint32_t nextSampleUs = 0;
+
+// Sensor offsets, loaded from NVS on boot and updated when a still period
+// shows gyro drift, see lib/imu_calibration
+imu_cal_t imuCal;
+imu_drift_t imuDrift;
+bool calPending = false;
+
 // Motions: https://i.ytimg.com/vi/FXabvMSQNxA/maxresdefault.jpg
-int8_t mpuRoll;   // Left/Right
-int8_t mpuPitch;  // Forward/backward
-int8_t mpuYaw;    // Rotate right/left
+int16_t mpuRoll;   // Left/Right
+int16_t mpuPitch;  // Forward/backward
+int16_t mpuYaw;    // Rotate right/left
+
+bool capturing = false;
+uint16_t captureSeq = 0;
+telemetry_stats_t captureStats;
+
+// Display rows as shown, a row is sent again only when its text changed
+char rowText[OLED_ROWS][OLED_WIDTH / 6 + 1];
+char rowShown[OLED_ROWS][OLED_WIDTH / 6 + 1];
+
+
+// One 32-byte chunk of a page, under a millisecond at 400 kHz
+void write_chunk(uint8_t page, uint8_t x, const uint8_t *data)
+{
+    uint8_t column = x + OLED_COLUMN_OFFSET;
+    Wire.beginTransmission(OLED_I2C_ADDRESS);
+    Wire.write((uint8_t) 0x00);
+    Wire.write(0xB0 | page);              // Page address
+    Wire.write(0x00 | (column & 0x0F));   // Lower column address
+    Wire.write(0x10 | (column >> 4));     // Higher column address
+    Wire.endTransmission();
+
+    Wire.beginTransmission(OLED_I2C_ADDRESS);
+    Wire.write((uint8_t) 0x40);   // D/C = 1: data stream
+    Wire.write(data + x, OLED_CHUNK_LENGTH);
+    Wire.endTransmission();
+}
+
+
+// Render one text row into the 128 columns of a panel page
+void render_row(const char *text, uint8_t *page)
+{
+    static GFXcanvas1 canvas(OLED_WIDTH, 8);
+
+    canvas.fillScreen(BLACK);
+    canvas.setTextSize(1);
+    canvas.setTextColor(WHITE);
+    canvas.setTextWrap(false);
+    canvas.setCursor(0, 0);
+    canvas.print(text);
+
+    // Canvas rows are horizontal bytes (MSB left), SH1106 pages vertical (LSB top)
+    const uint8_t *rows = canvas.getBuffer();
+    for (uint8_t x = 0; x < OLED_WIDTH; x++) {
+        uint8_t column = 0;
+        for (uint8_t y = 0; y < 8; y++) {
+            if (rows[y * (OLED_WIDTH / 8) + x / 8] & (0x80 >> (x % 8)))
+                column |= 1 << y;
+        }
+        page[x] = column;
+    }
+}
+
+
+// At most one chunk per call: a changed row is rendered, then sent in
+// four passes, so a sample is never more than a chunk late
+void update_display()
+{
+    static uint8_t page[OLED_WIDTH];
+    static int8_t pageRow = -1;
+    static uint8_t pageChunk = 0;
+
+    for (uint8_t row = 0; row < OLED_ROWS && pageRow < 0; row++) {
+        if (strcmp(rowText[row], rowShown[row]) != 0) {
+            strcpy(rowShown[row], rowText[row]);
+            render_row(rowShown[row], page);
+            pageRow = row;
+            pageChunk = 0;
+        }
+    }
+    if (pageRow < 0)
+        return;
+    write_chunk(pageRow, pageChunk * OLED_CHUNK_LENGTH, page);
+    if (++pageChunk == OLED_WIDTH / OLED_CHUNK_LENGTH)
+        pageRow = -1;
+}
+
+
+void send_frame(uint8_t type, const void *payload, size_t length)
+{
+    uint8_t frame[FRAME_MAX_LENGTH];
+
+    size_t frame_length = frame_encode(type, payload, length, frame);
+    Serial.write(frame, frame_length);
+}
+
+
+void start_capture()
+{
+    telemetry_info_t info;
+
+    info.rate_hz = SAMPLE_RATE_HZ;
+    info.acc_lsb_per_g = ACC_LSB_PER_G;
+    info.gyro_lsb_per_dps_x10 = lroundf(GYRO_LSB_PER_DPS * 10);
+    memset(&captureStats, 0, sizeof(captureStats));
+    captureSeq = 0;
+    capturing = true;
+    send_frame(TELEMETRY_INFO, &info, sizeof(info));
+}
+
+
+// Serial commands, only the bytes already received
+void read_commands()
+{
+    static char line[COMMAND_LENGTH];
+    static uint8_t length = 0;
+
+    int available = Serial.available();
+    while (available-- > 0) {
+        char c = Serial.read();
+        if (c != '\n' && c != '\r') {
+            if (length < COMMAND_LENGTH - 1)
+                line[length++] = c;
+            continue;
+        }
+        line[length] = '\0';
+        length = 0;
+        if (strcmp(line, "capture") == 0)
+            start_capture();
+        else if (strcmp(line, "stop") == 0)
+            capturing = false;
+    }
+}
+
+
+int16_t to_counts(float value, float scale)
+{
+    return (int16_t) constrain(lroundf(value * scale), -32768L, 32767L);
+}
+
+
+// Frame of the newest sample, dropped rather than waiting for the UART
+void send_sample(uint32_t sampleUs)
+{
+    telemetry_sample_t sample;
+
+    sample.seq = captureSeq++;
+    sample.t_us = sampleUs;
+    sample.acc[0] = to_counts(mpu.getAccX(), ACC_LSB_PER_G);
+    sample.acc[1] = to_counts(mpu.getAccY(), ACC_LSB_PER_G);
+    sample.acc[2] = to_counts(mpu.getAccZ(), ACC_LSB_PER_G);
+    sample.gyro[0] = to_counts(mpu.getGyroX(), GYRO_LSB_PER_DPS);
+    sample.gyro[1] = to_counts(mpu.getGyroY(), GYRO_LSB_PER_DPS);
+    sample.gyro[2] = to_counts(mpu.getGyroZ(), GYRO_LSB_PER_DPS);
+    sample.roll = lroundf(angles.roll * 100);
+    sample.pitch = lroundf(angles.pitch * 100);
+    sample.yaw = lroundf(angles.yaw * 100);
+
+    captureStats.samples++;
+    if (Serial.availableForWrite() < (int) (sizeof(sample) + FRAME_OVERHEAD)) {
+        captureStats.dropped++;
+        return;
+    }
+    send_frame(TELEMETRY_SAMPLE, &sample, sizeof(sample));
+}
+
+
+// NVS record of the offsets, see imu_calibration.h
+imu_cal_status_t load_calibration(float temp_c)
+{
+    Preferences prefs;
+
+    prefs.begin(IMU_CAL_NAMESPACE, true);
+    size_t length = prefs.getBytes(IMU_CAL_KEY, &imuCal, sizeof(imuCal));
+    prefs.end();
+    return imu_cal_check(&imuCal, length, temp_c);
+}
+
+
+void store_calibration()
+{
+    Preferences prefs;
+
+    imu_cal_seal(&imuCal);
+    prefs.begin(IMU_CAL_NAMESPACE, false);
+    prefs.putBytes(IMU_CAL_KEY, &imuCal, sizeof(imuCal));
+    prefs.end();
+}
+
+
+// Residual gyro bias of a still period goes into the offsets
+void check_drift()
+{
+    float bias[3];
+
+    const float acc[3] = {mpu.getAccX(), mpu.getAccY(), mpu.getAccZ()};
+    const float gyro[3] = {mpu.getGyroX(), mpu.getGyroY(), mpu.getGyroZ()};
+    if (!imu_drift_update(&imuDrift, acc, gyro, bias) || !imu_cal_correct(&imuCal, bias))
+        return;
+    imuCal.temp_c = mpu.getTemp();
+    mpu.setGyroOffsets(imuCal.gyro[0], imuCal.gyro[1], imuCal.gyro[2]);
+    calPending = true;
+}
+
+
+void update_leds()
+{
+    // Turn LEDs OFF
+    if (abs(mpuRoll) <= 10) {
+        digitalWrite(LED_LEFT,LOW);
+        digitalWrite(LED_RIGHT,LOW);
+    }
+    if (abs(mpuPitch) <= 15) {
+        digitalWrite(LED_FORWARD,LOW);
+        digitalWrite(LED_BACK,LOW);
+    }
+
+    // Turn LEDs ON
+    // Move forward
+    if (mpuPitch < -16) {
+      digitalWrite(LED_FORWARD,HIGH);
+    }
+
+    // Move backward
+    if (mpuPitch > 16) {
+        digitalWrite(LED_BACK,HIGH);
+    }
+
+    // Move right
+    if (mpuRoll < -11) {
+        digitalWrite(LED_RIGHT,HIGH);
+    }
+
+    // Move left
+    if (mpuRoll > 11) {
+        digitalWrite(LED_LEFT,HIGH);
+    }
+}
 
 
 void setup(void)
 {
     // Init hardware serial
-    Serial.begin(115200);
+    Serial.setTxBufferSize(SERIAL_TX_BUFFER);
+    Serial.begin(SERIAL_BAUD);
     while (!Serial);
 
     // Initialize OLED display with I2C address 0x3C
@@ -70,13 +350,44 @@ void setup(void)
     while (status != 0) {
         // Loop here if could not connect to MPU6050
     }
-    // Get the idle controller position
-    Serial.print(F("Calculating offsets, do not move MPU6050... "));
-    delay(1000);
-    mpu.calcOffsets();
-    Serial.println("Done");
+    // Stored offsets need no still board; drift is corrected in the background
+    mpu.update();
+    float temp_c = mpu.getTemp();
+    imu_cal_status_t cal_status = load_calibration(temp_c);
+    if (cal_status == IMU_CAL_OK || cal_status == IMU_CAL_TEMPERATURE) {
+        mpu.setAccOffsets(imuCal.acc[0], imuCal.acc[1], imuCal.acc[2]);
+        mpu.setGyroOffsets(imuCal.gyro[0], imuCal.gyro[1], imuCal.gyro[2]);
+        Serial.printf("IMU offsets loaded (%s): measured at %.1f C, now %.1f C, %u recalibrations\n",
+                      imu_cal_status_name(cal_status), imuCal.temp_c, temp_c, imuCal.updates);
+    }
+    else {
+        // Get the idle controller position
+        Serial.printf("IMU offsets %s\n", imu_cal_status_name(cal_status));
+        Serial.print(F("Calculating offsets, do not move MPU6050... "));
+        delay(1000);
+        mpu.calcOffsets();
+        Serial.println("Done");
+        imuCal.acc[0] = mpu.getAccXoffset();
+        imuCal.acc[1] = mpu.getAccYoffset();
+        imuCal.acc[2] = mpu.getAccZoffset();
+        imuCal.gyro[0] = mpu.getGyroXoffset();
+        imuCal.gyro[1] = mpu.getGyroYoffset();
+        imuCal.gyro[2] = mpu.getGyroZoffset();
+        for (uint8_t axis = 0; axis < 3; axis++)
+            imuCal.gyro_base[axis] = imuCal.gyro[axis];
+        imuCal.temp_c = temp_c;
+        imuCal.updates = 0;
+        store_calibration();
+        delay(100);
+    }
     Serial.println("Start moving MPU6050");
-    delay(100);
+    imu_drift_init(&imuDrift, SAMPLE_RATE_HZ);
+    mahony_init(&fusion, MAHONY_KP, MAHONY_KI);
+
+    // From now on the display is written a page at a time
+    display.clearDisplay();
+    display.display();
+    Wire.setClock(I2C_CLOCK_HZ);
 
     // Configure LEDs
     pinMode(LED_FORWARD, OUTPUT);
@@ -87,64 +398,74 @@ void setup(void)
     digitalWrite(LED_BACK, LOW);
     digitalWrite(LED_RIGHT, LOW);
     digitalWrite(LED_LEFT, LOW);
+
+    lastSampleUs = micros();
+    nextSampleUs = lastSampleUs;
 }
 
 
 void loop()
 {
-    uint16_t timer = 0;
+    static uint32_t textTime = 0;
+    static uint32_t displayTime = 0;
+    static uint32_t statsTime = 0;
 
-    mpu.update();
-    mpuRoll = mpu.getAngleX();
-    mpuPitch = mpu.getAngleY();
-    mpuYaw = mpu.getAngleZ();
-
-    display.clearDisplay();
-    display.setCursor(0, 0);
+    read_commands();
 
-    // Turn LEDs OFF
-    if (abs(mpuRoll) <= 10) {
-        digitalWrite(LED_LEFT,LOW);
-        digitalWrite(LED_RIGHT,LOW);
-    }
-    if (abs(mpuPitch) <= 15) {
-        digitalWrite(LED_FORWARD,LOW);
-        digitalWrite(LED_BACK,LOW);
-    }
+    // Fixed sample rate; after a stall the schedule restarts instead of
+    // catching up with a burst of samples
+    uint32_t nowUs = micros();
+    if ((int32_t) (nowUs - nextSampleUs) >= 0) {
+        if ((int32_t) (nowUs - nextSampleUs) >= SAMPLE_PERIOD_US) {
+            captureStats.late++;
+            nextSampleUs = nowUs;
+        }
+        nextSampleUs += SAMPLE_PERIOD_US;
 
-    // Turn LEDs ON
-    // Move forward
-    if (mpuPitch < -16) {
-      digitalWrite(LED_FORWARD,HIGH);
+        mpu.update();
+        nowUs = micros();
+        mahony_update(&fusion, mpu.getAccX(), mpu.getAccY(), mpu.getAccZ(),
+                      mpu.getGyroX(), mpu.getGyroY(), mpu.getGyroZ(), (nowUs - lastSampleUs) * 1e-6f);
+        lastSampleUs = nowUs;
+        mahony_euler(&fusion, &angles);
+        mpuRoll = lroundf(angles.roll);
+        mpuPitch = lroundf(angles.pitch);
+        mpuYaw = lroundf(angles.yaw);
+        update_leds();
+        check_drift();
+        if (capturing)
+            send_sample(nowUs);
     }
 
-    // Move backward
-    if (mpuPitch > 16) {
-        digitalWrite(LED_BACK,HIGH);
+    // An NVS write stalls the loop for a few ms, not during a capture
+    if (calPending && !capturing) {
+        store_calibration();
+        calPending = false;
+        Serial.printf("IMU gyro offsets updated: %.2f %.2f %.2f deg/s at %.1f C\n",
+                      imuCal.gyro[0], imuCal.gyro[1], imuCal.gyro[2], imuCal.temp_c);
     }
 
-    // Move right
-    if (mpuRoll < -11) {
-        digitalWrite(LED_RIGHT,HIGH);
+    if (millis() - displayTime >= DISPLAY_PERIOD_MS) {
+        snprintf(rowText[0], sizeof(rowText[0]), "Roll: %d", mpuRoll);
+        snprintf(rowText[1], sizeof(rowText[1]), "Pitch: %d", mpuPitch);
+        snprintf(rowText[2], sizeof(rowText[2]), "Yaw: %d", mpuYaw);
+        if (capturing)
+            snprintf(rowText[3], sizeof(rowText[3]), "Capture %u", captureStats.samples);
+        else
+            rowText[3][0] = '\0';
+        displayTime = millis();
     }
+    update_display();
 
-    // Move left
-    if (mpuRoll > 11) {
-        digitalWrite(LED_LEFT,HIGH);
+    if (capturing) {
+        if (millis() - statsTime >= STATS_PERIOD_MS) {
+            send_frame(TELEMETRY_STATS, &captureStats, sizeof(captureStats));
+            statsTime = millis();
+        }
     }
-
-    // Update display data every 100 ms
-    if ((millis()-timer) > 100) {
-        display.println("Roll: " + String(mpuRoll));
-        display.println("Pitch: " + String(mpuPitch));
-        display.println("Yaw: " + String(mpuYaw));
-        display.display();
-
-        // Update Serail monitor data as well
-        Serial.println("Roll: " + String(mpuRoll));
-        Serial.println("Pitch: " + String(mpuPitch));
-        Serial.println("Yaw: " + String(mpuYaw));
-
-        timer = millis();  
+    else if (millis() - textTime >= TEXT_PERIOD_MS) {
+        // Update Serial monitor data as well
+        Serial.printf("Roll: %d\nPitch: %d\nYaw: %d\n", mpuRoll, mpuPitch, mpuYaw);
+        textTime = millis();
     }
 }
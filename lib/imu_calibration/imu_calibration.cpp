@@ -0,0 +1,145 @@
+/*
+ * Stored MPU6050 offsets and background gyro recalibration, see
+ * `imu_calibration.h`.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "imu_calibration.h"
+
+
+static uint32_t crc32(const uint8_t *data, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+    }
+    return ~crc;
+}
+
+
+static uint32_t record_crc(const imu_cal_t *cal)
+{
+    return crc32((const uint8_t *) cal, offsetof(imu_cal_t, crc));
+}
+
+
+void imu_cal_seal(imu_cal_t *cal)
+{
+    cal->magic = IMU_CAL_MAGIC;
+    cal->version = IMU_CAL_VERSION;
+    cal->size = sizeof(imu_cal_t);
+    cal->crc = record_crc(cal);
+}
+
+
+imu_cal_status_t imu_cal_check(const imu_cal_t *cal, size_t length, float temp_c)
+{
+    if (length == 0)
+        return IMU_CAL_MISSING;
+    if (length != sizeof(imu_cal_t) || cal->magic != IMU_CAL_MAGIC ||
+        cal->version != IMU_CAL_VERSION || cal->size != sizeof(imu_cal_t) ||
+        cal->crc != record_crc(cal))
+        return IMU_CAL_INVALID;
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        // Also false for NaN
+        if (!(fabsf(cal->gyro[axis]) <= IMU_CAL_GYRO_MAX_DPS) ||
+            !(fabsf(cal->acc[axis]) <= IMU_CAL_ACC_MAX_G) ||
+            !(fabsf(cal->gyro[axis] - cal->gyro_base[axis]) <= IMU_CAL_DRIFT_TOTAL_DPS))
+            return IMU_CAL_INVALID;
+    }
+    if (!(fabsf(temp_c - cal->temp_c) <= IMU_CAL_TEMP_RANGE_C))
+        return IMU_CAL_TEMPERATURE;
+    return IMU_CAL_OK;
+}
+
+
+const char *imu_cal_status_name(imu_cal_status_t status)
+{
+    static const char *names[] = {"ok", "temperature", "missing", "invalid"};
+
+    return status <= IMU_CAL_INVALID ? names[status] : "?";
+}
+
+
+bool imu_cal_correct(imu_cal_t *cal, const float bias[3])
+{
+    bool moved = false;
+
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        float low = cal->gyro_base[axis] - IMU_CAL_DRIFT_TOTAL_DPS;
+        float high = cal->gyro_base[axis] + IMU_CAL_DRIFT_TOTAL_DPS;
+        float offset = cal->gyro[axis] + bias[axis];
+        offset = offset < low ? low : (offset > high ? high : offset);
+        if (offset != cal->gyro[axis]) {
+            cal->gyro[axis] = offset;
+            moved = true;
+        }
+    }
+    if (moved)
+        cal->updates++;
+    return moved;
+}
+
+
+static void drift_reset(imu_drift_t *d)
+{
+    d->count = 0;
+    d->acc_dev_max = 0.0f;
+    for (uint8_t axis = 0; axis < 3; axis++)
+        d->sum[axis] = d->sum_sq[axis] = 0.0f;
+}
+
+
+void imu_drift_init(imu_drift_t *d, uint32_t window_samples)
+{
+    memset(d, 0, sizeof(*d));
+    d->window = window_samples > 1 ? window_samples : 2;
+}
+
+
+bool imu_drift_update(imu_drift_t *d, const float acc[3], const float gyro[3], float bias[3])
+{
+    float magnitude = sqrtf(acc[0] * acc[0] + acc[1] * acc[1] + acc[2] * acc[2]);
+    float deviation = fabsf(magnitude - 1.0f);
+
+    // A moving window is given up as early as possible
+    if (deviation > IMU_CAL_STILL_G) {
+        drift_reset(d);
+        return false;
+    }
+    if (deviation > d->acc_dev_max)
+        d->acc_dev_max = deviation;
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        d->sum[axis] += gyro[axis];
+        d->sum_sq[axis] += gyro[axis] * gyro[axis];
+    }
+    if (++d->count < d->window)
+        return false;
+
+    bool still = true;
+    bool drifted = false;
+    float mean[3];
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        mean[axis] = d->sum[axis] / d->count;
+        float variance = d->sum_sq[axis] / d->count - mean[axis] * mean[axis];
+        if (variance > IMU_CAL_STILL_DPS * IMU_CAL_STILL_DPS ||
+            fabsf(mean[axis]) > IMU_CAL_DRIFT_MAX_DPS)
+            still = false;
+        if (fabsf(mean[axis]) > IMU_CAL_DRIFT_DPS)
+            drifted = true;
+    }
+    drift_reset(d);
+    if (!still)
+        return false;
+    d->still++;
+    if (!drifted)
+        return false;
+    d->drifts++;
+    for (uint8_t axis = 0; axis < 3; axis++)
+        bias[axis] = mean[axis];
+    return true;
+}
@@ -0,0 +1,101 @@
+/*
+ * Stored MPU6050 offsets and background gyro recalibration.
+ *
+ * `mpu.calcOffsets()` needs the board held still for about two seconds
+ * on every boot. Instead the offsets are kept in NVS as an imu_cal_t:
+ * loaded at once on boot, checked for a valid record and for the die
+ * temperature they were measured at, and only computed again when there
+ * is no usable record.
+ *
+ * While running, imu_drift_update() watches the calibrated samples for
+ * still periods. A still period with a mean gyro rate above
+ * IMU_CAL_DRIFT_DPS is residual bias: it is added to the gyro offsets and
+ * stored again, but the offsets never move more than
+ * IMU_CAL_DRIFT_TOTAL_DPS away from what calcOffsets() measured, so a
+ * slow steady turn cannot build up in them. The firmware only applies
+ * corrections on the ground. The accel offsets are left alone, since
+ * calcOffsets() computed them for a board lying flat, which a still hand
+ * is not.
+ *
+ * Library is shared by gesture-tester and tello-hand (`lib_extra_dirs`)
+ * and has no Arduino dependency; the NVS access (Preferences) stays in
+ * the firmware.
+ */
+
+#ifndef IMU_CALIBRATION_H
+#define IMU_CALIBRATION_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define IMU_CAL_MAGIC          0x4C414349   // "ICAL"
+#define IMU_CAL_VERSION        2
+// NVS namespace and key
+#define IMU_CAL_NAMESPACE      "imu"
+#define IMU_CAL_KEY            "cal"
+
+// Plausible offsets; more means a bad calibration or another sensor
+#define IMU_CAL_GYRO_MAX_DPS   20.0f
+#define IMU_CAL_ACC_MAX_G      0.5f
+// Gyro bias drifts with temperature; further away the record is only a start
+#define IMU_CAL_TEMP_RANGE_C   10.0f
+
+// Still: gyro standard deviation and |acc| deviation from 1 g in a window
+#define IMU_CAL_STILL_DPS      0.5f
+#define IMU_CAL_STILL_G        0.03f
+// Residual bias of a still window that triggers a recalibration; above
+// the maximum it is a slow steady turn rather than bias
+#define IMU_CAL_DRIFT_DPS      0.3f
+#define IMU_CAL_DRIFT_MAX_DPS  3.0f
+// Largest total correction of a gyro offset from its calcOffsets() value
+#define IMU_CAL_DRIFT_TOTAL_DPS 2.0f
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;               // sizeof(imu_cal_t)
+    float acc[3];                // Offsets [g], as MPU6050_light setAccOffsets()
+    float gyro[3];               // [deg/s], as setGyroOffsets()
+    float gyro_base[3];          // Gyro offsets as measured by calcOffsets()
+    float temp_c;                // Die temperature when measured
+    uint32_t updates;            // Background recalibrations since calcOffsets()
+    uint32_t crc;                // CRC-32 of the fields above
+} imu_cal_t;
+
+typedef enum {
+    IMU_CAL_OK = 0,
+    IMU_CAL_TEMPERATURE,         // Valid, but measured at another temperature
+    IMU_CAL_MISSING,
+    IMU_CAL_INVALID              // Wrong version, size or CRC, implausible
+} imu_cal_status_t;
+
+typedef struct {
+    uint32_t window;             // Samples per window
+    uint32_t count;
+    float sum[3], sum_sq[3];     // Gyro [deg/s]
+    float acc_dev_max;           // Largest | |acc| - 1 g | in the window
+    uint32_t still;              // Still windows seen
+    uint32_t drifts;             // Of those, with bias above IMU_CAL_DRIFT_DPS
+} imu_drift_t;
+
+// Fill in magic, version, size and CRC before storing
+void imu_cal_seal(imu_cal_t *cal);
+
+// `length` as read from NVS, `temp_c` the current die temperature
+imu_cal_status_t imu_cal_check(const imu_cal_t *cal, size_t length, float temp_c);
+
+const char *imu_cal_status_name(imu_cal_status_t status);
+
+// Add a residual bias to the gyro offsets, each kept within
+// IMU_CAL_DRIFT_TOTAL_DPS of `gyro_base`; false if none of them moved
+bool imu_cal_correct(imu_cal_t *cal, const float bias[3]);
+
+void imu_drift_init(imu_drift_t *drift, uint32_t window_samples);
+
+// Feed one calibrated sample (g, deg/s); true at the end of a still window
+// whose mean gyro rate is between IMU_CAL_DRIFT_DPS and
+// IMU_CAL_DRIFT_MAX_DPS on some axis, the mean is then in `bias`
+bool imu_drift_update(imu_drift_t *drift, const float acc[3], const float gyro[3],
+                      float bias[3]);
+
+#endif
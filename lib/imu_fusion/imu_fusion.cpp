@@ -0,0 +1,206 @@
+/*
+ * Mahony quaternion sensor fusion, see `imu_fusion.h`.
+ */
+
+#include <math.h>
+#include "imu_fusion.h"
+
+#define DEG_TO_RAD_F  0.017453292f
+#define RAD_TO_DEG_F  57.29577951f
+
+
+static void quaternion_to_euler(float q0, float q1, float q2, float q3, euler_t *angles)
+{
+    float sin_pitch = -2.0f * (q1 * q3 - q0 * q2);
+
+    if (sin_pitch > 1.0f)
+        sin_pitch = 1.0f;
+    else if (sin_pitch < -1.0f)
+        sin_pitch = -1.0f;
+
+    angles->roll = atan2f(q0 * q1 + q2 * q3, 0.5f - q1 * q1 - q2 * q2) * RAD_TO_DEG_F;
+    angles->pitch = asinf(sin_pitch) * RAD_TO_DEG_F;
+    angles->yaw = atan2f(q1 * q2 + q0 * q3, 0.5f - q2 * q2 - q3 * q3) * RAD_TO_DEG_F;
+}
+
+
+void mahony_init(mahony_t *f, float kp, float ki)
+{
+    f->q0 = 1.0f;
+    f->q1 = f->q2 = f->q3 = 0.0f;
+    f->ix = f->iy = f->iz = 0.0f;
+    f->kp = kp;
+    f->ki = ki;
+}
+
+
+void mahony_update(mahony_t *f, float ax, float ay, float az,
+                   float gx, float gy, float gz, float dt)
+{
+    gx *= DEG_TO_RAD_F;
+    gy *= DEG_TO_RAD_F;
+    gz *= DEG_TO_RAD_F;
+
+    // Correct the gyro with the gravity direction unless in free fall
+    float norm = ax * ax + ay * ay + az * az;
+    if (norm > 0.0f) {
+        float recip = 1.0f / sqrtf(norm);
+        ax *= recip;
+        ay *= recip;
+        az *= recip;
+
+        // Gravity direction estimated from the quaternion (half)
+        float vx = f->q1 * f->q3 - f->q0 * f->q2;
+        float vy = f->q0 * f->q1 + f->q2 * f->q3;
+        float vz = f->q0 * f->q0 - 0.5f + f->q3 * f->q3;
+
+        // Error is the cross product of measured and estimated gravity
+        float ex = ay * vz - az * vy;
+        float ey = az * vx - ax * vz;
+        float ez = ax * vy - ay * vx;
+
+        if (f->ki > 0.0f) {
+            f->ix += 2.0f * f->ki * ex * dt;
+            f->iy += 2.0f * f->ki * ey * dt;
+            f->iz += 2.0f * f->ki * ez * dt;
+            gx += f->ix;
+            gy += f->iy;
+            gz += f->iz;
+        }
+        gx += 2.0f * f->kp * ex;
+        gy += 2.0f * f->kp * ey;
+        gz += 2.0f * f->kp * ez;
+    }
+
+    // Integrate the rate of change of the quaternion
+    gx *= 0.5f * dt;
+    gy *= 0.5f * dt;
+    gz *= 0.5f * dt;
+    float q0 = f->q0;
+    float q1 = f->q1;
+    float q2 = f->q2;
+    float q3 = f->q3;
+    f->q0 += -q1 * gx - q2 * gy - q3 * gz;
+    f->q1 += q0 * gx + q2 * gz - q3 * gy;
+    f->q2 += q0 * gy - q1 * gz + q3 * gx;
+    f->q3 += q0 * gz + q1 * gy - q2 * gx;
+
+    float recip = 1.0f / sqrtf(f->q0 * f->q0 + f->q1 * f->q1 + f->q2 * f->q2 + f->q3 * f->q3);
+    f->q0 *= recip;
+    f->q1 *= recip;
+    f->q2 *= recip;
+    f->q3 *= recip;
+}
+
+
+void mahony_euler(const mahony_t *f, euler_t *angles)
+{
+    quaternion_to_euler(f->q0, f->q1, f->q2, f->q3, angles);
+}
+
+
+// Fixed-point helpers
+static inline int32_t mul30(int32_t a, int32_t b)
+{
+    return (int32_t) (((int64_t) a * b) >> 30);
+}
+
+
+static uint32_t isqrt64(uint64_t value)
+{
+    uint64_t result = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while (bit > value)
+        bit >>= 2;
+    while (bit != 0) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        }
+        else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t) result;
+}
+
+
+void mahony_fx_init(mahony_fx_t *f, float kp, float ki, float gyro_lsb_per_dps)
+{
+    f->q0 = MAHONY_Q30_ONE;
+    f->q1 = f->q2 = f->q3 = 0;
+    f->ix = f->iy = f->iz = 0;
+    f->kp = (int32_t) (kp * MAHONY_Q16_ONE);
+    f->ki = (int32_t) (ki * MAHONY_Q16_ONE);
+    f->gyro_scale = (int32_t) (DEG_TO_RAD_F / gyro_lsb_per_dps * MAHONY_Q30_ONE);
+}
+
+
+void mahony_fx_update(mahony_fx_t *f, int16_t ax, int16_t ay, int16_t az,
+                      int16_t gx, int16_t gy, int16_t gz, uint32_t dt_us)
+{
+    // Rates in Q16 rad/s
+    int32_t rx = (int32_t) (((int64_t) gx * f->gyro_scale) >> 14);
+    int32_t ry = (int32_t) (((int64_t) gy * f->gyro_scale) >> 14);
+    int32_t rz = (int32_t) (((int64_t) gz * f->gyro_scale) >> 14);
+
+    uint32_t norm = isqrt64((int64_t) ax * ax + (int64_t) ay * ay + (int64_t) az * az);
+    if (norm > 0) {
+        // Unit gravity in Q30
+        int32_t nx = (int32_t) (((int64_t) ax << 30) / norm);
+        int32_t ny = (int32_t) (((int64_t) ay << 30) / norm);
+        int32_t nz = (int32_t) (((int64_t) az << 30) / norm);
+
+        int32_t vx = mul30(f->q1, f->q3) - mul30(f->q0, f->q2);
+        int32_t vy = mul30(f->q0, f->q1) + mul30(f->q2, f->q3);
+        int32_t vz = mul30(f->q0, f->q0) - MAHONY_Q30_ONE / 2 + mul30(f->q3, f->q3);
+
+        int32_t ex = mul30(ny, vz) - mul30(nz, vy);
+        int32_t ey = mul30(nz, vx) - mul30(nx, vz);
+        int32_t ez = mul30(nx, vy) - mul30(ny, vx);
+
+        if (f->ki > 0) {
+            // 2 * ki * e * dt, Q16 x Q30 -> Q30
+            f->ix += (int32_t) ((((int64_t) f->ki * ex) * dt_us / 1000000) >> 15);
+            f->iy += (int32_t) ((((int64_t) f->ki * ey) * dt_us / 1000000) >> 15);
+            f->iz += (int32_t) ((((int64_t) f->ki * ez) * dt_us / 1000000) >> 15);
+            rx += f->ix >> 14;
+            ry += f->iy >> 14;
+            rz += f->iz >> 14;
+        }
+        rx += (int32_t) (((int64_t) f->kp * ex) >> 29);
+        ry += (int32_t) (((int64_t) f->kp * ey) >> 29);
+        rz += (int32_t) (((int64_t) f->kp * ez) >> 29);
+    }
+
+    // Half rotation over dt in Q30
+    int32_t hx = (int32_t) ((((int64_t) rx * dt_us) << 14) / 2000000);
+    int32_t hy = (int32_t) ((((int64_t) ry * dt_us) << 14) / 2000000);
+    int32_t hz = (int32_t) ((((int64_t) rz * dt_us) << 14) / 2000000);
+
+    int32_t q0 = f->q0;
+    int32_t q1 = f->q1;
+    int32_t q2 = f->q2;
+    int32_t q3 = f->q3;
+    q0 += -mul30(f->q1, hx) - mul30(f->q2, hy) - mul30(f->q3, hz);
+    q1 += mul30(f->q0, hx) + mul30(f->q2, hz) - mul30(f->q3, hy);
+    q2 += mul30(f->q0, hy) - mul30(f->q1, hz) + mul30(f->q3, hx);
+    q3 += mul30(f->q0, hz) + mul30(f->q1, hy) - mul30(f->q2, hx);
+
+    uint32_t length = isqrt64((int64_t) q0 * q0 + (int64_t) q1 * q1 +
+                              (int64_t) q2 * q2 + (int64_t) q3 * q3);
+    f->q0 = (int32_t) (((int64_t) q0 << 30) / length);
+    f->q1 = (int32_t) (((int64_t) q1 << 30) / length);
+    f->q2 = (int32_t) (((int64_t) q2 << 30) / length);
+    f->q3 = (int32_t) (((int64_t) q3 << 30) / length);
+}
+
+
+void mahony_fx_euler(const mahony_fx_t *f, euler_t *angles)
+{
+    const float scale = 1.0f / MAHONY_Q30_ONE;
+
+    quaternion_to_euler(f->q0 * scale, f->q1 * scale, f->q2 * scale, f->q3 * scale, angles);
+}
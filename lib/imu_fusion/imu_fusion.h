@@ -0,0 +1,69 @@
+/*
+ * Mahony quaternion sensor fusion for the MPU6050.
+ *
+ * Replaces the complementary filter of MPU6050_light (`getAngleX/Y/Z`):
+ * the attitude is kept as a quaternion, so roll and pitch no longer
+ * couple at large tilts and yaw only drifts with the residual gyro bias,
+ * which the integral term tracks.
+ *
+ * Two paths with the same filter:
+ *   float  - `mahony_update()`, fed with g and deg/s (MPU6050_light units)
+ *   fixed  - `mahony_fx_update()`, fed with raw int16 sensor counts, all
+ *            integer math (quaternion in Q30, rates in Q16)
+ *
+ * Library is shared by gesture-tester and tello-hand (`lib_extra_dirs`)
+ * and has no Arduino dependency, so it also builds on the host.
+ */
+
+#ifndef IMU_FUSION_H
+#define IMU_FUSION_H
+
+#include <stdint.h>
+
+// Default gains
+#define MAHONY_KP  2.0f
+#define MAHONY_KI  0.02f
+
+typedef struct {
+    float roll;    // Rotation about X [deg]
+    float pitch;   // Rotation about Y [deg]
+    float yaw;     // Rotation about Z [deg]
+} euler_t;
+
+// Float path
+typedef struct {
+    float q0, q1, q2, q3;   // Attitude quaternion
+    float ix, iy, iz;       // Integral feedback [rad/s]
+    float kp, ki;
+} mahony_t;
+
+void mahony_init(mahony_t *f, float kp, float ki);
+
+// acc in g (any scale), gyro in deg/s, dt in s
+void mahony_update(mahony_t *f, float ax, float ay, float az,
+                   float gx, float gy, float gz, float dt);
+
+void mahony_euler(const mahony_t *f, euler_t *angles);
+
+// Fixed-point path
+#define MAHONY_Q30_ONE  (1L << 30)
+#define MAHONY_Q16_ONE  (1L << 16)
+
+typedef struct {
+    int32_t q0, q1, q2, q3;   // Q30
+    int32_t ix, iy, iz;       // Q30 rad/s
+    int32_t kp, ki;           // Q16
+    int32_t gyro_scale;       // Q30 rad/s per gyro count
+} mahony_fx_t;
+
+// `gyro_lsb_per_dps`: 131 for +-250 deg/s, 65.5 for +-500 deg/s, ...
+void mahony_fx_init(mahony_fx_t *f, float kp, float ki, float gyro_lsb_per_dps);
+
+// Raw accelerometer and gyro counts, dt in microseconds
+void mahony_fx_update(mahony_fx_t *f, int16_t ax, int16_t ay, int16_t az,
+                      int16_t gx, int16_t gy, int16_t gz, uint32_t dt_us);
+
+// Conversion to angles uses float, call it at display/control rate only
+void mahony_fx_euler(const mahony_fx_t *f, euler_t *angles);
+
+#endif
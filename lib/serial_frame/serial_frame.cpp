@@ -0,0 +1,106 @@
+/*
+ * Binary serial frames, see `serial_frame.h`.
+ */
+
+#include <string.h>
+#include "serial_frame.h"
+
+typedef enum {
+    FRAME_HUNT = 0,
+    FRAME_TYPE,
+    FRAME_LENGTH,
+    FRAME_PAYLOAD,
+    FRAME_CRC_LOW,
+    FRAME_CRC_HIGH
+} frame_state_t;
+
+
+uint16_t frame_crc16(uint16_t crc, const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        crc ^= (uint16_t) data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+
+size_t frame_encode(uint8_t type, const void *payload, size_t length, uint8_t *out)
+{
+    if (length > FRAME_MAX_PAYLOAD)
+        return 0;
+    out[0] = FRAME_SYNC;
+    out[1] = type;
+    out[2] = (uint8_t) length;
+    if (length > 0)
+        memcpy(out + 3, payload, length);
+    uint16_t crc = frame_crc16(0xFFFF, out + 1, length + 2);
+    out[3 + length] = crc & 0xFF;
+    out[4 + length] = crc >> 8;
+    return length + FRAME_OVERHEAD;
+}
+
+
+void frame_decoder_init(frame_decoder_t *decoder)
+{
+    memset(decoder, 0, sizeof(*decoder));
+}
+
+
+bool frame_decode(frame_decoder_t *d, uint8_t byte)
+{
+    switch (d->state) {
+        case FRAME_HUNT:
+            if (byte == FRAME_SYNC)
+                d->state = FRAME_TYPE;
+            else
+                d->skipped++;
+        break;
+
+        case FRAME_TYPE:
+            d->type = byte;
+            d->crc = frame_crc16(0xFFFF, &byte, 1);
+            d->state = FRAME_LENGTH;
+        break;
+
+        case FRAME_LENGTH:
+            if (byte > FRAME_MAX_PAYLOAD) {
+                d->crc_errors++;
+                d->state = FRAME_HUNT;
+                break;
+            }
+            d->length = byte;
+            d->received = 0;
+            d->crc = frame_crc16(d->crc, &byte, 1);
+            d->state = byte > 0 ? FRAME_PAYLOAD : FRAME_CRC_LOW;
+        break;
+
+        case FRAME_PAYLOAD:
+            d->payload[d->received++] = byte;
+            if (d->received == d->length) {
+                d->crc = frame_crc16(d->crc, d->payload, d->length);
+                d->state = FRAME_CRC_LOW;
+            }
+        break;
+
+        case FRAME_CRC_LOW:
+            if (byte != (d->crc & 0xFF)) {
+                d->crc_errors++;
+                d->state = FRAME_HUNT;
+                break;
+            }
+            d->state = FRAME_CRC_HIGH;
+        break;
+
+        case FRAME_CRC_HIGH:
+            d->state = FRAME_HUNT;
+            if (byte != (d->crc >> 8)) {
+                d->crc_errors++;
+                break;
+            }
+            d->frames++;
+            return true;
+    }
+    return false;
+}
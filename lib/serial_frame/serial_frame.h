@@ -0,0 +1,51 @@
+/*
+ * Compact binary frames for a serial link.
+ *
+ *   0xA5 | type | length | payload[length] | crc16 (little endian)
+ *
+ * The CRC is CRC-16/CCITT-FALSE over type, length and payload. The sync
+ * byte is never part of ASCII text, so frames can share a port with log
+ * lines: the decoder skips everything outside a frame and resynchronizes
+ * after a corrupted one.
+ *
+ * Used by the tello-hand serial bridge and the gesture-tester capture
+ * stream, both through `lib_extra_dirs`. Plain C++ on purpose: the host
+ * bridge bench links the same encoder and decoder.
+ */
+
+#ifndef SERIAL_FRAME_H
+#define SERIAL_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FRAME_SYNC          0xA5
+#define FRAME_MAX_PAYLOAD   250
+#define FRAME_OVERHEAD      5
+#define FRAME_MAX_LENGTH    (FRAME_MAX_PAYLOAD + FRAME_OVERHEAD)
+
+typedef struct {
+    uint8_t state;
+    uint8_t type;
+    uint8_t length;
+    uint8_t received;
+    uint16_t crc;
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    uint32_t frames;          // Valid frames decoded
+    uint32_t crc_errors;
+    uint32_t skipped;         // Bytes outside any frame
+} frame_decoder_t;
+
+uint16_t frame_crc16(uint16_t crc, const uint8_t *data, size_t length);
+
+// Write a frame to `out` (FRAME_OVERHEAD + length bytes), returns its
+// length, 0 if the payload is too long
+size_t frame_encode(uint8_t type, const void *payload, size_t length, uint8_t *out);
+
+void frame_decoder_init(frame_decoder_t *decoder);
+
+// Feed one received byte; true when `type`, `length` and `payload` hold
+// a complete frame with a valid CRC
+bool frame_decode(frame_decoder_t *decoder, uint8_t byte);
+
+#endif
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""
+Sustained echo throughput of the serial-echo firmware.
+
+Streams numbered lines of printable text to the board and checks what
+comes back. At most --window bytes are in flight, so the measurement is
+the rate the echo keeps up with rather than how much the UART buffers
+absorb. Reports, after a one second warm-up:
+    throughput   echoed bytes/s and the share of the line rate
+    lines        echoed intact, corrupted, and lost (sequence gaps)
+    latency      send to echo of each line, p50/p99/max
+
+The port is opened raw through termios, no pyserial needed (Linux, or
+any POSIX system that has the baud rate constant).
+
+Usage:
+    python3 echo_throughput.py /dev/ttyUSB0 [--baud 921600] [--seconds 10]
+                               [--line-length 64] [--window 2048]
+"""
+
+import argparse
+import os
+import random
+import select
+import string
+import sys
+import termios
+import threading
+import time
+import tty
+
+WARMUP = 1.0
+
+
+def open_port(path, baud):
+    speed = getattr(termios, f"B{baud}", None)
+    if speed is None:
+        sys.exit(f"baud rate {baud} not supported by termios here")
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(fd)
+    attributes = termios.tcgetattr(fd)
+    attributes[4] = attributes[5] = speed
+    termios.tcsetattr(fd, termios.TCSANOW, attributes)
+    termios.tcflush(fd, termios.TCIOFLUSH)
+    return fd
+
+
+def make_line(sequence, length, rng):
+    body = "".join(rng.choice(string.ascii_letters + string.digits) for _ in range(length - 10))
+    return f"{sequence:08d} {body}\n".encode()
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    return values[int(p * (len(values) - 1) + 0.5)]
+
+
+class Stream:
+    def __init__(self, fd, args):
+        self.fd = fd
+        self.args = args
+        self.rng = random.Random(args.seed)
+        self.lock = threading.Condition()
+        self.sent_bytes = 0
+        self.received_bytes = 0
+        self.lines = {}          # sequence -> (text, send time)
+        self.done = False
+
+    def writer(self, end):
+        sequence = 0
+        while time.monotonic() < end:
+            line = make_line(sequence, self.args.line_length, self.rng)
+            with self.lock:
+                while self.sent_bytes - self.received_bytes + len(line) > self.args.window:
+                    if not self.lock.wait(0.5):
+                        # Echo stalled or lost: give the window back
+                        self.received_bytes = self.sent_bytes
+                self.lines[sequence] = (line, time.monotonic())
+                self.sent_bytes += len(line)
+            view = memoryview(line)
+            while view:
+                written = os.write(self.fd, view)
+                view = view[written:]
+            sequence += 1
+        with self.lock:
+            self.done = True
+        return sequence
+
+    def reader(self, results, start):
+        pending = b""
+        idle_until = None
+        while True:
+            ready, _, _ = select.select([self.fd], [], [], 0.2)
+            if not ready:
+                with self.lock:
+                    if self.done and (idle_until is None or time.monotonic() > idle_until):
+                        return
+                    idle_until = idle_until or time.monotonic() + 1.0
+                continue
+            idle_until = None
+            data = os.read(self.fd, 65536)
+            now = time.monotonic()
+            with self.lock:
+                self.received_bytes += len(data)
+                self.lock.notify()
+            pending += data
+            *complete, pending = pending.split(b"\n")
+            for line in complete:
+                self.check(line + b"\n", now, results, start)
+
+    def check(self, line, now, results, start):
+        try:
+            sequence = int(line[:8])
+        except ValueError:
+            results["corrupt"] += 1
+            return
+        with self.lock:
+            expected = self.lines.pop(sequence, None)
+        if expected is None or expected[0] != line:
+            results["corrupt"] += 1
+            return
+        results["intact"] += 1
+        results["last"] = max(results["last"], sequence)
+        if expected[1] - start >= WARMUP:
+            results["bytes"] += len(line)
+            results["latency"].append((now - expected[1]) * 1000.0)
+            results["end"] = now
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port")
+    parser.add_argument("--baud", type=int, default=921600)
+    parser.add_argument("--seconds", type=float, default=10.0)
+    parser.add_argument("--line-length", type=int, default=64)
+    parser.add_argument("--window", type=int, default=2048, help="bytes in flight at most")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+    if args.line_length < 12:
+        sys.exit("--line-length must be at least 12")
+
+    fd = open_port(args.port, args.baud)
+    stream = Stream(fd, args)
+    results = {"intact": 0, "corrupt": 0, "last": -1, "bytes": 0, "latency": [], "end": 0.0}
+    start = time.monotonic()
+    reader = threading.Thread(target=stream.reader, args=(results, start), daemon=True)
+    reader.start()
+    lines_sent = stream.writer(start + args.seconds)
+    reader.join()
+    os.close(fd)
+
+    elapsed = results["end"] - start - WARMUP
+    rate = results["bytes"] / elapsed if elapsed > 0 else 0.0
+    line_rate = args.baud / 10.0   # 8N1
+    lost = lines_sent - results["intact"] - results["corrupt"]
+    latency = results["latency"]
+    print(f"throughput: {rate:.0f} B/s echoed, {100.0 * rate / line_rate:.1f}% of {args.baud} baud")
+    print(f"lines: {lines_sent} sent, {results['intact']} intact, {results['corrupt']} corrupt, "
+          f"{lost} lost")
+    print(f"latency: p50 {percentile(latency, 0.5):.2f} p99 {percentile(latency, 0.99):.2f} "
+          f"max {max(latency, default=0.0):.2f} ms")
+
+
+if __name__ == "__main__":
+    main()
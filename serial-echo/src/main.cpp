@@ -3,77 +3,290 @@
  *
  * Description (for SSD1306):
  *   https://techexplorations.com/blog/drones/empowering-education-exploring-open-source-hardware-drone-control-with-esp32-and-the-tello-api/
- * 
+ *
  * Code:
  *   https://github.com/jsolderitsch/ESP32Controller
- * 
+ *
  * Library Required: Adafruit GFX Library (Version 1.11.9)
  *                   Adafruit_ESP32_SH1106 (Version 1.0.2)
+ *
+ * Reception is event driven: the UART driver fills a large receive
+ * buffer, and the HardwareSerial event task calls `on_receive()` when the
+ * RX FIFO fills or the line goes idle. The callback echoes the bytes at
+ * once and copies them into a ring buffer for the display, so `loop()`
+ * and the OLED never slow the echo down.
+ *
+ * The OLED is a scrolling console: the top row shows bytes/s and UART
+ * overruns, the rows below the last lines received, wrapped at 21
+ * characters. Scrolling moves the SH1106 display start line instead of
+ * redrawing the screen, so a new line rewrites three 128-byte pages (the
+ * finished line, the empty row below it and the status row) rather than
+ * the whole 1 KB frame.
+ *
+ * `host/echo_throughput.py` measures the sustained echo throughput.
  */
 
 #include <Wire.h>
 #include <Adafruit_GFX.h>
 #include <Adafruit_SH1106.h>
+#include <atomic>
 
+#ifndef SERIAL_BAUD
+#define SERIAL_BAUD          921600
+#endif
+// UART driver buffers: about 180 ms of input at 921600 baud
+#define SERIAL_RX_BUFFER     16384
+#define SERIAL_TX_BUFFER     4096
+// Bytes read and echoed at a time by the receive callback
+#define ECHO_CHUNK           256
 
-const unsigned int MAX_MESSAGE_LENGTH = 24;
+// Received bytes waiting for the display, power of two
+#define CONSOLE_RING_SIZE    8192
+
+#define OLED_WIDTH           128
+#define OLED_PAGES           8
+#define OLED_I2C_ADDRESS     0x3C
+// SH1106 RAM is 132 columns wide, the visible 128 start at column 2
+#define OLED_COLUMN_OFFSET   2
+#define OLED_CHUNK_LENGTH    32
+#define OLED_I2C_CLOCK_HZ    400000
+
+// Row 0 status, rows 1--6 received lines, row 7 the line being received
+#define CONSOLE_COLUMNS      (OLED_WIDTH / 6)
+#define CONSOLE_LINES        (OLED_PAGES - 2)
+#define CURRENT_ROW          (OLED_PAGES - 1)
+#define DISPLAY_PERIOD_MS    50
 
 // Declaration for an SH1106 display connected to I2C (SDA, SCL pins)
 #define OLED_RESET 4  // Reset pin
 Adafruit_SH1106 display(OLED_RESET);
 
+// Written by the UART event task only
+static uint8_t console_ring[CONSOLE_RING_SIZE];
+static std::atomic<uint32_t> ring_head{0};
+static std::atomic<uint32_t> ring_tail{0};
+static std::atomic<uint32_t> rx_bytes{0};
+static std::atomic<uint32_t> overruns{0};      // UART FIFO or driver buffer full
+static std::atomic<uint32_t> rx_errors{0};     // Framing, parity and break
+
+// Console text, loop() only
+static char history[CONSOLE_LINES][CONSOLE_COLUMNS + 1];
+static uint8_t history_head = 0;     // Oldest line
+static char current[CONSOLE_COLUMNS + 1];
+static uint8_t current_length = 0;
+static bool current_dirty = true;
+static uint32_t scrolls = 0;         // New lines since the last frame
+static uint8_t start_page = 0;       // Panel page shown as row 0
+
+static char status[CONSOLE_COLUMNS + 1];
+static bool status_dirty = true;
+
+
+// UART event task: echo and hand the bytes to the display
+void on_receive()
+{
+    uint8_t chunk[ECHO_CHUNK];
+    int available;
+
+    while ((available = Serial.available()) > 0) {
+        size_t length = Serial.read(chunk, min((size_t) available, sizeof(chunk)));
+        Serial.write(chunk, length);
+        rx_bytes.fetch_add(length, std::memory_order_relaxed);
+
+        uint32_t head = ring_head.load(std::memory_order_relaxed);
+        uint32_t space = CONSOLE_RING_SIZE - (head - ring_tail.load(std::memory_order_acquire));
+        // The echo is complete, the display skips what does not fit
+        uint32_t copied = min((uint32_t) length, space);
+        for (uint32_t i = 0; i < copied; i++)
+            console_ring[(head + i) & (CONSOLE_RING_SIZE - 1)] = chunk[i];
+        ring_head.store(head + copied, std::memory_order_release);
+    }
+}
+
+
+void on_receive_error(hardwareSerial_error_t error)
+{
+    if (error == UART_FIFO_OVF_ERROR || error == UART_BUFFER_FULL_ERROR)
+        overruns.fetch_add(1, std::memory_order_relaxed);
+    else
+        rx_errors.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+void oled_command(uint8_t command)
+{
+    Wire.beginTransmission(OLED_I2C_ADDRESS);
+    Wire.write((uint8_t) 0x00);   // Co = 0, D/C = 0: command stream
+    Wire.write(command);
+    Wire.endTransmission();
+}
+
+
+void write_page(uint8_t page, const uint8_t *data)
+{
+    for (uint8_t x = 0; x < OLED_WIDTH; x += OLED_CHUNK_LENGTH) {
+        uint8_t column = x + OLED_COLUMN_OFFSET;
+        Wire.beginTransmission(OLED_I2C_ADDRESS);
+        Wire.write((uint8_t) 0x00);
+        Wire.write(0xB0 | page);              // Page address
+        Wire.write(0x00 | (column & 0x0F));   // Lower column address
+        Wire.write(0x10 | (column >> 4));     // Higher column address
+        Wire.endTransmission();
+
+        Wire.beginTransmission(OLED_I2C_ADDRESS);
+        Wire.write((uint8_t) 0x40);   // D/C = 1: data stream
+        Wire.write(data + x, OLED_CHUNK_LENGTH);
+        Wire.endTransmission();
+    }
+}
+
+
+// Render one text row and send it to the panel page that shows `row`
+void draw_row(uint8_t row, const char *text)
+{
+    static GFXcanvas1 canvas(OLED_WIDTH, 8);
+    uint8_t page[OLED_WIDTH];
+
+    canvas.fillScreen(BLACK);
+    canvas.setTextSize(1);
+    canvas.setTextColor(WHITE);
+    canvas.setTextWrap(false);
+    canvas.setCursor(0, 0);
+    canvas.print(text);
+
+    // Canvas rows are horizontal bytes (MSB left), SH1106 pages vertical (LSB top)
+    const uint8_t *rows = canvas.getBuffer();
+    for (uint8_t x = 0; x < OLED_WIDTH; x++) {
+        uint8_t column = 0;
+        for (uint8_t y = 0; y < 8; y++) {
+            if (rows[y * (OLED_WIDTH / 8) + x / 8] & (0x80 >> (x % 8)))
+                column |= 1 << y;
+        }
+        page[x] = column;
+    }
+    write_page((start_page + row) % OLED_PAGES, page);
+}
+
+
+const char *line_text(uint8_t row)
+{
+    return history[(history_head + row - 1) % CONSOLE_LINES];
+}
+
+
+void new_line()
+{
+    memcpy(history[history_head], current, sizeof(current));
+    history_head = (history_head + 1) % CONSOLE_LINES;
+    current_length = 0;
+    current[0] = '\0';
+    current_dirty = true;
+    scrolls++;
+}
+
+
+// Received bytes into console lines, wrapped at the screen width
+void drain_console()
+{
+    uint32_t tail = ring_tail.load(std::memory_order_relaxed);
+    uint32_t head = ring_head.load(std::memory_order_acquire);
+
+    for (; tail != head; tail++) {
+        char c = console_ring[tail & (CONSOLE_RING_SIZE - 1)];
+        if (c == '\n') {
+            new_line();
+            continue;
+        }
+        if (c == '\r')
+            continue;
+        if (current_length == CONSOLE_COLUMNS)
+            new_line();
+        current[current_length++] = (c >= ' ' && c <= '~') ? c : '.';
+        current[current_length] = '\0';
+        current_dirty = true;
+    }
+    ring_tail.store(tail, std::memory_order_release);
+}
+
+
+void update_status()
+{
+    static uint32_t last_bytes = 0;
+    static unsigned long last_time = 0;
+    unsigned long now = millis();
+
+    if (now - last_time < 1000)
+        return;
+    uint32_t bytes = rx_bytes.load(std::memory_order_relaxed);
+    uint32_t rate = (uint64_t) (bytes - last_bytes) * 1000 / (now - last_time);
+    last_bytes = bytes;
+    last_time = now;
+
+    char text[sizeof(status) + 16];
+    snprintf(text, sizeof(text), "%lu B/s ov %lu er %lu", (unsigned long) rate,
+             (unsigned long) overruns.load(std::memory_order_relaxed),
+             (unsigned long) rx_errors.load(std::memory_order_relaxed));
+    text[CONSOLE_COLUMNS] = '\0';
+    if (strcmp(text, status) != 0) {
+        strcpy(status, text);
+        status_dirty = true;
+    }
+}
+
+
+// Scroll by moving the display start line, then redraw only the rows
+// whose text changed: the new lines, the current one and the status
+void render()
+{
+    // Rows that still show a line kept their panel page
+    uint8_t first_new = scrolls >= CURRENT_ROW ? 1 : CURRENT_ROW - scrolls;
+
+    if (scrolls > 0) {
+        start_page = (start_page + scrolls) % OLED_PAGES;
+        oled_command(0x40 | (start_page * 8));   // Display start line
+        status_dirty = true;
+        current_dirty = true;
+    }
+    for (uint8_t row = first_new; row < CURRENT_ROW; row++)
+        draw_row(row, line_text(row));
+    if (current_dirty)
+        draw_row(CURRENT_ROW, current);
+    if (status_dirty)
+        draw_row(0, status);
+
+    scrolls = 0;
+    current_dirty = false;
+    status_dirty = false;
+}
+
 
 void setup()
 {
-    Serial.begin(115200);
+    Serial.setRxBufferSize(SERIAL_RX_BUFFER);
+    Serial.setTxBufferSize(SERIAL_TX_BUFFER);
+    Serial.begin(SERIAL_BAUD);
     while (!Serial);
+    Serial.onReceive(on_receive);
+    Serial.onReceiveError(on_receive_error);
 
     // Initialize OLED display with I2C address 0x3C
     // SSD1306_SWITCHCAPVCC = generate display voltage from 3.3V internally
     display.begin(SH1106_SWITCHCAPVCC, 0x3C);
-    delay(500);
-
-    display.display();
-    display.setTextSize(1);
-    display.setTextColor(WHITE);
-    display.setRotation(0);
+    Wire.setClock(OLED_I2C_CLOCK_HZ);
     display.clearDisplay();
-    display.setCursor(0, 0);
+    display.display();
+
+    // From here on the console writes the panel pages directly
+    strcpy(status, "waiting");
+    for (uint8_t row = 0; row < OLED_PAGES; row++)
+        draw_row(row, row == 0 ? status : "");
 }
 
 
 void loop()
 {
-    display.clearDisplay();    // Clear the buffer
-    display.setCursor(0,0);    // Set cursor to the top-left corner
-
-    // Check to see if anything is available in the serial receive buffer
-    while (Serial.available() > 0) {
-        // Create a place to hold the incoming message
-        static char message[MAX_MESSAGE_LENGTH];
-        static unsigned int message_pos = 0;
-
-        // Read the next available byte in the serial receive buffer
-        char inByte = Serial.read();
-
-        // Message coming in (check not terminating character) and guard for over message size
-        if (inByte != '\n' && (message_pos < MAX_MESSAGE_LENGTH - 1)) {
-            //Add the incoming byte to our message
-            message[message_pos] = inByte;
-            message_pos++;
-        }
-        // Full message received...
-        else {
-            // Add null character to string
-            message[message_pos] = '\0';
-
-            // Print the message (or do other things)
-            Serial.println(message);
-
-            display.println("Message: ");
-            display.println(message);
-            display.display();  // Update the OLED display
-            message_pos = 0;
-        }
-    }
+    drain_console();
+    update_status();
+    render();
+    delay(DISPLAY_PERIOD_MS);
 }
@@ -0,0 +1,505 @@
+/*
+ * Serial bridge benchmark against the Tello emulator (`tello_stub.py`).
+ *
+ * Rebuilds the bridge mode of the firmware on Linux. A socket pair stands
+ * in for the USB serial port, each direction paced to the byte rate of the
+ * baud rate (-b, 8N1). On the firmware side
+ *   uart   thread like the UART event task, feeds bridge_receive()
+ *   comms  thread like comms_task(): ground station commands from a ring,
+ *          the command engine and the state stream relayed upstream
+ *   rc     thread like the rc stream, the latest setpoint at 20 Hz
+ * and on the ground station side a client that sends rc frames at -r Hz
+ * with -k setpoints each and keeps "battery?" commands in flight.
+ *
+ * Reports:
+ *   acks     command to answer frame, p50/p99/max, and rejected commands
+ *   rc       setpoints sent, handed on, and rc datagrams the emulator got
+ *   state    state frames/s relayed
+ *   serial   bytes/s each way and the share of the line rate
+ *
+ *   python3 tello_stub.py --quiet --port 9889 &
+ *   g++ -O2 -pthread -I ../include -I ../../lib/serial_frame bridge_bench.cpp \
+ *       ../src/serial_bridge.cpp ../src/command_engine.cpp ../src/tello_state.cpp \
+ *       ../../lib/serial_frame/serial_frame.cpp -o bridge_bench
+ *   ./bridge_bench [-p port] [-s state port] [-b baud] [-d seconds] [-r rc Hz] [-k batch]
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "command_engine.h"
+#include "rc_format.h"
+#include "serial_bridge.h"
+#include "serial_frame.h"
+#include "spsc_ring.h"
+#include "tello_state.h"
+
+#define TICK_US           1000   // FreeRTOS tick of the comms task wait
+#define RC_RATE_HZ        20     // RC_STREAM_RATE_HZ of the firmware
+#define COMMAND_TIMEOUT   10000  // BRIDGE_TIMEOUT_MS
+#define READ_PERIOD_MS    100    // "battery?" while fewer are in flight
+
+typedef struct {
+    char text[CMD_MAX_LENGTH];
+    uint32_t timeout_ms;
+} command_msg_t;
+
+// One direction of the serial line
+typedef struct {
+    int fd;
+    uint64_t free_us;            // When the last byte written is on the wire
+    uint64_t bytes;
+    std::mutex mutex;
+} line_t;
+
+static SpscRing<command_msg_t, BRIDGE_PENDING> bridgeRing;
+
+static std::mutex notify_mutex;
+static std::condition_variable notify_cv;
+static bool notified = false;
+
+static int sock = -1;
+static int state_sock = -1;
+static uint32_t baud = 921600;
+static line_t upstream;          // Firmware to ground station
+static line_t downstream;
+static std::atomic<bool> running{true};
+static std::atomic<uint32_t> rc_word{0};
+static std::atomic<uint32_t> rc_sent{0};
+
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static uint32_t host_now_ms(void)
+{
+    return (uint32_t) (now_us() / 1000);
+}
+
+
+// Blocks like a full UART transmit FIFO once the line is behind
+static void line_write(line_t *line, const uint8_t *data, size_t length)
+{
+    std::lock_guard<std::mutex> lock(line->mutex);
+    uint64_t now = now_us();
+    line->free_us = std::max(line->free_us, now) + length * 10000000ULL / baud;
+    line->bytes += length;
+    while (length > 0) {
+        ssize_t written = write(line->fd, data, length);
+        if (written <= 0)
+            return;
+        data += written;
+        length -= written;
+    }
+    if (line->free_us > now + 1000)
+        usleep(line->free_us - now - 1000);
+}
+
+
+static bool host_send(const uint8_t *data, size_t length)
+{
+    return send(sock, data, length, 0) == (ssize_t) length;
+}
+
+
+static int host_receive(uint8_t *data, size_t size)
+{
+    ssize_t length = recv(sock, data, size, MSG_DONTWAIT);
+    return length > 0 ? (int) length : 0;
+}
+
+
+static void on_response(const char *command, cmd_result_t result,
+                        const char *response, uint32_t rtt_ms)
+{
+    bridge_on_response(command, result, response, rtt_ms);
+}
+
+
+static void notify_comms(void)
+{
+    std::lock_guard<std::mutex> lock(notify_mutex);
+    notified = true;
+    notify_cv.notify_one();
+}
+
+
+// bridge_io_t of the firmware
+static void io_write(const uint8_t *data, size_t length)
+{
+    line_write(&upstream, data, length);
+}
+
+
+static void io_set_rc(const rc_setpoint_t *sp)
+{
+    rc_word = rc_setpoint_word(sp);
+}
+
+
+static bool io_command(const char *text)
+{
+    command_msg_t msg;
+
+    strncpy(msg.text, text, CMD_MAX_LENGTH - 1);
+    msg.text[CMD_MAX_LENGTH - 1] = '\0';
+    msg.timeout_ms = COMMAND_TIMEOUT;
+    if (!bridgeRing.push(msg))
+        return false;
+    notify_comms();
+    return true;
+}
+
+
+static void uart_thread(void)
+{
+    uint8_t data[64];
+
+    while (running) {
+        ssize_t length = read(upstream.fd, data, sizeof(data));
+        if (length <= 0)
+            break;
+        bridge_receive(data, length);
+    }
+}
+
+
+static void comms_thread(void)
+{
+    static const cmd_transport_t transport = {host_send, host_receive, host_now_ms};
+    command_msg_t msg;
+    char datagram[TELLO_STATE_MAX_LENGTH];
+    tello_state_t state = {};
+
+    cmd_engine_init(&transport, on_response);
+    while (running) {
+        while (bridgeRing.pop(msg)) {
+            if (!cmd_engine_submit(msg.text, msg.timeout_ms))
+                bridge_on_dropped(msg.text);
+        }
+        ssize_t length;
+        while ((length = recv(state_sock, datagram, sizeof(datagram), MSG_DONTWAIT)) > 0) {
+            if (tello_state_parse(datagram, length, &state))
+                bridge_on_state(&state);
+        }
+        cmd_engine_poll();
+
+        // ulTaskNotifyTake(pdTRUE, 1)
+        std::unique_lock<std::mutex> lock(notify_mutex);
+        notify_cv.wait_for(lock, std::chrono::microseconds(TICK_US), [] { return notified; });
+        notified = false;
+    }
+}
+
+
+static void rc_thread(void)
+{
+    char text[RC_FORMAT_MAX_LENGTH];
+    uint64_t next = now_us();
+
+    while (running) {
+        // The firmware polls from the control task, at the IMU rate
+        bridge_poll();
+        uint32_t word = rc_word;
+        rc_setpoint_t sp;
+        memcpy(&sp, &word, sizeof(sp));
+        size_t length = rc_format(text, &sp);
+        if (host_send((const uint8_t *) text, length + 1))
+            rc_sent++;
+        next += 1000000 / RC_RATE_HZ;
+        uint64_t now = now_us();
+        if (next > now)
+            usleep(next - now);
+    }
+}
+
+
+// Ground station side
+typedef struct {
+    std::mutex mutex;
+    uint64_t sent_us[256];
+    uint8_t outstanding;
+    std::vector<double> latency_ms;
+    uint32_t rejected;
+    uint32_t unmatched;
+    uint32_t states;
+    uint32_t acks;
+    char last_answer[FRAME_MAX_PAYLOAD];
+    uint8_t last_seq;
+    bridge_stats_t stats;
+} client_t;
+
+static client_t client;
+
+
+static void client_reader(int fd)
+{
+    frame_decoder_t decoder;
+    uint8_t data[256];
+
+    frame_decoder_init(&decoder);
+    while (true) {
+        ssize_t length = read(fd, data, sizeof(data));
+        if (length <= 0)
+            return;
+        uint64_t now = now_us();
+        for (ssize_t i = 0; i < length; i++) {
+            if (!frame_decode(&decoder, data[i]))
+                continue;
+            std::lock_guard<std::mutex> lock(client.mutex);
+            if (decoder.type == BRIDGE_STATE) {
+                client.states++;
+            }
+            else if (decoder.type == BRIDGE_STATS && decoder.length == sizeof(bridge_stats_t)) {
+                memcpy(&client.stats, decoder.payload, sizeof(bridge_stats_t));
+            }
+            else if (decoder.type == BRIDGE_ACK && decoder.length >= 4) {
+                uint8_t seq = decoder.payload[0];
+                client.acks++;
+                if (seq == BRIDGE_SEQ_NONE || client.sent_us[seq] == 0) {
+                    client.unmatched++;
+                    continue;
+                }
+                if (decoder.payload[1] == BRIDGE_REJECTED)
+                    client.rejected++;
+                else
+                    client.latency_ms.push_back((now - client.sent_us[seq]) / 1000.0);
+                client.sent_us[seq] = 0;
+                client.outstanding--;
+                memcpy(client.last_answer, decoder.payload + 4, decoder.length - 4);
+                client.last_answer[decoder.length - 4] = '\0';
+                client.last_seq = seq;
+            }
+        }
+    }
+}
+
+
+static void send_command(uint8_t seq, const char *text)
+{
+    uint8_t payload[CMD_MAX_LENGTH + 1];
+    uint8_t frame[FRAME_MAX_LENGTH];
+
+    size_t length = strlen(text);
+    payload[0] = seq;
+    memcpy(payload + 1, text, length);
+    {
+        std::lock_guard<std::mutex> lock(client.mutex);
+        client.sent_us[seq] = now_us();
+        client.outstanding++;
+    }
+    line_write(&downstream, frame, frame_encode(BRIDGE_COMMAND, payload, length + 1, frame));
+}
+
+
+// Send and wait for the answer, false on timeout or rejection
+static bool run_command(uint8_t seq, const char *text, char *answer)
+{
+    send_command(seq, text);
+    for (int i = 0; i < 2000; i++) {
+        usleep(1000);
+        std::lock_guard<std::mutex> lock(client.mutex);
+        if (client.sent_us[seq] == 0) {
+            strcpy(answer, client.last_answer);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t rank = (size_t) (p * (sorted.size() - 1) + 0.5);
+    return sorted[rank];
+}
+
+
+static bool emulator_rc_count(uint8_t seq, uint32_t *rc)
+{
+    char answer[FRAME_MAX_PAYLOAD];
+
+    return run_command(seq, "emu stats?", answer) && sscanf(answer, "rc=%u", rc) == 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    int port = 8889;
+    int state_port = 8890;
+    double seconds = 10;
+    int rc_hz = 200;
+    int batch = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:s:b:d:r:k:")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            case 's': state_port = atoi(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            case 'd': seconds = atof(optarg); break;
+            case 'r': rc_hz = atoi(optarg); break;
+            case 'k': batch = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-p port] [-s state port] [-b baud] [-d seconds] "
+                                "[-r rc Hz] [-k batch]\n", argv[0]);
+                return 2;
+        }
+    }
+    batch = std::max(1, std::min(batch, FRAME_MAX_PAYLOAD / (int) sizeof(rc_setpoint_t)));
+
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    struct sockaddr_in state_address = {};
+    state_address.sin_family = AF_INET;
+    state_address.sin_port = htons(state_port);
+    state_address.sin_addr.s_addr = htonl(INADDR_ANY);
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    state_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0 || state_sock < 0 ||
+        connect(sock, (struct sockaddr *) &address, sizeof(address)) < 0 ||
+        bind(state_sock, (struct sockaddr *) &state_address, sizeof(state_address)) < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    // [0] firmware end, [1] ground station end
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("socketpair");
+        return 1;
+    }
+    upstream.fd = fds[0];
+    downstream.fd = fds[1];
+
+    static const bridge_io_t io = {io_write, io_set_rc, io_command, host_now_ms};
+    bridge_init(&io);
+    bridge_enter();
+    std::thread uart(uart_thread);
+    std::thread comms(comms_thread);
+    std::thread rc(rc_thread);
+    std::thread reader(client_reader, fds[1]);
+
+    char answer[FRAME_MAX_PAYLOAD];
+    uint32_t emu_rc_start = 0, emu_rc_end = 0;
+    if (!run_command(0, "command", answer) || !emulator_rc_count(1, &emu_rc_start)) {
+        fprintf(stderr, "no answer from the emulator on port %d\n", port);
+        return 1;
+    }
+    {
+        std::lock_guard<std::mutex> lock(client.mutex);
+        client.latency_ms.clear();
+        client.states = 0;
+    }
+
+    // rc frames at the host rate, a new yaw each; reads while a slot is free
+    rc_setpoint_t batch_sp[FRAME_MAX_PAYLOAD / sizeof(rc_setpoint_t)];
+    uint8_t frame[FRAME_MAX_LENGTH];
+    uint32_t setpoints = 0, frames = 0, reads = 0;
+    uint8_t seq = 2;
+    uint32_t rc_start = rc_sent;
+    uint64_t start = now_us();
+    uint64_t end = start + (uint64_t) (seconds * 1000000);
+    uint64_t next_rc = start, next_read = start;
+    uint64_t down_start = downstream.bytes, up_start = upstream.bytes;
+    while (now_us() < end) {
+        uint64_t now = now_us();
+        if (now >= next_rc) {
+            for (int i = 0; i < batch; i++) {
+                batch_sp[i].roll = 0;
+                batch_sp[i].pitch = 0;
+                batch_sp[i].throttle = 0;
+                batch_sp[i].yaw = (int8_t) ((setpoints++ % 201) - 100);
+            }
+            line_write(&downstream, frame, frame_encode(BRIDGE_RC, batch_sp,
+                                                        batch * sizeof(rc_setpoint_t), frame));
+            frames++;
+            next_rc += 1000000 / rc_hz;
+        }
+        if (now >= next_read) {
+            bool free_slot;
+            {
+                std::lock_guard<std::mutex> lock(client.mutex);
+                free_slot = client.outstanding < BRIDGE_PENDING && client.sent_us[seq] == 0;
+            }
+            if (free_slot) {
+                send_command(seq, "battery?");
+                seq = seq == 254 ? 2 : seq + 1;
+                reads++;
+            }
+            next_read += READ_PERIOD_MS * 1000 / BRIDGE_PENDING;
+        }
+        uint64_t wait = std::min(next_rc, next_read);
+        now = now_us();
+        if (wait > now)
+            usleep(wait - now);
+    }
+    double elapsed = (now_us() - start) / 1e6;
+    uint64_t down_bytes = downstream.bytes - down_start, up_bytes = upstream.bytes - up_start;
+    uint32_t rc_datagrams = rc_sent - rc_start;
+
+    // Let the reads in flight finish, then the final counts
+    usleep(300000);
+    bool emu_ok = emulator_rc_count(1, &emu_rc_end);
+    uint32_t rc_total = rc_sent - rc_start;
+    bridge_send_stats();
+    usleep(100000);
+
+    uint8_t exit_frame[FRAME_OVERHEAD];
+    line_write(&downstream, exit_frame, frame_encode(BRIDGE_EXIT, NULL, 0, exit_frame));
+    usleep(100000);
+    running = false;
+    shutdown(fds[0], SHUT_RDWR);
+    shutdown(fds[1], SHUT_RDWR);
+    uart.join();
+    comms.join();
+    rc.join();
+    reader.join();
+
+    std::lock_guard<std::mutex> lock(client.mutex);
+    std::vector<double> &latency = client.latency_ms;
+    std::sort(latency.begin(), latency.end());
+    const bridge_stats_t &stats = client.stats;
+    double line_rate = baud / 10.0;
+    printf("bridge at %u baud, rc %d Hz x %d setpoints, %.1f s\n", baud, rc_hz, batch, elapsed);
+    printf("acks:   %zu answered, p50 %.2f p99 %.2f max %.2f ms, %u rejected, %u unmatched\n",
+           latency.size(), percentile(latency, 0.5), percentile(latency, 0.99),
+           latency.empty() ? 0.0 : latency.back(), client.rejected, client.unmatched);
+    printf("rc:     %u frames, %u setpoints (%.0f/s), %u coalesced, %u datagrams sent (%.1f Hz)",
+           frames, setpoints, setpoints / elapsed, stats.coalesced, rc_datagrams,
+           rc_datagrams / elapsed);
+    if (emu_ok)
+        printf(", emulator got %u of %u", emu_rc_end - emu_rc_start, rc_total);
+    printf("\n");
+    printf("state:  %u frames, %.1f/s\n", client.states, client.states / elapsed);
+    printf("serial: down %.0f B/s (%.1f%%), up %.0f B/s (%.1f%%), %u crc errors\n",
+           down_bytes / elapsed, 100.0 * down_bytes / elapsed / line_rate,
+           up_bytes / elapsed, 100.0 * up_bytes / elapsed / line_rate, stats.crc_errors);
+    printf("bridge: %u frames, %u commands, %u acks, %u reads sent, %u silences, "
+           "active after exit: %s\n", stats.frames, stats.commands, stats.acks, reads,
+           stats.silences, bridge_active() ? "yes" : "no");
+    close(sock);
+    close(state_sock);
+    return 0;
+}
@@ -0,0 +1,325 @@
+/*
+ * Command path benchmark against the Tello emulator (`tello_stub.py`).
+ *
+ * Drives the tello-hand command engine over a real UDP socket and reports:
+ *   rc        sustained rc packets/s sent, and delivered per the emulator;
+ *             unpaced by default, -R paces to a stream rate [Hz]
+ *   rtt       round trip percentiles of acknowledged commands ("battery?")
+ *   recovery  time from the end of a link outage to the first answered
+ *             command, with the deadline given by -t
+ *   state     state stream datagrams/s received and parsed on port 8890
+ *   engine    expired commands and late answers the engine dropped
+ *
+ * Run it against a congested link, e.g.
+ *   python3 tello_stub.py --quiet --rtt 30 --jitter 10 --loss 0.05 --reorder 0.02 &
+ *   g++ -O2 -I ../include command_bench.cpp ../src/command_engine.cpp ../src/tello_state.cpp -o command_bench
+ *   ./command_bench [-p port] [-s state port] [-d rc seconds] [-R rc Hz]
+ *                   [-n rtt commands] [-o outage ms] [-r outages] [-t deadline ms]
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "command_engine.h"
+#include "rc_format.h"
+#include "tello_state.h"
+
+
+static int sock = -1;
+static int state_sock = -1;
+static uint32_t state_received = 0;
+static uint32_t state_parsed = 0;
+
+static bool done = false;
+static cmd_result_t last_result;
+static char last_response[CMD_MAX_LENGTH];
+static uint64_t done_us = 0;
+
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static uint32_t host_now_ms(void)
+{
+    return (uint32_t) (now_us() / 1000);
+}
+
+
+static bool host_send(const uint8_t *data, size_t length)
+{
+    return send(sock, data, length, 0) == (ssize_t) length;
+}
+
+
+static int host_receive(uint8_t *data, size_t size)
+{
+    ssize_t length = recv(sock, data, size, MSG_DONTWAIT);
+    return length > 0 ? (int) length : 0;
+}
+
+
+static void on_response(const char *, cmd_result_t result,
+                        const char *response, uint32_t)
+{
+    last_result = result;
+    strncpy(last_response, response, CMD_MAX_LENGTH - 1);
+    last_response[CMD_MAX_LENGTH - 1] = '\0';
+    done_us = now_us();
+    done = true;
+}
+
+
+static void drain_state(void)
+{
+    char datagram[TELLO_STATE_MAX_LENGTH];
+    tello_state_t state;
+
+    if (state_sock < 0)
+        return;
+    for (;;) {
+        ssize_t length = recv(state_sock, datagram, sizeof(datagram), MSG_DONTWAIT);
+        if (length <= 0)
+            return;
+        state_received++;
+        if (tello_state_parse(datagram, length, &state))
+            state_parsed++;
+    }
+}
+
+
+// Send an acknowledged command and poll until it completes
+static cmd_result_t run(const char *command, uint32_t timeout_ms)
+{
+    done = false;
+    if (!cmd_engine_submit(command, timeout_ms))
+        return CMD_RESULT_NO_RESPONSE;
+    while (!done) {
+        cmd_engine_poll();
+        drain_state();
+    }
+    return last_result;
+}
+
+
+// Wait without sending, answers arriving meanwhile are dropped
+static void settle(uint32_t ms)
+{
+    uint8_t data[CMD_MAX_LENGTH];
+    uint64_t end = now_us() + ms * 1000ULL;
+
+    while (now_us() < end) {
+        host_receive(data, sizeof(data));
+        drain_state();
+        usleep(1000);
+    }
+}
+
+
+static bool emulator_rc_count(uint32_t *rc)
+{
+    if (run("emu stats?", 1000) != CMD_RESULT_VALUE)
+        return false;
+    return sscanf(last_response, "rc=%u", rc) == 1;
+}
+
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t rank = (size_t) (p * (sorted.size() - 1) + 0.5);
+    return sorted[rank];
+}
+
+
+static void bench_rc(double seconds, int rate_hz)
+{
+    char packet[RC_FORMAT_MAX_LENGTH];
+    rc_setpoint_t sp = {0, 0, 0, 0};
+    uint32_t sent = 0, failed = 0, before = 0, after = 0;
+
+    bool counted = emulator_rc_count(&before);
+    uint64_t start = now_us();
+    uint64_t end = start + (uint64_t) (seconds * 1e6);
+    uint64_t next = start;
+    while (now_us() < end) {
+        if (rate_hz > 0) {
+            while (now_us() < next)
+                ;
+            next += 1000000 / rate_hz;
+        }
+        sp.roll = (int8_t) (sent % 201 - 100);
+        sp.yaw = (int8_t) (sent % 101 - 50);
+        rc_format(packet, &sp);
+        if (cmd_engine_submit(packet, 0))
+            sent++;
+        else
+            failed++;
+    }
+    double elapsed = (now_us() - start) / 1e6;
+    // Let the emulator catch up before counting
+    settle(500);
+    counted = counted && emulator_rc_count(&after);
+
+    printf("rc: %u sent in %.1f s, %.0f packets/s, %u send errors\n",
+           sent, elapsed, sent / elapsed, failed);
+    if (counted) {
+        uint32_t delivered = after - before;
+        printf("rc: %u delivered, %.0f packets/s, %.1f%% lost\n", delivered, delivered / elapsed,
+               sent ? 100.0 * (sent - delivered) / sent : 0.0);
+    }
+}
+
+
+static void bench_rtt(int count, uint32_t deadline_ms)
+{
+    std::vector<double> rtt_ms;
+    uint32_t results[CMD_RESULTS] = {};
+    uint32_t stale = 0;
+
+    for (int i = 0; i < count; i++) {
+        uint64_t start = now_us();
+        cmd_result_t result = run("battery?", deadline_ms);
+        results[result]++;
+        if (result == CMD_RESULT_VALUE)
+            rtt_ms.push_back((done_us - start) / 1000.0);
+        else if (result == CMD_RESULT_OK)
+            stale++;   // Late answer of an earlier command taken for this one
+    }
+    std::sort(rtt_ms.begin(), rtt_ms.end());
+
+    printf("rtt: %zu of %d answered, p50 %.2f p90 %.2f p99 %.2f max %.2f ms\n",
+           rtt_ms.size(), count, percentile(rtt_ms, 0.5), percentile(rtt_ms, 0.9),
+           percentile(rtt_ms, 0.99), rtt_ms.empty() ? 0.0 : rtt_ms.back());
+    printf("rtt: %u error, %u timeout, %u no response, %u mismatched answers\n",
+           results[CMD_RESULT_ERROR], results[CMD_RESULT_TIMEOUT],
+           results[CMD_RESULT_NO_RESPONSE], stale);
+}
+
+
+static void bench_recovery(int trials, uint32_t outage_ms, uint32_t deadline_ms)
+{
+    char command[CMD_MAX_LENGTH];
+    std::vector<double> recovery_ms;
+    uint32_t lost = 0;
+
+    snprintf(command, sizeof(command), "emu outage %u", outage_ms);
+    for (int i = 0; i < trials; i++) {
+        settle(200);
+        if (run(command, 1000) != CMD_RESULT_OK) {
+            printf("recovery: outage %d not acknowledged\n", i);
+            continue;
+        }
+        uint64_t outage_end = now_us() + outage_ms * 1000ULL;
+
+        // Keep commands flowing through the outage until one is answered after it
+        for (;;) {
+            cmd_result_t result = run("battery?", deadline_ms);
+            if (result == CMD_RESULT_NO_RESPONSE)
+                lost++;
+            if (result == CMD_RESULT_VALUE && done_us > outage_end)
+                break;
+        }
+        recovery_ms.push_back((done_us - outage_end) / 1000.0);
+    }
+    std::sort(recovery_ms.begin(), recovery_ms.end());
+
+    double sum = 0;
+    for (double r : recovery_ms)
+        sum += r;
+    printf("recovery: %zu outages of %u ms, deadline %u ms, first answer after %.1f ms avg "
+           "%.1f ms max, %u commands lost\n", recovery_ms.size(), outage_ms, deadline_ms,
+           recovery_ms.empty() ? 0.0 : sum / recovery_ms.size(),
+           recovery_ms.empty() ? 0.0 : recovery_ms.back(), lost);
+}
+
+
+int main(int argc, char **argv)
+{
+    int port = 8889;
+    int state_port = 8890;
+    double rc_seconds = 5;
+    int rc_rate_hz = 0;
+    int rtt_count = 500;
+    uint32_t outage_ms = 2000;
+    int outages = 5;
+    uint32_t deadline_ms = 1000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:s:d:R:n:o:r:t:")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            case 's': state_port = atoi(optarg); break;
+            case 'd': rc_seconds = atof(optarg); break;
+            case 'R': rc_rate_hz = atoi(optarg); break;
+            case 'n': rtt_count = atoi(optarg); break;
+            case 'o': outage_ms = atoi(optarg); break;
+            case 'r': outages = atoi(optarg); break;
+            case 't': deadline_ms = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-p port] [-s state port] [-d rc seconds] "
+                        "[-R rc Hz] [-n rtt commands] [-o outage ms] [-r outages] [-t deadline ms]\n", argv[0]);
+                return 2;
+        }
+    }
+    const cmd_transport_t transport = {host_send, host_receive, host_now_ms};
+
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    // State stream, as the controller receives it
+    struct sockaddr_in state_address = {};
+    state_address.sin_family = AF_INET;
+    state_address.sin_port = htons(state_port);
+    state_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    state_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (state_sock >= 0 &&
+        bind(state_sock, (struct sockaddr *) &state_address, sizeof(state_address)) < 0) {
+        perror("state port");
+        close(state_sock);
+        state_sock = -1;
+    }
+
+    cmd_engine_init(&transport, on_response);
+    uint64_t start = now_us();
+    // SDK mode, retried like the firmware does on a lossy link
+    for (int i = 0; i < 5 && run("command", deadline_ms) != CMD_RESULT_OK; i++)
+        ;
+
+    bench_rc(rc_seconds, rc_rate_hz);
+    bench_rtt(rtt_count, deadline_ms);
+    bench_recovery(outages, outage_ms, deadline_ms);
+
+    double elapsed = (now_us() - start) / 1e6;
+    if (state_sock >= 0) {
+        printf("state: %u datagrams in %.1f s, %.1f/s, %u parsed\n",
+               state_received, elapsed, state_received / elapsed, state_parsed);
+        close(state_sock);
+    }
+    cmd_engine_stats_t engine;
+    cmd_engine_get_stats(&engine);
+    printf("engine: %u submitted, %u answered, %u expired, %u stale answers dropped, depth max %u\n",
+           engine.submitted, engine.completed, engine.expired, engine.stale, engine.depth_max);
+    close(sock);
+    return 0;
+}
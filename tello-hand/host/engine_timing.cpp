@@ -0,0 +1,131 @@
+/*
+ * Runs the tello-hand command engine on Linux against `tello_stub.py` and
+ * times the takeoff, land and timeout paths. While commands wait for their
+ * answers the main loop keeps spinning; its rate and the longest gap
+ * between two polls are reported as well.
+ *
+ * Build and run:
+ *   python3 tello_stub.py --ignore wifi? &
+ *   g++ -O2 -I ../include engine_timing.cpp ../src/command_engine.cpp -o engine_timing
+ *   ./engine_timing [port]
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "command_engine.h"
+
+
+static int sock = -1;
+static bool done = false;
+static cmd_result_t last_result;
+
+
+static bool host_send(const uint8_t *data, size_t length)
+{
+    return send(sock, data, length, 0) == (ssize_t) length;
+}
+
+
+static int host_receive(uint8_t *data, size_t size)
+{
+    ssize_t length = recv(sock, data, size, MSG_DONTWAIT);
+    return length > 0 ? (int) length : 0;
+}
+
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static uint32_t host_now_ms(void)
+{
+    return (uint32_t) (now_us() / 1000);
+}
+
+
+static const char *result_name(cmd_result_t result)
+{
+    switch (result) {
+        case CMD_RESULT_OK:          return "ok";
+        case CMD_RESULT_VALUE:       return "value";
+        case CMD_RESULT_ERROR:       return "error";
+        case CMD_RESULT_TIMEOUT:     return "timeout";
+        case CMD_RESULT_PREEMPTED:   return "preempted";
+        default:                     return "no response";
+    }
+}
+
+
+static void on_response(const char *command, cmd_result_t result,
+                        const char *response, uint32_t rtt_ms)
+{
+    printf("  %-10s -> %-12s '%s' after %u ms\n", command,
+           result_name(result), response, rtt_ms);
+    last_result = result;
+    done = true;
+}
+
+
+static void run(const char *command, uint32_t timeout_ms)
+{
+    uint64_t loops = 0;
+    uint64_t max_gap_us = 0;
+    uint64_t start = now_us();
+    uint64_t last = start;
+
+    done = false;
+    cmd_engine_submit(command, timeout_ms);
+    while (!done) {
+        cmd_engine_poll();
+        loops++;
+
+        uint64_t now = now_us();
+        if (now - last > max_gap_us)
+            max_gap_us = now - last;
+        last = now;
+    }
+
+    double seconds = (now_us() - start) / 1e6;
+    printf("  loop kept running: %.0f polls/s, longest gap %llu us\n",
+           loops / seconds, (unsigned long long) max_gap_us);
+}
+
+
+int main(int argc, char **argv)
+{
+    int port = argc > 1 ? atoi(argv[1]) : 8889;
+    const cmd_transport_t transport = {host_send, host_receive, host_now_ms};
+
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        perror("socket");
+        return 1;
+    }
+    cmd_engine_init(&transport, on_response);
+
+    printf("command:\n");
+    run("command", 0);
+    printf("takeoff:\n");
+    run("takeoff", 0);
+    printf("land:\n");
+    run("land", 0);
+    printf("timeout path (stand-in started with --ignore wifi?):\n");
+    run("wifi?", 1000);
+
+    close(sock);
+    return last_result == CMD_RESULT_NO_RESPONSE ? 0 : 1;
+}
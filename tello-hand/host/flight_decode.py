@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+"""
+Decode a tello-hand flight recorder file (/flight.bin on LittleFS) to CSV.
+
+The file is a header (magic "TFR1", version, record size) followed by
+fixed-size little-endian records, see include/flight_recorder.h.
+
+Usage:
+    python3 flight_decode.py flight.bin [-o flight.csv]
+
+Copy the file off the controller first, e.g. with a LittleFS download
+tool or by reading it over serial.
+"""
+
+import argparse
+import csv
+import struct
+import sys
+
+
+HEADER = struct.Struct("<IHH")
+RECORD = struct.Struct("<IBBBBH4b3h")
+MAGIC = 0x31524654
+VERSION = 1
+
+EVENTS = ["setpoint", "command", "response"]
+COMMANDS = ["rc", "command", "takeoff", "land", "emergency", "battery?", "other"]
+RESULTS = ["ok", "value", "error", "timeout", "no_response", "preempted"]
+
+COLUMNS = ["time_ms", "event", "command", "result", "rtt_ms",
+           "rc_roll", "rc_pitch", "rc_throttle", "rc_yaw", "roll", "pitch", "yaw"]
+
+
+def name(table, index):
+    return table[index] if index < len(table) else str(index)
+
+
+def decode(data):
+    if len(data) < HEADER.size:
+        raise ValueError("file too short")
+    magic, version, record_size = HEADER.unpack_from(data)
+    if magic != MAGIC:
+        raise ValueError("not a flight recorder file")
+    if version != VERSION or record_size != RECORD.size:
+        raise ValueError("unsupported version %d, record size %d" % (version, record_size))
+
+    body = data[HEADER.size:]
+    whole = len(body) - len(body) % RECORD.size
+    for fields in RECORD.iter_unpack(body[:whole]):
+        (time_ms, event, command, result, _reserved, rtt_ms,
+         rc_roll, rc_pitch, rc_throttle, rc_yaw, roll, pitch, yaw) = fields
+        response = event == EVENTS.index("response")
+        yield [time_ms, name(EVENTS, event), name(COMMANDS, command),
+               name(RESULTS, result) if response else "",
+               rtt_ms if response else "",
+               rc_roll, rc_pitch, rc_throttle, rc_yaw, roll, pitch, yaw]
+    if whole != len(body):
+        print("warning: %d trailing bytes ignored" % (len(body) - whole), file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("file")
+    parser.add_argument("-o", "--output", help="CSV file, default stdout")
+    args = parser.parse_args()
+
+    with open(args.file, "rb") as f:
+        data = f.read()
+    out = open(args.output, "w", newline="") if args.output else sys.stdout
+    try:
+        writer = csv.writer(out)
+        writer.writerow(COLUMNS)
+        count = 0
+        for row in decode(data):
+            writer.writerow(row)
+            count += 1
+    except ValueError as error:
+        sys.exit("%s: %s" % (args.file, error))
+    finally:
+        if args.output:
+            out.close()
+    print("%d records" % count, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
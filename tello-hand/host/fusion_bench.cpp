@@ -0,0 +1,262 @@
+/*
+ * Host benchmark of the IMU fusion paths: updates per second and angle
+ * error against a trace with known attitude.
+ *
+ * The trace is a CSV file with one sample per line
+ *   t_us,ax,ay,az,gx,gy,gz[,roll,pitch,yaw]
+ * in g, deg/s and deg (reference angles optional). Without a file a
+ * synthetic trace is generated: large roll/pitch swings with a constant
+ * yaw rotation, gyro bias and sensor noise.
+ *
+ * Compared are the complementary filter of MPU6050_light (baseline) and
+ * the Mahony float and fixed-point paths.
+ *
+ * Build and run:
+ *   g++ -O2 -I ../../lib/imu_fusion fusion_bench.cpp ../../lib/imu_fusion/imu_fusion.cpp -o fusion_bench
+ *   ./fusion_bench [trace.csv]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#include "imu_fusion.h"
+
+#define SAMPLE_RATE_HZ   200
+#define SYNTHETIC_SECS   120
+#define ACC_LSB_PER_G    16384.0f   // +-2 g
+#define GYRO_LSB_PER_DPS 131.0f     // +-250 deg/s
+#define RUNS             20
+
+typedef struct {
+    uint32_t t_us;
+    float ax, ay, az;
+    float gx, gy, gz;
+    int16_t raw[6];
+    bool has_reference;
+    euler_t reference;
+} sample_t;
+
+typedef struct {
+    double roll, pitch, yaw;
+    int count;
+} angle_error_t;
+
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static float noise(float amplitude)
+{
+    return amplitude * ((rand() / (float) RAND_MAX) * 2.0f - 1.0f);
+}
+
+
+static int16_t to_raw(float value, float scale)
+{
+    float raw = value * scale;
+    if (raw > 32767.0f)
+        raw = 32767.0f;
+    if (raw < -32768.0f)
+        raw = -32768.0f;
+    return (int16_t) lrintf(raw);
+}
+
+
+static void finish_sample(sample_t *s)
+{
+    s->raw[0] = to_raw(s->ax, ACC_LSB_PER_G);
+    s->raw[1] = to_raw(s->ay, ACC_LSB_PER_G);
+    s->raw[2] = to_raw(s->az, ACC_LSB_PER_G);
+    s->raw[3] = to_raw(s->gx, GYRO_LSB_PER_DPS);
+    s->raw[4] = to_raw(s->gy, GYRO_LSB_PER_DPS);
+    s->raw[5] = to_raw(s->gz, GYRO_LSB_PER_DPS);
+}
+
+
+// ZYX Euler angles: roll/pitch swings, slow yaw rotation
+static void synthesize(std::vector<sample_t> &trace)
+{
+    const float d2r = M_PI / 180.0f;
+    const float dt = 1.0f / SAMPLE_RATE_HZ;
+
+    srand(1);
+    for (int i = 0; i < SYNTHETIC_SECS * SAMPLE_RATE_HZ; i++) {
+        float t = i * dt;
+        float roll = 60.0f * sinf(0.5f * t);
+        float pitch = 45.0f * sinf(0.7f * t + 1.0f);
+        float yaw = fmodf(30.0f * t + 180.0f, 360.0f) - 180.0f;
+        float droll = 30.0f * cosf(0.5f * t);
+        float dpitch = 31.5f * cosf(0.7f * t + 1.0f);
+        float dyaw = 30.0f;
+
+        float sr = sinf(roll * d2r), cr = cosf(roll * d2r);
+        float sp = sinf(pitch * d2r), cp = cosf(pitch * d2r);
+
+        sample_t s;
+        s.t_us = (uint32_t) (t * 1e6f);
+        // Gravity in the body frame plus noise
+        s.ax = -sp + noise(0.02f);
+        s.ay = sr * cp + noise(0.02f);
+        s.az = cr * cp + noise(0.02f);
+        // Body rates plus bias and noise
+        s.gx = droll - dyaw * sp + 0.8f + noise(0.3f);
+        s.gy = dpitch * cr + dyaw * cp * sr - 0.5f + noise(0.3f);
+        s.gz = -dpitch * sr + dyaw * cp * cr + 0.3f + noise(0.3f);
+        s.has_reference = true;
+        s.reference = {roll, pitch, yaw};
+        finish_sample(&s);
+        trace.push_back(s);
+    }
+}
+
+
+static bool load(const char *path, std::vector<sample_t> &trace)
+{
+    FILE *file = fopen(path, "r");
+    char line[256];
+
+    if (file == NULL)
+        return false;
+    while (fgets(line, sizeof(line), file)) {
+        sample_t s;
+        unsigned long t_us;
+        int fields = sscanf(line, "%lu,%f,%f,%f,%f,%f,%f,%f,%f,%f", &t_us,
+                            &s.ax, &s.ay, &s.az, &s.gx, &s.gy, &s.gz,
+                            &s.reference.roll, &s.reference.pitch, &s.reference.yaw);
+        if (fields < 7)
+            continue;   // Header or comment
+        s.t_us = t_us;
+        s.has_reference = fields == 10;
+        finish_sample(&s);
+        trace.push_back(s);
+    }
+    fclose(file);
+    return !trace.empty();
+}
+
+
+static double angle_diff(double a, double b)
+{
+    double d = fmod(a - b + 540.0, 360.0) - 180.0;
+    return d * d;
+}
+
+
+static void accumulate(angle_error_t *e, const sample_t &s, const euler_t &angles)
+{
+    if (!s.has_reference)
+        return;
+    e->roll += angle_diff(angles.roll, s.reference.roll);
+    e->pitch += angle_diff(angles.pitch, s.reference.pitch);
+    e->yaw += angle_diff(angles.yaw, s.reference.yaw);
+    e->count++;
+}
+
+
+// MPU6050_light update() with its default 0.98 gyro coefficient
+static void complementary(const std::vector<sample_t> &trace, angle_error_t *e)
+{
+    float x = 0, y = 0, z = 0;
+
+    for (size_t i = 1; i < trace.size(); i++) {
+        const sample_t &s = trace[i];
+        float dt = (s.t_us - trace[i - 1].t_us) * 1e-6f;
+        float acc_x = atan2f(s.ay, sqrtf(s.az * s.az + s.ax * s.ax)) * 57.29578f;
+        float acc_y = -atan2f(s.ax, sqrtf(s.az * s.az + s.ay * s.ay)) * 57.29578f;
+
+        x = 0.98f * (x + s.gx * dt) + 0.02f * acc_x;
+        y = 0.98f * (y + s.gy * dt) + 0.02f * acc_y;
+        z += s.gz * dt;
+        if (e != NULL) {
+            euler_t angles = {x, y, fmodf(z + 540.0f, 360.0f) - 180.0f};
+            accumulate(e, s, angles);
+        }
+    }
+}
+
+
+static void mahony_float(const std::vector<sample_t> &trace, angle_error_t *e)
+{
+    mahony_t f;
+    euler_t angles;
+
+    mahony_init(&f, MAHONY_KP, MAHONY_KI);
+    for (size_t i = 1; i < trace.size(); i++) {
+        const sample_t &s = trace[i];
+        float dt = (s.t_us - trace[i - 1].t_us) * 1e-6f;
+        mahony_update(&f, s.ax, s.ay, s.az, s.gx, s.gy, s.gz, dt);
+        if (e != NULL) {
+            mahony_euler(&f, &angles);
+            accumulate(e, s, angles);
+        }
+    }
+}
+
+
+static void mahony_fixed(const std::vector<sample_t> &trace, angle_error_t *e)
+{
+    mahony_fx_t f;
+    euler_t angles;
+
+    mahony_fx_init(&f, MAHONY_KP, MAHONY_KI, GYRO_LSB_PER_DPS);
+    for (size_t i = 1; i < trace.size(); i++) {
+        const sample_t &s = trace[i];
+        mahony_fx_update(&f, s.raw[0], s.raw[1], s.raw[2], s.raw[3], s.raw[4], s.raw[5],
+                         s.t_us - trace[i - 1].t_us);
+        if (e != NULL) {
+            mahony_fx_euler(&f, &angles);
+            accumulate(e, s, angles);
+        }
+    }
+}
+
+
+static void report(const char *name, const std::vector<sample_t> &trace,
+                   void (*run)(const std::vector<sample_t> &, angle_error_t *))
+{
+    angle_error_t e = {};
+    run(trace, &e);
+
+    // Timing without the Euler conversion
+    double start = now_s();
+    for (int i = 0; i < RUNS; i++)
+        run(trace, NULL);
+    double rate = RUNS * (trace.size() - 1) / (now_s() - start);
+
+    printf("%-14s %12.0f updates/s", name, rate);
+    if (e.count > 0) {
+        printf("   RMS error roll %6.2f  pitch %6.2f  yaw %6.2f deg",
+               sqrt(e.roll / e.count), sqrt(e.pitch / e.count), sqrt(e.yaw / e.count));
+    }
+    printf("\n");
+}
+
+
+int main(int argc, char **argv)
+{
+    std::vector<sample_t> trace;
+
+    if (argc > 1) {
+        if (!load(argv[1], trace)) {
+            fprintf(stderr, "Cannot read trace %s\n", argv[1]);
+            return 1;
+        }
+    }
+    else {
+        synthesize(trace);
+    }
+    printf("%zu samples, %.1f s\n", trace.size(),
+           (trace.back().t_us - trace.front().t_us) / 1e6);
+
+    report("complementary", trace, complementary);
+    report("mahony float", trace, mahony_float);
+    report("mahony fixed", trace, mahony_fixed);
+    return 0;
+}
@@ -0,0 +1,304 @@
+/*
+ * Kill-to-wire latency of the emergency/land priority lane.
+ *
+ * Rebuilds the firmware command path on Linux: a "control" thread posts
+ * commands through the two SpscRings like `hal_command()`, and a "comms"
+ * thread runs the command engine like `comms_task()`, waking once per
+ * 1 ms tick or at once when a priority command is posted. A loopback
+ * drone never answers ordinary commands, so every trial finds the engine
+ * waiting; "emergency" and "land" are answered "ok" right away.
+ *
+ * For each scenario the time from the kill press (push into the priority
+ * ring) to the return of send() for the priority datagram is measured and
+ * reported as p50/p99/max, and the worst case over all scenarios last.
+ *   idle         nothing in flight
+ *   takeoff      takeoff waiting for its answer (up to 20 s)
+ *   land         land waiting, emergency preempts it
+ *   queue-full   battery? waiting, the engine queue full behind it
+ *   land-on-read land (not emergency) while battery? waits
+ *
+ * Build and run:
+ *   g++ -O2 -pthread -I ../include priority_bench.cpp ../src/command_engine.cpp -o priority_bench
+ *   ./priority_bench [-n trials] [-N]
+ * -N disables the wakeup, the comms thread then only polls once per tick.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "command_engine.h"
+#include "spsc_ring.h"
+
+#define TICK_US  1000   // FreeRTOS tick of the comms task wait
+
+typedef struct {
+    char text[CMD_MAX_LENGTH];
+    uint32_t timeout_ms;
+} command_msg_t;
+
+typedef struct {
+    const char *name;
+    const char *setup[CMD_QUEUE_LENGTH + 1];   // Sent before the kill, NULL terminated
+    const char *priority;
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    {"idle", {NULL}, "emergency"},
+    {"takeoff", {"takeoff", NULL}, "emergency"},
+    {"land", {"land", NULL}, "emergency"},
+    {"queue-full", {"battery?", "speed?", "speed?", "speed?", "speed?",
+                    "speed?", "speed?", "speed?", "speed?"}, "emergency"},
+    {"land-on-read", {"battery?", NULL}, "land"},
+};
+
+static SpscRing<command_msg_t, 16> commandRing;
+static SpscRing<command_msg_t, 4> priorityRing;
+
+// Task notification of the comms thread
+static std::mutex notify_mutex;
+static std::condition_variable notify_cv;
+static bool notified = false;
+static bool use_notify = true;
+
+static int sock = -1;
+static int drone_sock = -1;
+static std::atomic<bool> running{true};
+static std::atomic<bool> reset{false};
+static std::atomic<uint32_t> sent{0};
+static std::atomic<uint64_t> priority_sent_us{0};
+static char priority_text[CMD_MAX_LENGTH];
+
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static uint32_t host_now_ms(void)
+{
+    return (uint32_t) (now_us() / 1000);
+}
+
+
+static bool host_send(const uint8_t *data, size_t length)
+{
+    bool ok = send(sock, data, length, 0) == (ssize_t) length;
+    if (strcmp((const char *) data, priority_text) == 0)
+        priority_sent_us = now_us();
+    sent++;
+    return ok;
+}
+
+
+static int host_receive(uint8_t *data, size_t size)
+{
+    ssize_t length = recv(sock, data, size, MSG_DONTWAIT);
+    return length > 0 ? (int) length : 0;
+}
+
+
+static void on_response(const char *, cmd_result_t, const char *, uint32_t)
+{
+}
+
+
+// Like hal_command(), called from the control thread only
+static bool post_command(const char *command)
+{
+    command_msg_t msg;
+
+    strncpy(msg.text, command, CMD_MAX_LENGTH - 1);
+    msg.text[CMD_MAX_LENGTH - 1] = '\0';
+    msg.timeout_ms = 0;
+    if (!cmd_is_priority(msg.text))
+        return commandRing.push(msg);
+    if (!priorityRing.push(msg))
+        return false;
+    if (use_notify) {
+        std::lock_guard<std::mutex> lock(notify_mutex);
+        notified = true;
+        notify_cv.notify_one();
+    }
+    return true;
+}
+
+
+// Like comms_task(); the engine is only touched from here
+static void comms_thread(void)
+{
+    static const cmd_transport_t transport = {host_send, host_receive, host_now_ms};
+    command_msg_t msg;
+
+    cmd_engine_init(&transport, on_response);
+    while (running) {
+        if (reset.exchange(false))
+            cmd_engine_init(&transport, on_response);
+        while (priorityRing.pop(msg))
+            cmd_engine_submit(msg.text, msg.timeout_ms);
+        while (commandRing.pop(msg))
+            cmd_engine_submit(msg.text, msg.timeout_ms);
+        cmd_engine_poll();
+
+        // ulTaskNotifyTake(pdTRUE, 1)
+        std::unique_lock<std::mutex> lock(notify_mutex);
+        notify_cv.wait_for(lock, std::chrono::microseconds(TICK_US), [] { return notified; });
+        notified = false;
+    }
+}
+
+
+// Loopback drone: answers the priority commands only
+static void drone_thread(void)
+{
+    char data[CMD_MAX_LENGTH];
+    struct sockaddr_in from;
+    socklen_t from_length;
+
+    while (running) {
+        from_length = sizeof(from);
+        ssize_t length = recvfrom(drone_sock, data, sizeof(data) - 1, 0,
+                                  (struct sockaddr *) &from, &from_length);
+        if (length <= 0)
+            continue;
+        data[length] = '\0';
+        if (cmd_is_priority(data))
+            sendto(drone_sock, "ok", 2, 0, (struct sockaddr *) &from, from_length);
+    }
+}
+
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t rank = (size_t) (p * (sorted.size() - 1) + 0.5);
+    return sorted[rank];
+}
+
+
+// Wait until `condition` holds, false after `ms`
+template <typename F>
+static bool wait_until(F condition, uint32_t ms)
+{
+    uint64_t end = now_us() + ms * 1000ULL;
+    while (!condition()) {
+        if (now_us() > end)
+            return false;
+        usleep(50);
+    }
+    return true;
+}
+
+
+static double bench_scenario(const scenario_t *scenario, int trials)
+{
+    std::vector<double> latency_us;
+    uint32_t lost = 0;
+
+    strcpy(priority_text, scenario->priority);
+    for (int i = 0; i < trials; i++) {
+        reset = true;
+        wait_until([] { return !reset; }, 100);
+
+        // The first setup command goes out, the rest queues behind it
+        uint32_t before = sent;
+        int setup = 0;
+        while (setup < CMD_QUEUE_LENGTH + 1 && scenario->setup[setup] != NULL)
+            post_command(scenario->setup[setup++]);
+        if (setup > 0 && !wait_until([before] { return sent != before; }, 100)) {
+            lost++;
+            continue;
+        }
+        // Press at a random phase of the comms tick
+        usleep(500 + rand() % TICK_US);
+
+        priority_sent_us = 0;
+        uint64_t press_us = now_us();
+        post_command(scenario->priority);
+        if (!wait_until([] { return priority_sent_us != 0; }, 100)) {
+            lost++;
+            continue;
+        }
+        latency_us.push_back(priority_sent_us - press_us);
+        // Let the answer arrive before the next reset
+        usleep(2000);
+    }
+    std::sort(latency_us.begin(), latency_us.end());
+
+    double worst = latency_us.empty() ? 0 : latency_us.back();
+    printf("%-13s %-10s %5zu  p50 %7.1f  p99 %7.1f  max %7.1f us%s\n", scenario->name,
+           scenario->priority, latency_us.size(), percentile(latency_us, 0.5),
+           percentile(latency_us, 0.99), worst, lost ? "  (some not sent)" : "");
+    return worst;
+}
+
+
+int main(int argc, char **argv)
+{
+    int trials = 1000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:N")) != -1) {
+        switch (opt) {
+            case 'n': trials = atoi(optarg); break;
+            case 'N': use_notify = false; break;
+            default:
+                fprintf(stderr, "usage: %s [-n trials] [-N]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    // Drone on an ephemeral loopback port, the engine socket connected to it
+    struct sockaddr_in address = {};
+    socklen_t address_length = sizeof(address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    drone_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (drone_sock < 0 || sock < 0 ||
+        bind(drone_sock, (struct sockaddr *) &address, sizeof(address)) < 0 ||
+        getsockname(drone_sock, (struct sockaddr *) &address, &address_length) < 0 ||
+        connect(sock, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        perror("socket");
+        return 1;
+    }
+    struct timeval timeout = {0, 100000};
+    setsockopt(drone_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::thread comms(comms_thread);
+    std::thread drone(drone_thread);
+
+    printf("kill to send(), %d trials per scenario, %s\n", trials,
+           use_notify ? "comms woken by notification" : "comms polling once per tick");
+    double worst = 0;
+    for (const scenario_t &scenario : scenarios)
+        worst = std::max(worst, bench_scenario(&scenario, trials));
+    printf("worst case %.1f us\n", worst);
+
+    running = false;
+    comms.join();
+    drone.join();
+
+    cmd_engine_stats_t engine;
+    cmd_engine_get_stats(&engine);
+    printf("engine (last scenario): %u priority, %u preempted, %u flushed\n",
+           engine.priority, engine.preempted, engine.flushed);
+    close(sock);
+    close(drone_sock);
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * Microbenchmark of the rc command hot path: build the command for the
+ * current setpoint, compare it with the previous one and copy it into the
+ * UDP payload.
+ *
+ *   before: heap string concatenation, string compare, copy to buffer[50]
+ *           (std::string stands in for Arduino `String`)
+ *   after:  packed setpoint compare and `rc_format()` into the payload
+ *
+ * Build and run:
+ *   g++ -O2 -I ../include rc_format_bench.cpp -o rc_format_bench
+ *   ./rc_format_bench
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include "rc_format.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#endif
+
+#define ITERATIONS  2000000
+#define SAMPLES     256
+
+
+static rc_setpoint_t samples[SAMPLES];
+static volatile size_t sink;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static uint64_t cycles(void)
+{
+#ifdef HAVE_CYCLES
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+
+static size_t run_before(void)
+{
+    uint8_t buffer[50];
+    std::string gestureCmd = "rc 0 0 0 0";
+    std::string lastGestureCmd;
+    size_t sent = 0;
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        const rc_setpoint_t *sp = &samples[i % SAMPLES];
+
+        lastGestureCmd = gestureCmd;
+        gestureCmd = "rc ";
+        gestureCmd = gestureCmd + std::to_string(sp->roll) + " " + std::to_string(sp->pitch) +
+                     " " + std::to_string(sp->throttle) + " " + std::to_string(sp->yaw);
+        if (gestureCmd != lastGestureCmd) {
+            memset(buffer, 0, sizeof(buffer));
+            memcpy(buffer, gestureCmd.c_str(), gestureCmd.length() + 1);
+            sent += buffer[3];
+        }
+    }
+    return sent;
+}
+
+
+static size_t run_after(void)
+{
+    char payload[RC_FORMAT_MAX_LENGTH];
+    rc_setpoint_t gestureCmd = {0, 0, 0, 0};
+    rc_setpoint_t lastGestureCmd;
+    size_t sent = 0;
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        lastGestureCmd = gestureCmd;
+        gestureCmd = samples[i % SAMPLES];
+        if (!rc_setpoint_equal(&gestureCmd, &lastGestureCmd)) {
+            rc_format(payload, &gestureCmd);
+            sent += payload[3];
+        }
+    }
+    return sent;
+}
+
+
+static void measure(const char *name, size_t (*run)(void))
+{
+    uint64_t start_ns = now_ns();
+    uint64_t start_cycles = cycles();
+    sink = run();
+    uint64_t total_cycles = cycles() - start_cycles;
+    uint64_t total_ns = now_ns() - start_ns;
+
+    printf("%-7s %8.1f ns/command", name, (double) total_ns / ITERATIONS);
+#ifdef HAVE_CYCLES
+    printf("  %8.1f cycles/command", (double) total_cycles / ITERATIONS);
+#endif
+    printf("\n");
+}
+
+
+int main(void)
+{
+    // Gesture values as produced by the pitch/roll quantization
+    static const int8_t levels[] = {0, 20, 30, 40, -20, -30, -40};
+    for (int i = 0; i < SAMPLES; i++) {
+        samples[i].roll = levels[i % 7];
+        samples[i].pitch = levels[(i / 7) % 7];
+        samples[i].throttle = (i % 11 == 0) ? 30 : 0;
+        samples[i].yaw = (i % 13 == 0) ? -50 : 0;
+    }
+
+    // Formatter sanity check against printf
+    char expected[32];
+    char actual[RC_FORMAT_MAX_LENGTH];
+    for (int v = -128; v < 128; v++) {
+        rc_setpoint_t sp = {(int8_t) v, (int8_t) -v, 0, (int8_t) (v / 3)};
+        snprintf(expected, sizeof(expected), "rc %d %d %d %d", sp.roll, sp.pitch, sp.throttle, sp.yaw);
+        if (rc_format(actual, &sp) != strlen(expected) || strcmp(actual, expected) != 0) {
+            printf("rc_format mismatch: '%s' != '%s'\n", actual, expected);
+            return 1;
+        }
+    }
+
+    measure("before", run_before);
+    measure("after", run_after);
+    return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * Fuzz and throughput test of the Tello state stream parser.
+ *
+ *   round trip  random states formatted like the drone does, parsed back
+ *   fuzz        mutated and random datagrams in exactly sized heap buffers,
+ *               build with sanitizers to catch any read past the end
+ *   throughput  datagrams/s of the parser against copying the datagram,
+ *               terminating it and running sscanf() over the known format
+ *
+ * Build and run:
+ *   g++ -O2 -g -fsanitize=address,undefined -I ../include state_parser_bench.cpp ../src/tello_state.cpp -o state_parser_bench
+ *   ./state_parser_bench [fuzz iterations]
+ * (drop the sanitizers for meaningful throughput numbers)
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tello_state.h"
+
+#define ROUND_TRIPS      100000
+#define FUZZ_ITERATIONS  1000000
+#define THROUGHPUT_RUNS  2000000
+
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static int random_int(int low, int high)
+{
+    return low + rand() % (high - low + 1);
+}
+
+
+static void random_state(tello_state_t *s)
+{
+    s->pitch = random_int(-90, 90);
+    s->roll = random_int(-180, 180);
+    s->yaw = random_int(-180, 180);
+    s->vgx = random_int(-100, 100);
+    s->vgy = random_int(-100, 100);
+    s->vgz = random_int(-100, 100);
+    s->templ = random_int(20, 90);
+    s->temph = s->templ + random_int(0, 5);
+    s->tof = random_int(10, 6553);
+    s->h = random_int(0, 3000);
+    s->bat = random_int(0, 100);
+    s->baro = random_int(-10000, 10000) / 100.0f;
+    s->time = random_int(0, 1000);
+    s->agx = random_int(-200000, 200000) / 100.0f;
+    s->agy = random_int(-200000, 200000) / 100.0f;
+    s->agz = random_int(-200000, 200000) / 100.0f;
+}
+
+
+// Same layout as the Tello firmware, SDK 2.0 adds the mission pad prefix
+static int format_state(char *out, size_t size, const tello_state_t *s, bool mission_pad)
+{
+    int length = 0;
+
+    if (mission_pad)
+        length = snprintf(out, size, "mid:-1;x:0;y:0;z:0;mpry:0,0,0;");
+    length += snprintf(out + length, size - length,
+                       "pitch:%d;roll:%d;yaw:%d;vgx:%d;vgy:%d;vgz:%d;templ:%d;temph:%d;"
+                       "tof:%d;h:%d;bat:%d;baro:%.2f;time:%d;agx:%.2f;agy:%.2f;agz:%.2f;\r\n",
+                       s->pitch, s->roll, s->yaw, s->vgx, s->vgy, s->vgz, s->templ, s->temph,
+                       s->tof, s->h, s->bat, s->baro, s->time, s->agx, s->agy, s->agz);
+    return length;
+}
+
+
+static bool same_state(const tello_state_t *a, const tello_state_t *b)
+{
+    return a->pitch == b->pitch && a->roll == b->roll && a->yaw == b->yaw &&
+           a->vgx == b->vgx && a->vgy == b->vgy && a->vgz == b->vgz &&
+           a->templ == b->templ && a->temph == b->temph && a->tof == b->tof &&
+           a->h == b->h && a->bat == b->bat && a->time == b->time &&
+           fabsf(a->baro - b->baro) < 0.006f && fabsf(a->agx - b->agx) < 0.006f &&
+           fabsf(a->agy - b->agy) < 0.006f && fabsf(a->agz - b->agz) < 0.006f;
+}
+
+
+static int round_trip(void)
+{
+    char text[TELLO_STATE_MAX_LENGTH];
+    int failures = 0;
+
+    for (int i = 0; i < ROUND_TRIPS; i++) {
+        tello_state_t expected, parsed = {};
+        random_state(&expected);
+        int length = format_state(text, sizeof(text), &expected, i % 2);
+        if (!tello_state_parse(text, length, &parsed) || parsed.fields != 0xFFFF ||
+            !same_state(&expected, &parsed)) {
+            if (failures++ < 5)
+                printf("  mismatch: %.*s", length, text);
+        }
+    }
+    printf("round trip: %d datagrams, %d failures\n", ROUND_TRIPS, failures);
+    return failures;
+}
+
+
+static int mutate(char *data, int length, int size)
+{
+    const char alphabet[] = "0123456789-.:;\r\nabgptxyz";
+
+    switch (length > 0 ? rand() % 6 : 5) {
+        case 0:   // Bit flip
+            data[rand() % length] ^= 1 << (rand() % 8);
+            break;
+        case 1:   // Truncate
+            length = rand() % (length + 1);
+            break;
+        case 2:   // Replace with a separator or digit
+            data[rand() % length] = alphabet[rand() % (sizeof(alphabet) - 1)];
+            break;
+        case 3:   // Delete a byte
+            memmove(data + length / 2, data + length / 2 + 1, length - length / 2 - 1);
+            length--;
+            break;
+        case 4:   // Insert a run of digits (overlong numbers)
+            if (length + 12 < size) {
+                int at = rand() % length;
+                memmove(data + at + 12, data + at, length - at);
+                for (int i = 0; i < 12; i++)
+                    data[at + i] = '0' + rand() % 10;
+                length += 12;
+            }
+            break;
+        default:  // Random bytes
+            length = rand() % size;
+            for (int i = 0; i < length; i++)
+                data[i] = rand();
+            break;
+    }
+    return length;
+}
+
+
+static void fuzz(long iterations)
+{
+    char text[TELLO_STATE_MAX_LENGTH];
+    long accepted = 0;
+
+    for (long i = 0; i < iterations; i++) {
+        tello_state_t s;
+        random_state(&s);
+        int length = format_state(text, sizeof(text), &s, rand() % 2);
+        for (int n = rand() % 4; n >= 0; n--)
+            length = mutate(text, length, sizeof(text));
+
+        // Exactly sized, not terminated: any overread hits the sanitizer
+        char *datagram = (char *) malloc(length > 0 ? length : 1);
+        memcpy(datagram, text, length);
+        tello_state_t parsed = {};
+        if (tello_state_parse(datagram, length, &parsed))
+            accepted++;
+        free(datagram);
+    }
+    printf("fuzz: %ld datagrams, %ld with fields, no crash\n", iterations, accepted);
+}
+
+
+// What a String/sscanf receiver does: copy, terminate, scan
+static bool sscanf_parse(const char *data, size_t length, tello_state_t *s)
+{
+    char copy[TELLO_STATE_MAX_LENGTH + 1];
+    int pitch, roll, yaw, vgx, vgy, vgz, templ, temph, tof, h, bat, time;
+
+    if (length > TELLO_STATE_MAX_LENGTH)
+        return false;
+    memcpy(copy, data, length);
+    copy[length] = '\0';
+    int fields = sscanf(copy, "pitch:%d;roll:%d;yaw:%d;vgx:%d;vgy:%d;vgz:%d;templ:%d;temph:%d;"
+                        "tof:%d;h:%d;bat:%d;baro:%f;time:%d;agx:%f;agy:%f;agz:%f;",
+                        &pitch, &roll, &yaw, &vgx, &vgy, &vgz, &templ, &temph,
+                        &tof, &h, &bat, &s->baro, &time, &s->agx, &s->agy, &s->agz);
+    s->bat = bat;
+    return fields == 16;
+}
+
+
+static void throughput(void)
+{
+    const int variants = 64;
+    char text[variants][TELLO_STATE_MAX_LENGTH];
+    int length[variants];
+    tello_state_t s;
+    long checksum = 0;
+
+    for (int i = 0; i < variants; i++) {
+        random_state(&s);
+        length[i] = format_state(text[i], sizeof(text[i]), &s, false);
+    }
+
+    double start = now_s();
+    for (int i = 0; i < THROUGHPUT_RUNS; i++) {
+        tello_state_parse(text[i % variants], length[i % variants], &s);
+        checksum += s.bat;
+    }
+    double parser = now_s() - start;
+
+    start = now_s();
+    for (int i = 0; i < THROUGHPUT_RUNS; i++) {
+        sscanf_parse(text[i % variants], length[i % variants], &s);
+        checksum += s.bat;
+    }
+    double baseline = now_s() - start;
+
+    printf("throughput: in place %.0f datagrams/s (%.0f ns each), sscanf %.0f datagrams/s (%.0f ns each)"
+           " [%ld]\n",
+           THROUGHPUT_RUNS / parser, parser / THROUGHPUT_RUNS * 1e9,
+           THROUGHPUT_RUNS / baseline, baseline / THROUGHPUT_RUNS * 1e9, checksum % 10);
+}
+
+
+int main(int argc, char **argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : FUZZ_ITERATIONS;
+
+    srand(1);
+    int failures = round_trip();
+    fuzz(iterations);
+    throughput();
+    return failures == 0 ? 0 : 1;
+}
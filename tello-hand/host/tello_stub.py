@@ -0,0 +1,219 @@
+#!/usr/bin/env python3
+"""
+Tello UDP emulator for host-side runs of the tello-hand command path.
+
+Listens on the SDK command port and answers like the drone does: "ok" for
+control commands, a value for read commands ("battery?") and nothing for
+"rc". Takeoff and land answer after a delay similar to the real flight.
+After the first "command" the state stream is sent to the client's address
+on the state port, 10 datagrams/s, as the drone does.
+
+A congested 2.4 GHz link is modelled on both directions:
+    --rtt / --jitter   answer delay, normally distributed [ms]
+    --loss             probability that a datagram is lost, each direction
+    --reorder          probability that an answer is held back and
+                       overtaken by the next ones
+    --error-rate       probability of an "error" answer to a control command
+    --timeout-rate     probability of a "timeout" answer to a control command
+The random generator is seeded (--seed) so runs repeat.
+
+Emulator extensions, not part of the SDK, answered at once and never lost:
+    "emu outage <ms>"  answer "ok", then drop all traffic for <ms>
+    "emu stats?"       "rc=<n> commands=<n> lost=<n> state=<n>" since start
+
+Usage:
+    python3 tello_stub.py [--port 8889] [--state-port 8890] [--takeoff-delay 4]
+                          [--rtt 20] [--jitter 5] [--loss 0.05] [--reorder 0.02]
+                          [--ignore wifi?] [--quiet]
+"""
+
+import argparse
+import heapq
+import random
+import socket
+import threading
+import time
+
+
+READ_ANSWERS = {
+    "battery?": "87",
+    "speed?": "100.0",
+    "time?": "0s",
+    "wifi?": "90",
+    "sdk?": "20",
+    "sn?": "0TQDG000000000",
+}
+
+STATE_PERIOD = 0.1
+
+
+def answer_for(command):
+    if command.startswith("rc "):
+        return None
+    if command in READ_ANSWERS:
+        return READ_ANSWERS[command]
+    return "ok"
+
+
+class Link:
+    """Delayed, lossy and reordering sender shared by both ports."""
+
+    def __init__(self, sock, args):
+        self.sock = sock
+        self.args = args
+        self.random = random.Random(args.seed)
+        self.queue = []
+        self.sequence = 0
+        self.lock = threading.Condition()
+        self.outage_until = 0.0
+        self.rc = 0
+        self.commands = 0
+        self.lost = 0
+        self.state = 0
+        threading.Thread(target=self.run, daemon=True).start()
+
+    def down(self):
+        return time.monotonic() < self.outage_until
+
+    def lose(self):
+        """One datagram crosses the link, True if it is lost."""
+        with self.lock:
+            if self.down() or self.random.random() < self.args.loss:
+                self.lost += 1
+                return True
+        return False
+
+    def delay(self):
+        with self.lock:
+            delay = self.random.gauss(self.args.rtt, self.args.jitter)
+            if self.random.random() < self.args.reorder:
+                delay += self.args.reorder_delay
+        return max(delay, 0.0) / 1000.0
+
+    def send(self, text, address, delay):
+        with self.lock:
+            heapq.heappush(self.queue, (time.monotonic() + delay, self.sequence, text, address))
+            self.sequence += 1
+            self.lock.notify()
+
+    def send_now(self, text, address):
+        self.sock.sendto(text.encode(), address)
+
+    def run(self):
+        while True:
+            with self.lock:
+                while not self.queue or self.queue[0][0] > time.monotonic():
+                    timeout = self.queue[0][0] - time.monotonic() if self.queue else None
+                    self.lock.wait(timeout)
+                _, _, text, address = heapq.heappop(self.queue)
+            if not self.lose():
+                self.sock.sendto(text.encode(), address)
+
+
+def state_line(start, battery):
+    elapsed = int(time.monotonic() - start)
+    return ("pitch:0;roll:0;yaw:0;vgx:0;vgy:0;vgz:0;templ:60;temph:63;tof:10;h:0;"
+            f"bat:{battery};baro:12.34;time:{elapsed};agx:0.00;agy:0.00;agz:-1000.00;\r\n")
+
+
+def stream_state(link, state_sock, target, args):
+    start = time.monotonic()
+    while True:
+        time.sleep(STATE_PERIOD)
+        address = target[0]
+        if address is None or link.lose():
+            continue
+        state_sock.sendto(state_line(start, READ_ANSWERS["battery?"]).encode(), address)
+        with link.lock:
+            link.state += 1
+
+
+def emulator_command(link, command, address):
+    """Handle the "emu ..." extensions, False if `command` is a drone command."""
+    if command == "emu stats?":
+        link.send_now(f"rc={link.rc} commands={link.commands} lost={link.lost} "
+                      f"state={link.state}", address)
+        return True
+    if command.startswith("emu outage "):
+        link.send_now("ok", address)
+        with link.lock:
+            link.outage_until = time.monotonic() + float(command.split()[2]) / 1000.0
+        return True
+    return False
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8889)
+    parser.add_argument("--state-port", type=int, default=8890,
+                        help="client port of the state stream, 0 to disable")
+    parser.add_argument("--delay", type=float, default=0.02,
+                        help="processing delay of ordinary commands [s]")
+    parser.add_argument("--takeoff-delay", type=float, default=4.0)
+    parser.add_argument("--land-delay", type=float, default=3.0)
+    parser.add_argument("--rtt", type=float, default=0.0, help="link round trip [ms]")
+    parser.add_argument("--jitter", type=float, default=0.0, help="std. deviation of the rtt [ms]")
+    parser.add_argument("--loss", type=float, default=0.0, help="datagram loss, each direction")
+    parser.add_argument("--reorder", type=float, default=0.0, help="answers held back")
+    parser.add_argument("--reorder-delay", type=float, default=100.0,
+                        help="extra delay of a held back answer [ms]")
+    parser.add_argument("--error-rate", type=float, default=0.0)
+    parser.add_argument("--timeout-rate", type=float, default=0.0)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--ignore", action="append", default=[],
+                        help="never answer this command (repeatable)")
+    parser.add_argument("--quiet", action="store_true", help="do not print every datagram")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.host, args.port))
+    link = Link(sock, args)
+    print(f"Tello emulator listening on {args.host}:{args.port}, rtt {args.rtt} ms "
+          f"jitter {args.jitter} ms loss {args.loss} reorder {args.reorder}")
+
+    # State stream to the client that entered SDK mode
+    state_target = [None]
+    if args.state_port:
+        state_sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        threading.Thread(target=stream_state, args=(link, state_sock, state_target, args),
+                         daemon=True).start()
+
+    start = time.monotonic()
+    while True:
+        data, address = sock.recvfrom(1024)
+        command = data.rstrip(b"\0\r\n").decode(errors="replace")
+        if not args.quiet:
+            stamp = time.monotonic() - start
+            print(f"{stamp:10.3f}  {address[0]}:{address[1]}  {command}")
+
+        if emulator_command(link, command, address):
+            continue
+        if link.lose():
+            continue
+        text = answer_for(command)
+        with link.lock:
+            if text is None:
+                link.rc += 1
+                continue
+            link.commands += 1
+            if text == "ok" and link.random.random() < args.error_rate:
+                text = "error"
+            elif text == "ok" and link.random.random() < args.timeout_rate:
+                text = "timeout"
+        if command in args.ignore:
+            continue
+        if command == "command" and args.state_port:
+            state_target[0] = (address[0], args.state_port)
+
+        delay = args.delay
+        if command == "takeoff":
+            delay = args.takeoff_delay
+        elif command == "land":
+            delay = args.land_delay
+        link.send(text, address, delay + link.delay())
+
+
+if __name__ == "__main__":
+    main()
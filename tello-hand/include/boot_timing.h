@@ -0,0 +1,41 @@
+/*
+ * Boot stage timing.
+ *
+ * setup() no longer runs the start-up in line: the display and UI come
+ * up first, the IMU initializes in its own task, the buttons in the
+ * control task and WiFi (with the config portal) in a boot task, all at
+ * the same time. Each stage marks its start and end here, from whatever
+ * task runs it; the UI task prints the table once the drone answered its
+ * first command, or once nothing runs any more after a failure.
+ *
+ * Times are esp_timer microseconds since the start of the application.
+ */
+
+#ifndef BOOT_TIMING_H
+#define BOOT_TIMING_H
+
+#include <Arduino.h>
+
+typedef enum {
+    BOOT_SERIAL = 0,
+    BOOT_DISPLAY,            // Panel, renderer and I2C bus; the UI task is live after it
+    BOOT_BUTTONS,            // Pins in setup(), interrupts in the control task
+    BOOT_IMU,                // MPU6050 and its offsets, in the IMU task
+    BOOT_WIFI,               // Until the station has an address
+    BOOT_DRONE,              // From the link to the first answered command
+    BOOT_STAGES
+} boot_stage_t;
+
+// Only the first call of each has an effect; `note` must be a literal
+void boot_stage_start(boot_stage_t stage);
+void boot_stage_done(boot_stage_t stage, const char *note = NULL);
+void boot_stage_fail(boot_stage_t stage, const char *note);
+
+// All stages done, or none running any more after one failed (a stage
+// that depends on the failed one never starts)
+bool boot_settled(void);
+
+// One line per stage and the boot-to-ready time
+void boot_report(Print &out);
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * Interrupt-driven buttons with a hardware-timer debounce.
+ *
+ * Replaces the EasyButton instances that were polled with `read()` once
+ * per control cycle, so a press was only seen when the control loop got
+ * around to it. Every button pin raises a GPIO interrupt on both edges.
+ * The first edge that changes the level is reported at once, stamped
+ * with `esp_timer_get_time()`, and locks the pin out for
+ * `BUTTON_DEBOUNCE_MS`; contact bounce inside that window is ignored. A
+ * periodic hardware timer ends the lock-out and re-samples the pin, so a
+ * release (or a press shorter than the window) is reported at most one
+ * timer tick after the window closes. Events go to a FreeRTOS queue and
+ * wake the consumer task, independent of how long its cycle is.
+ *
+ * A button may also report a sequence: `count` presses within
+ * `window_ms` of the first one post one BUTTON_EVENT_SEQUENCE, after the
+ * press that completes it (the kill button double press).
+ *
+ * Buttons are active low with the pull-up enabled, as EasyButton used
+ * them. GPIO 34--39 have no internal pull-up and need an external one;
+ * the short glitches GPIO 36/39 show with the ADC or WiFi active are
+ * rejected since the level is read again in the interrupt.
+ */
+
+#ifndef BUTTON_INPUT_H
+#define BUTTON_INPUT_H
+
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define BUTTON_INPUT_MAX      8
+#define BUTTON_INPUT_QUEUE    16
+
+#ifndef BUTTON_DEBOUNCE_MS
+#define BUTTON_DEBOUNCE_MS    20
+#endif
+
+// Hardware timer 0 (timer 1 is the flight replay), 1 us per count
+#define BUTTON_INPUT_TIMER    0
+#define BUTTON_INPUT_DIVIDER  80
+#define BUTTON_INPUT_TICK_US  1000
+
+typedef enum {
+    BUTTON_EVENT_PRESS = 0,
+    BUTTON_EVENT_RELEASE,
+    BUTTON_EVENT_SEQUENCE
+} button_event_type_t;
+
+typedef struct {
+    uint8_t button;        // Id given to button_input_add()
+    uint8_t type;          // button_event_type_t
+    uint8_t count;         // Presses of a BUTTON_EVENT_SEQUENCE
+    int64_t time_us;       // Of the edge, or of the tick ending a lock-out; esp_timer
+} button_event_t;
+
+typedef struct {
+    uint32_t events;       // Posted to the queue
+    uint32_t bounces;      // Edges ignored during a lock-out or without a level change
+    uint32_t overflows;    // Events lost, queue full
+    uint32_t latency_max_us;   // Edge to button_input_read()
+} button_input_stats_t;
+
+// Register a button before button_input_begin()
+bool button_input_add(uint8_t button, uint8_t pin);
+
+// Report `count` presses within `window_ms` as one sequence event
+void button_input_sequence(uint8_t button, uint8_t count, uint32_t window_ms);
+
+// Attach the interrupts and start the timer; `task` is notified per event
+void button_input_begin(TaskHandle_t task);
+
+// Take the next event without waiting, false if there is none
+bool button_input_read(button_event_t *event);
+
+void button_input_get_stats(button_input_stats_t *stats);
+
+#endif
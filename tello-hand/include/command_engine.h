@@ -0,0 +1,106 @@
+/*
+ * Non-blocking Tello command engine.
+ *
+ * Acknowledged commands (`command`, `takeoff`, `battery?`, ...) are queued
+ * and sent one at a time. The engine remembers a deadline for the command
+ * waiting for its answer and `cmd_engine_poll()` checks for the response
+ * without blocking, so the caller's loop keeps running at full rate.
+ * `rc` commands have no answer and are sent immediately.
+ *
+ * The drone's answers carry no id, so after a command expired its answer
+ * may still arrive while the next one waits. For `CMD_LATE_ANSWER_MS`
+ * after an expiry, answers of the wrong kind for the waiting command (a
+ * value for a control command, "ok" for a `?` read command) are taken as
+ * such late answers and dropped instead of completing the wrong command.
+ *
+ * "emergency" and "land" take a priority lane: they end the wait of the
+ * command in flight (reported as CMD_RESULT_PREEMPTED) and are sent at
+ * once, ahead of everything queued. "emergency" also discards the queue;
+ * "land" does not preempt another priority command and waits first.
+ *
+ * The engine does not depend on Arduino; the UDP socket and the clock are
+ * provided through `cmd_transport_t`, so the same code runs on the host.
+ */
+
+#ifndef COMMAND_ENGINE_H
+#define COMMAND_ENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Longest command or response incl. terminating null character
+#define CMD_MAX_LENGTH       50
+
+// Acknowledged commands waiting to be sent
+#define CMD_QUEUE_LENGTH     8
+
+// Default response deadlines [ms]
+#define CMD_TIMEOUT_DEFAULT  5000
+#define CMD_TIMEOUT_TAKEOFF  20000
+#define CMD_TIMEOUT_LAND     10000
+
+// How long after an expiry a late answer is expected [ms]
+#define CMD_LATE_ANSWER_MS   5000
+
+typedef enum {
+    CMD_RESULT_OK = 0,      // "ok"
+    CMD_RESULT_VALUE,       // Read command answer, e.g. "87" for "battery?"
+    CMD_RESULT_ERROR,       // "error ..."
+    CMD_RESULT_TIMEOUT,     // Drone answered "timeout"
+    CMD_RESULT_NO_RESPONSE, // Deadline passed without any answer
+    CMD_RESULT_PREEMPTED    // Wait ended by "emergency" or "land"
+} cmd_result_t;
+
+#define CMD_RESULTS          (CMD_RESULT_PREEMPTED + 1)
+
+typedef struct {
+    // Send one datagram to the drone, return true on success
+    bool (*send)(const uint8_t *data, size_t length);
+    // Read one pending datagram into `data`, return 0 if there is none
+    int (*receive)(uint8_t *data, size_t size);
+    // Monotonic time in milliseconds
+    uint32_t (*now_ms)(void);
+} cmd_transport_t;
+
+typedef struct {
+    uint8_t depth;            // Queued, not yet sent
+    uint8_t depth_max;
+    bool waiting;             // A command waits for its answer
+    uint32_t submitted;       // Acknowledged commands accepted
+    uint32_t dropped;         // Rejected, queue full or too long
+    uint32_t completed;       // Answered, incl. "error" and "timeout"
+    uint32_t expired;         // Deadline passed without an answer
+    uint32_t priority;        // Sent through the priority lane
+    uint32_t preempted;       // Waits ended by a priority command
+    uint32_t flushed;         // Queued commands discarded for one
+    uint32_t stale;           // Late answers dropped
+    uint32_t rc_sent;
+} cmd_engine_stats_t;
+
+// Called from `cmd_engine_poll()` once an acknowledged command completes
+typedef void (*cmd_response_cb_t)(const char *command, cmd_result_t result,
+                                  const char *response, uint32_t rtt_ms);
+
+void cmd_engine_init(const cmd_transport_t *transport, cmd_response_cb_t on_response);
+
+// Queue a command; `timeout_ms` = 0 selects the deadline by command type.
+// `rc` commands are sent at once, priority commands preempt the wait.
+// Returns false if the queue is full.
+bool cmd_engine_submit(const char *command, uint32_t timeout_ms);
+
+// Send pending commands, check for a response and expire the deadline
+void cmd_engine_poll(void);
+
+// True while a command waits for its answer or the queue is not empty
+bool cmd_engine_busy(void);
+
+// Counters are single words, safe to read from another task
+void cmd_engine_get_stats(cmd_engine_stats_t *stats);
+
+// "emergency" and "land"
+bool cmd_is_priority(const char *command);
+
+// Deadline used for `command` when the caller does not give one
+uint32_t cmd_default_timeout(const char *command);
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * Tilt to rc command curves, generated at compile time.
+ *
+ * Each axis maps the MPU6050 tilt angle (-90..90 deg) to an rc value:
+ * zero inside the deadband, then `min_rate` rising to `max_rate` at
+ * `full_tilt` with an expo blend (0 = linear, 1 = cubic). The curve is
+ * evaluated by the compiler into a 181-entry table, so the runtime mapping
+ * is one clamp and one table index, no float math.
+ *
+ * The profile is picked with `CONTROL_PROFILE` (see platformio.ini); the
+ * tables of the other profiles are never built into the firmware.
+ */
+
+#ifndef CONTROL_CURVE_H
+#define CONTROL_CURVE_H
+
+#include <stdint.h>
+
+#define CURVE_MAX_ANGLE  90
+#define CURVE_LENGTH     (2 * CURVE_MAX_ANGLE + 1)
+
+typedef struct {
+    uint8_t deadband;    // |tilt| up to this angle gives 0 [deg]
+    uint8_t full_tilt;   // Tilt with max_rate [deg]
+    uint8_t min_rate;    // rc value just outside the deadband
+    uint8_t max_rate;    // rc value at and beyond full_tilt
+    float expo;          // 0 = linear .. 1 = cubic
+} curve_params_t;
+
+typedef struct {
+    curve_params_t roll;
+    curve_params_t pitch;
+} control_profile_t;
+
+typedef struct {
+    int8_t value[CURVE_LENGTH];
+} curve_table_t;
+
+// Named profiles
+namespace control_profiles {
+    // Close to the original 20/30/40 steps with 10/15 deg deadbands
+    constexpr control_profile_t classic = {
+        {10, 40, 20, 40, 0.0f},
+        {15, 40, 20, 40, 0.0f},
+    };
+    // Wide deadband, soft center, low top speed
+    constexpr control_profile_t beginner = {
+        {12, 45, 10, 30, 0.6f},
+        {15, 45, 10, 30, 0.6f},
+    };
+    // Small deadband, fine control near center, full speed at the edge
+    constexpr control_profile_t sport = {
+        {6, 35, 5, 80, 0.4f},
+        {8, 35, 5, 80, 0.4f},
+    };
+}
+
+#ifndef CONTROL_PROFILE
+#define CONTROL_PROFILE  classic
+#endif
+
+constexpr int8_t curve_value(const curve_params_t &p, int angle)
+{
+    int magnitude = angle < 0 ? -angle : angle;
+    if (magnitude <= p.deadband)
+        return 0;
+
+    float x = float(magnitude - p.deadband) / float(p.full_tilt - p.deadband);
+    if (x > 1.0f)
+        x = 1.0f;
+    float y = (1.0f - p.expo) * x + p.expo * x * x * x;
+    int rate = int(p.min_rate + y * (p.max_rate - p.min_rate) + 0.5f);
+
+    // Pilot perspective: tilting forward/left (negative angle) is a positive rc value
+    return angle < 0 ? rate : -rate;
+}
+
+
+constexpr curve_table_t make_curve(const curve_params_t &p)
+{
+    curve_table_t table = {};
+    for (int angle = -CURVE_MAX_ANGLE; angle <= CURVE_MAX_ANGLE; angle++)
+        table.value[angle + CURVE_MAX_ANGLE] = curve_value(p, angle);
+    return table;
+}
+
+
+inline constexpr curve_table_t rollCurve = make_curve(control_profiles::CONTROL_PROFILE.roll);
+inline constexpr curve_table_t pitchCurve = make_curve(control_profiles::CONTROL_PROFILE.pitch);
+
+static_assert(rollCurve.value[CURVE_MAX_ANGLE] == 0, "Roll curve must be zero at rest");
+static_assert(pitchCurve.value[CURVE_MAX_ANGLE] == 0, "Pitch curve must be zero at rest");
+static_assert(rollCurve.value[0] == -rollCurve.value[CURVE_LENGTH - 1], "Roll curve must be symmetric");
+
+
+static inline int8_t curve_lookup(const curve_table_t &table, int angle)
+{
+    if (angle < -CURVE_MAX_ANGLE)
+        angle = -CURVE_MAX_ANGLE;
+    else if (angle > CURVE_MAX_ANGLE)
+        angle = CURVE_MAX_ANGLE;
+    return table.value[angle + CURVE_MAX_ANGLE];
+}
+
+#endif
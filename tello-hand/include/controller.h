@@ -0,0 +1,68 @@
+/*
+ * Controller logic: gesture mapping, button handling and command
+ * sequencing (takeoff, land, emergency, recovery from a lost answer).
+ *
+ * Moved out of `main.cpp` so it depends on nothing but `hal.h`, the
+ * command engine types and the control curves. The firmware feeds it from
+ * the pipeline tasks; the `native` simulator feeds it from recorded IMU
+ * traces and a simulated drone.
+ *
+ * Threading as in the firmware: `controller_set_angles()`,
+ * `controller_button()` and `controller_update()` run in the control task,
+ * `controller_on_response()` and `controller_on_battery()` in the comms task.
+ */
+
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include <stdint.h>
+#include "command_engine.h"
+
+// Length of one response wait tick of the original polling loop [ms]
+#define UDP_TICK_MS          500
+
+// Tello battery warning level [%], from the state stream
+#define TELLO_BATTERY_LOW    30
+
+typedef enum {
+    BUTTON_TAKEOFF = 0,      // Takeoff, or land when in flight
+    BUTTON_KILL,             // Emergency stop, aborts a replay
+    BUTTON_KILL_DOUBLE,      // Reset the WiFi settings
+    BUTTON_UP,
+    BUTTON_DOWN,
+    BUTTON_CW,
+    BUTTON_CCW,
+    BUTTONS
+} button_t;
+
+// Newest fused IMU angles [deg]
+void controller_set_angles(int roll, int pitch, int yaw);
+
+// Gesture and rc button setpoints; off while a ground station sends them
+void controller_set_gestures(bool enabled);
+
+// A flight replay started or ended: the drone counts as in flight, with
+// the setpoints coming from the replay
+void controller_on_replay(bool running);
+
+void controller_button(button_t button);
+
+// Gesture mapping and error recovery, once per control cycle
+void controller_update(void);
+
+// Tello SDK mode after the link comes up, which also starts the state stream
+void controller_start_session(const char *ssid);
+
+// Send a command, `udp_delay_ticks` x UDP_TICK_MS is its deadline
+void controller_command(const char *command, int udp_delay_ticks);
+
+// Command engine response callback (cmd_response_cb_t)
+void controller_on_response(const char *command, cmd_result_t result,
+                            const char *response, uint32_t rtt_ms);
+
+// Battery level from the state stream, `first` of the session
+void controller_on_battery(int percent, bool first);
+
+bool controller_in_flight(void);
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Binary flight recorder.
+ *
+ * Replaces the text flight file of the old SPIFFS code, which opened,
+ * appended and closed the file for every command. Events are stored as
+ * fixed-size 20-byte records in a RAM ring buffer; logging is a copy under
+ * a spinlock and never touches flash. A low-priority task writes every full
+ * block of records to LittleFS and the remainder when the flight ends.
+ *
+ * File layout (little endian), decoded by `host/flight_decode.py`:
+ *   flight_file_header_t, then flight_record_t until the end of the file
+ */
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stdint.h>
+#include "rc_format.h"
+
+#define FLIGHT_REC_PATH           "/flight.bin"
+#define FLIGHT_REC_MAGIC          0x31524654   // "TFR1"
+#define FLIGHT_REC_VERSION        1
+
+// Records per flash write and blocks in the RAM ring
+#define FLIGHT_REC_BLOCK_RECORDS  64
+#define FLIGHT_REC_BLOCKS         4
+#define FLIGHT_REC_CAPACITY       (FLIGHT_REC_BLOCK_RECORDS * FLIGHT_REC_BLOCKS)
+
+#define FLIGHT_REC_CORE           0
+#define FLIGHT_REC_PRIORITY       1
+#define FLIGHT_REC_STACK          4096
+
+typedef enum {
+    FLIGHT_EVENT_SETPOINT = 0,   // New rc setpoint with the IMU angles
+    FLIGHT_EVENT_COMMAND,        // Acknowledged command passed to the engine
+    FLIGHT_EVENT_RESPONSE        // Its completion, `result` and `rtt_ms` valid
+} flight_event_t;
+
+typedef enum {
+    FLIGHT_CMD_RC = 0,
+    FLIGHT_CMD_COMMAND,
+    FLIGHT_CMD_TAKEOFF,
+    FLIGHT_CMD_LAND,
+    FLIGHT_CMD_EMERGENCY,
+    FLIGHT_CMD_BATTERY,
+    FLIGHT_CMD_OTHER
+} flight_command_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+} flight_file_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t time_ms;            // Since flight_recorder_start()
+    uint8_t event;               // flight_event_t
+    uint8_t command;             // flight_command_t
+    uint8_t result;              // cmd_result_t of a response
+    uint8_t reserved;
+    uint16_t rtt_ms;             // Response time, saturated
+    rc_setpoint_t rc;            // Setpoint in effect
+    int16_t roll, pitch, yaw;    // IMU angles [deg]
+} flight_record_t;
+
+static_assert(sizeof(flight_record_t) == 20, "flight_record_t is part of the file format");
+
+typedef struct {
+    uint32_t records;            // Logged since start
+    uint32_t dropped;            // Ring full, flash too slow
+    uint32_t blocks;             // Flash writes
+    uint32_t flush_max_us;       // Slowest flash write
+    bool active;
+} flight_recorder_stats_t;
+
+// Mount LittleFS (formats it once if needed) and start the flush task
+bool flight_recorder_begin(void);
+
+// New recording, replaces the previous flight file once the flush task has
+// finished it. Does nothing if the task is still behind on earlier flights.
+void flight_recorder_start(void);
+
+// End of flight: the remaining records are written and the file closed
+void flight_recorder_stop(void);
+
+void flight_recorder_log_setpoint(const rc_setpoint_t *rc, int16_t roll, int16_t pitch, int16_t yaw);
+void flight_recorder_log_command(const char *command);
+void flight_recorder_log_response(const char *command, uint8_t result, uint32_t rtt_ms);
+
+void flight_recorder_get_stats(flight_recorder_stats_t *stats);
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * Timer-driven replay of a recorded flight.
+ *
+ * Replaces the old `processFlightReplay()`, which parsed the text flight
+ * file line by line and `delay()`ed between commands, so parse and send
+ * time added up as drift. `flight_replay_load()` reads the binary flight
+ * recorder file once into a compact schedule of (offset, command, rc)
+ * events. During the replay a hardware timer counting microseconds from
+ * the start raises an interrupt at each event's original offset; a high
+ * priority task sends the event and arms the alarm for the next one.
+ * Offsets are absolute, so send latency never accumulates.
+ *
+ * `flight_replay_abort()` stops the schedule at any point; the controller
+ * then sends "emergency" on the command engine's priority lane, like any
+ * other emergency stop.
+ */
+
+#ifndef FLIGHT_REPLAY_H
+#define FLIGHT_REPLAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "flight_recorder.h"
+
+// Longest schedule loaded [events]
+#define FLIGHT_REPLAY_MAX_EVENTS  8192
+
+// Hardware timer 1, 80 MHz APB / 80 = 1 us per count
+#define FLIGHT_REPLAY_TIMER       1
+#define FLIGHT_REPLAY_DIVIDER     80
+
+#define FLIGHT_REPLAY_CORE        1
+#define FLIGHT_REPLAY_PRIORITY    10
+#define FLIGHT_REPLAY_STACK       3072
+
+// Number of command types, indexed by flight_command_t
+#define FLIGHT_REPLAY_COMMANDS    (FLIGHT_CMD_OTHER + 1)
+
+typedef struct {
+    uint32_t count;
+    uint32_t jitter_avg_us;   // Mean lateness of the send against the offset
+    uint32_t jitter_max_us;
+    uint32_t worst_event;     // Schedule index of the latest send
+} flight_replay_jitter_t;
+
+typedef struct {
+    uint32_t events;          // In the loaded schedule
+    uint32_t sent;
+    uint32_t duration_ms;     // Offset of the last event
+    bool running;
+    bool aborted;
+    flight_replay_jitter_t command[FLIGHT_REPLAY_COMMANDS];
+} flight_replay_stats_t;
+
+// Send one datagram to the drone, return true on success
+typedef bool (*replay_send_fn_t)(const uint8_t *data, size_t length);
+
+void flight_replay_begin(replay_send_fn_t send);
+
+// Read a flight recorder file into the schedule, returns the event count
+uint32_t flight_replay_load(const char *path);
+
+// Start the loaded schedule, false if empty or already running
+bool flight_replay_start(void);
+
+// Stop the schedule, the caller sends "emergency"
+void flight_replay_abort(void);
+
+bool flight_replay_running(void);
+
+void flight_replay_get_stats(flight_replay_stats_t *stats);
+
+#endif
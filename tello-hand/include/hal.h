@@ -0,0 +1,54 @@
+/*
+ * Hardware abstraction for the controller logic (`controller.h`).
+ *
+ * The controller never touches Arduino globals (`Serial`, `display`,
+ * `digitalWrite`, `WiFiUDP`, `millis`); everything it needs from the
+ * board goes through these functions. The firmware implements them in
+ * `main.cpp` on top of the pipeline tasks; the `native` environment
+ * implements them in `src/sim/` with a virtual clock and a simulated
+ * drone, so the same logic runs on Linux faster than real time.
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include "rc_format.h"
+
+typedef enum {
+    HAL_LED_IN_FLIGHT = 0,
+    HAL_LED_BATTERY_LOW
+} hal_led_t;
+
+// Monotonic time [ms]
+uint32_t hal_millis(void);
+
+// One line on the serial log
+void hal_log(const char *text);
+
+// Show `text` on the display, optionally cleared first
+void hal_show(bool clear, const char *text);
+
+void hal_led(hal_led_t led, bool on);
+
+// Queue an acknowledged command with a response deadline, false if dropped.
+// The answer comes back through `controller_on_response()`.
+bool hal_command(const char *command, uint32_t timeout_ms);
+
+// rc setpoint for the streaming task, and whether it streams at all
+void hal_rc_set(const rc_setpoint_t *sp);
+void hal_rc_enable(bool on);
+
+// WiFi link to the drone
+bool hal_link_connected(void);
+// Forget the Tello SSID and restart into the config portal
+void hal_reset_wifi(void);
+
+// Flight recorder, started with the takeoff and stopped on the ground
+void hal_recording(bool on);
+
+// Replay of the recorded flight, started by the console "replay" command
+void hal_replay_abort(void);
+bool hal_replay_running(void);
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Shared I2C bus scheduler for the MPU6050 and the SH1106 display.
+ *
+ * Both devices sit on `Wire`. The bus runs in fast mode (400 kHz) and
+ * every user takes it for one short transaction at a time: the IMU for
+ * its 14-byte burst read, the display for one chunk of a page. The IMU
+ * always wins: a display chunk is not started while the IMU waits, nor
+ * when the IMU's next read is due before the chunk would finish. The IMU
+ * therefore never waits longer than one display chunk
+ * (`I2C_BUS_MAX_IMU_WAIT_US`).
+ */
+
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <stdint.h>
+
+#define I2C_BUS_CLOCK_HZ         400000
+
+// Worst-case time of one display chunk (address + 32 data bytes) [us]
+#define I2C_BUS_CHUNK_US         1000
+#define I2C_BUS_MAX_IMU_WAIT_US  I2C_BUS_CHUNK_US
+
+typedef enum {
+    I2C_CLIENT_IMU = 0,
+    I2C_CLIENT_DISPLAY,
+    I2C_CLIENT_COUNT
+} i2c_client_t;
+
+typedef struct {
+    uint32_t transactions;
+    uint32_t wait_avg_us;
+    uint32_t wait_max_us;
+} i2c_client_stats_t;
+
+typedef struct {
+    float utilization;    // Share of the window the bus was held [%]
+    i2c_client_stats_t client[I2C_CLIENT_COUNT];
+} i2c_bus_stats_t;
+
+// Call once the display is initialized; the MPU6050 is set up through
+// the scheduler afterwards, by the IMU task
+void i2c_bus_begin(uint32_t clock_hz);
+
+void i2c_bus_acquire(i2c_client_t client);
+void i2c_bus_release(i2c_client_t client);
+
+// IMU announces when its next read is due [esp_timer us]
+void i2c_bus_set_next_imu_read(int64_t due_us);
+
+// Copy the statistics and start a new window
+void i2c_bus_get_stats(i2c_bus_stats_t *stats);
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * MPU6050 FIFO driver woken by the data-ready interrupt.
+ *
+ * Instead of polling `mpu.update()` (one I2C read per call, whether or
+ * not there is a new sample), the sensor samples itself at a fixed rate
+ * set by the sample-rate divider and DLPF, and queues accel + gyro in its
+ * FIFO. The INT pin wakes the IMU task every `IMU_FIFO_BATCH` samples and
+ * `imu_fifo_read()` drains them in burst reads, so each sample is
+ * processed exactly once with a known spacing of 1/IMU_FIFO_RATE_HZ.
+ *
+ * MPU6050_light still does the initialization and offset calibration;
+ * this driver reconfigures the rate, filter and FIFO afterwards.
+ */
+
+#ifndef IMU_FIFO_H
+#define IMU_FIFO_H
+
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define IMU_FIFO_ADDRESS      0x68
+
+// Gyro output is 1 kHz with DLPF on: rate = 1000 / (1 + divider)
+#ifndef IMU_FIFO_RATE_HZ
+#define IMU_FIFO_RATE_HZ      250
+#endif
+#define IMU_FIFO_DLPF         3       // 44 Hz accel / 42 Hz gyro bandwidth
+
+// Samples per wake-up
+#ifndef IMU_FIFO_BATCH
+#define IMU_FIFO_BATCH        5
+#endif
+
+// Accel (6 bytes) + gyro (6 bytes) per sample
+#define IMU_FIFO_SAMPLE_SIZE  12
+// The FIFO holds 1024 bytes, the Wire buffer 128
+#define IMU_FIFO_MAX_SAMPLES  (1024 / IMU_FIFO_SAMPLE_SIZE)
+#define IMU_FIFO_READ_SAMPLES (120 / IMU_FIFO_SAMPLE_SIZE)
+// Spacing of the samples [us]
+#define IMU_FIFO_SAMPLE_US    (1000000 / IMU_FIFO_RATE_HZ)
+
+typedef struct {
+    int16_t ax, ay, az;   // Raw counts, offsets removed
+    int16_t gx, gy, gz;
+} imu_raw_sample_t;
+
+typedef struct {
+    uint32_t samples;        // Samples drained since start
+    uint32_t transactions;   // I2C transactions since start
+    uint32_t wakeups;
+    uint32_t overflows;      // FIFO resets after an overflow
+} imu_fifo_stats_t;
+
+// Configure the MPU6050 and attach the interrupt; `task` is notified
+bool imu_fifo_begin(uint8_t int_pin, TaskHandle_t task);
+
+// Offsets subtracted from every sample [raw counts]
+void imu_fifo_set_offsets(const int16_t offsets[6]);
+
+// Drain up to `max` samples, return how many were read
+uint16_t imu_fifo_read(imu_raw_sample_t *samples, uint16_t max);
+
+void imu_fifo_get_stats(imu_fifo_stats_t *stats);
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Latency tracing of the gesture pipeline, IMU sample to drone.
+ *
+ * Every stage is timed and counted into a log-linear histogram: values are
+ * bucketed by power of two, each power split into 8 linear sub-buckets, so
+ * the relative error is at most 12.5% from nanoseconds to a minute with a
+ * fixed 272 counters per histogram. `trace_dump()` prints one line per
+ * histogram with percentiles and the non-empty buckets.
+ *
+ * Stages inside one task are timed with the CPU cycle counter. The cycle
+ * counters of the two cores are not synchronized, so the spans that cross
+ * cores (setpoint to rc packet, sample to rc packet) use `esp_timer`.
+ *
+ * Only built with `-D LATENCY_TRACE`; otherwise the TRACE_* macros expand
+ * to nothing and no code or RAM is used.
+ */
+
+#ifndef LATENCY_TRACE_H
+#define LATENCY_TRACE_H
+
+#include <stdint.h>
+
+typedef enum {
+    TRACE_IMU_READ = 0,       // I2C read of the MPU6050 (poll or FIFO drain)
+    TRACE_FUSION,             // Mahony update(s)
+    TRACE_IMU_TO_CONTROL,     // Sample queued -> picked up by the control task
+    TRACE_MAPPING,            // control_update(): buttons, curves, setpoint
+    TRACE_SETPOINT_TO_SEND,   // New setpoint -> its first rc packet sent
+    TRACE_UDP_SEND,           // udp.beginPacket() .. endPacket()
+    TRACE_SAMPLE_TO_SEND,     // IMU sample -> rc packet leaves, end to end
+    // Command sent -> drone answer, per command type
+    TRACE_ACK_COMMAND,
+    TRACE_ACK_TAKEOFF,
+    TRACE_ACK_LAND,
+    TRACE_ACK_EMERGENCY,
+    TRACE_ACK_OTHER,
+    TRACE_HISTOGRAMS
+} trace_histogram_t;
+
+#define TRACE_SUB_BUCKET_BITS  3
+#define TRACE_MAX_EXPONENT     35    // 2^36 ns ~ 68 s
+#define TRACE_BUCKETS          ((TRACE_MAX_EXPONENT - TRACE_SUB_BUCKET_BITS + 2) << TRACE_SUB_BUCKET_BITS)
+
+// How often the UI task dumps the histograms [ms]
+#define TRACE_DUMP_INTERVAL_MS 30000
+
+#ifdef LATENCY_TRACE
+
+#include <Arduino.h>
+
+static inline uint32_t trace_cycles(void)
+{
+    return ESP.getCycleCount();
+}
+
+void trace_begin(void);
+
+// Elapsed since `start_cycles`, taken on the same core
+void trace_record_cycles(trace_histogram_t histogram, uint32_t start_cycles);
+void trace_record_us(trace_histogram_t histogram, uint32_t elapsed_us);
+
+// A new setpoint from the sample taken at `sample_us` (esp_timer)
+void trace_setpoint(int64_t sample_us);
+// rc packet sent: closes the spans of a pending setpoint
+void trace_setpoint_sent(void);
+
+// Acknowledged command completed after `rtt_ms`
+void trace_ack(const char *command, uint32_t rtt_ms);
+
+// Print all non-empty histograms and start over
+void trace_dump(Print &out);
+
+#define TRACE_BEGIN()                   trace_begin()
+#define TRACE_START(var)                uint32_t var = trace_cycles()
+#define TRACE_STAGE(histogram, start)   trace_record_cycles(histogram, start)
+#define TRACE_SETPOINT(sample_us)       trace_setpoint(sample_us)
+#define TRACE_SETPOINT_SENT()           trace_setpoint_sent()
+#define TRACE_ACK(command, rtt_ms)      trace_ack(command, rtt_ms)
+#define TRACE_DUMP(out)                 trace_dump(out)
+
+#else
+
+#define TRACE_BEGIN()                   ((void) 0)
+#define TRACE_START(var)                ((void) 0)
+#define TRACE_STAGE(histogram, start)   ((void) 0)
+#define TRACE_SETPOINT(sample_us)       ((void) 0)
+#define TRACE_SETPOINT_SENT()           ((void) 0)
+#define TRACE_ACK(command, rtt_ms)      ((void) 0)
+#define TRACE_DUMP(out)                 ((void) 0)
+
+#endif
+
+#endif
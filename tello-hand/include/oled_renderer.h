@@ -0,0 +1,54 @@
+/*
+ * Double-buffered SH1106 renderer with dirty-page tracking.
+ *
+ * Drawing goes to an off-screen canvas (back buffer). `oled_flush()`
+ * converts it to the SH1106 page layout, compares every 128-byte page
+ * with the copy of what the panel already shows (front buffer) and sends
+ * only the pages that changed. A text status update usually touches one
+ * or two of the eight pages instead of the full 1 KB frame.
+ *
+ * The display must be initialized with `Adafruit_SH1106::begin()` first;
+ * after that only the renderer writes to it.
+ */
+
+#ifndef OLED_RENDERER_H
+#define OLED_RENDERER_H
+
+#include <stdint.h>
+#include <Adafruit_GFX.h>
+
+#define OLED_WIDTH          128
+#define OLED_HEIGHT         64
+#define OLED_PAGES          (OLED_HEIGHT / 8)
+#define OLED_I2C_ADDRESS    0x3C
+
+// SH1106 RAM is 132 columns wide, the visible 128 start at column 2
+#define OLED_COLUMN_OFFSET  2
+
+// Data bytes per I2C transaction
+#define OLED_CHUNK_LENGTH   32
+
+// Default frame rate cap of the UI task [frames/s]
+#ifndef OLED_FPS
+#define OLED_FPS            10
+#endif
+
+typedef struct {
+    uint32_t frames;          // Flushes with at least one dirty page
+    uint32_t pages_written;
+    uint32_t pages_skipped;   // Unchanged pages not sent
+    uint32_t last_flush_us;
+    uint32_t max_flush_us;
+} oled_stats_t;
+
+void oled_begin(void);
+
+// Back buffer to draw into
+GFXcanvas1 &oled_canvas(void);
+
+// Send the changed pages to the panel, return how many were written
+uint8_t oled_flush(void);
+
+void oled_get_stats(oled_stats_t *stats);
+
+#endif
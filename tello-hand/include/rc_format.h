@@ -0,0 +1,89 @@
+/*
+ * Allocation-free rc setpoint handling.
+ *
+ * The four rc channels are kept as a packed 4-byte struct, so two
+ * setpoints are compared as a single 32-bit word, and the "rc a b c d"
+ * command is written by a small integer formatter straight into the
+ * caller's packet buffer. No `String`, no heap, no printf.
+ */
+
+#ifndef RC_FORMAT_H
+#define RC_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Longest command "rc -128 -128 -128 -128" incl. terminating null character
+#define RC_FORMAT_MAX_LENGTH  24
+
+typedef struct __attribute__((packed)) {
+    int8_t roll;
+    int8_t pitch;
+    int8_t throttle;
+    int8_t yaw;
+} rc_setpoint_t;
+
+static inline uint32_t rc_setpoint_word(const rc_setpoint_t *sp)
+{
+    uint32_t word;
+    memcpy(&word, sp, sizeof(word));
+    return word;
+}
+
+
+static inline bool rc_setpoint_equal(const rc_setpoint_t *a, const rc_setpoint_t *b)
+{
+    return rc_setpoint_word(a) == rc_setpoint_word(b);
+}
+
+
+static inline bool rc_setpoint_is_hover(const rc_setpoint_t *sp)
+{
+    return rc_setpoint_word(sp) == 0;
+}
+
+
+// Write one channel value (-128..127) and return the next free position
+static inline char *rc_format_int(char *out, int8_t value)
+{
+    int v = value;
+
+    if (v < 0) {
+        *out++ = '-';
+        v = -v;
+    }
+    if (v >= 100) {
+        *out++ = '0' + v / 100;
+        v %= 100;
+        *out++ = '0' + v / 10;
+    }
+    else if (v >= 10) {
+        *out++ = '0' + v / 10;
+    }
+    *out++ = '0' + v % 10;
+    return out;
+}
+
+
+// Write "rc roll pitch throttle yaw" incl. null character to `out`
+// (at least RC_FORMAT_MAX_LENGTH bytes), return the length without it
+static inline size_t rc_format(char *out, const rc_setpoint_t *sp)
+{
+    char *p = out;
+
+    *p++ = 'r';
+    *p++ = 'c';
+    *p++ = ' ';
+    p = rc_format_int(p, sp->roll);
+    *p++ = ' ';
+    p = rc_format_int(p, sp->pitch);
+    *p++ = ' ';
+    p = rc_format_int(p, sp->throttle);
+    *p++ = ' ';
+    p = rc_format_int(p, sp->yaw);
+    *p = '\0';
+    return p - out;
+}
+
+#endif
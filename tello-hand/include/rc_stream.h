@@ -0,0 +1,67 @@
+/*
+ * Fixed-rate rc streaming task.
+ *
+ * The control code only publishes the latest roll/pitch/throttle/yaw
+ * setpoint. A FreeRTOS task pinned to `RC_STREAM_CORE` sends it to the
+ * drone every period, independent of the loop speed and of how often the
+ * gesture changes. While the setpoint stays at hover the task drops to a
+ * keep-alive interval, still well inside the drone's rc timeout.
+ *
+ * Setpoints are coalesced latest-wins: one published while the previous
+ * one has not been sent yet replaces it, so a stale setpoint is never sent
+ * and gestures never queue up behind each other or behind a command that
+ * waits for its answer.
+ */
+
+#ifndef RC_STREAM_H
+#define RC_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "rc_format.h"
+
+// Streaming rate [Hz], clamped to 10--50
+#ifndef RC_STREAM_RATE_HZ
+#define RC_STREAM_RATE_HZ       20
+#endif
+#define RC_STREAM_MIN_HZ        10
+#define RC_STREAM_MAX_HZ        50
+
+// Hover setpoint is repeated at this interval [ms]
+#ifndef RC_STREAM_KEEPALIVE_MS
+#define RC_STREAM_KEEPALIVE_MS  1000
+#endif
+
+// Time at full rate after the setpoint returns to hover [ms]
+#define RC_STREAM_HOLD_MS       500
+
+#define RC_STREAM_CORE          0
+#define RC_STREAM_PRIORITY      3
+#define RC_STREAM_STACK         3072
+
+typedef struct {
+    uint32_t sent;            // Packets since start
+    uint32_t keepalives;      // Hover packets sent at the keep-alive interval
+    uint32_t send_errors;
+    uint32_t updates;         // Setpoints published while streaming
+    uint32_t coalesced;       // Replaced before they were sent
+    float rate_hz;            // Achieved rate over the last window
+    uint32_t jitter_avg_us;   // Mean |actual - scheduled| period over the window
+    uint32_t jitter_max_us;   // Worst period error over the window
+} rc_stream_stats_t;
+
+// Send one datagram to the drone, return true on success
+typedef bool (*rc_send_fn_t)(const uint8_t *data, size_t length);
+
+void rc_stream_begin(rc_send_fn_t send, uint16_t rate_hz);
+
+// Start/stop streaming; stopping resets the setpoint to hover
+void rc_stream_enable(bool enable);
+
+// Publish the latest setpoint, the task picks it up at its next period
+void rc_stream_set(int roll, int pitch, int throttle, int yaw);
+
+// Copy the counters and start a new rate/jitter window
+void rc_stream_get_stats(rc_stream_stats_t *stats);
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ * Serial-to-UDP bridge for a ground station on USB serial.
+ *
+ * In bridge mode a PC script drives the drone through the controller
+ * with `serial_frame.h` frames instead of console text. Entered with the
+ * console command "bridge"; the host waits for the "bridge: on" line and
+ * from then on sends frames only, until BRIDGE_EXIT.
+ *
+ * Host to controller:
+ *   BRIDGE_RC       one or more 4-byte setpoints (roll, pitch, throttle,
+ *                   yaw as int8), oldest first. Only the newest one is
+ *                   handed on: the rc stream sends it at its fixed rate,
+ *                   latest-wins, so any host rate fits the WiFi link.
+ *   BRIDGE_COMMAND  sequence number (0--254) and SDK command text, queued
+ *                   like a console command; never waits for the drone.
+ *   BRIDGE_EXIT     back to console mode.
+ * Controller to host:
+ *   BRIDGE_ACK      sequence, cmd_result_t, round trip [ms, uint16],
+ *                   answer text. BRIDGE_REJECTED if the command could not
+ *                   be queued; sequence BRIDGE_SEQ_NONE for commands the
+ *                   controller sent itself (e.g. "emergency" by button).
+ *   BRIDGE_STATE    each state stream datagram, as bridge_state_t
+ *   BRIDGE_STATS    bridge_stats_t, once per report interval
+ * Multi-byte values are little endian.
+ *
+ * At most BRIDGE_PENDING commands may wait for their answers; more are
+ * rejected at once, so the host gets flow control instead of a stall.
+ *
+ * Failsafe: if no valid frame arrived for BRIDGE_SILENCE_MS while a host
+ * setpoint is in effect (script crashed, cable pulled), `bridge_poll()`
+ * sets the rc setpoint to hover and counts it in `silences`.
+ *
+ * The code does not depend on Arduino; serial, rc and command queueing
+ * are provided through `bridge_io_t`, so it also runs on the host.
+ */
+
+#ifndef SERIAL_BRIDGE_H
+#define SERIAL_BRIDGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "command_engine.h"
+#include "rc_format.h"
+#include "tello_state.h"
+
+#define BRIDGE_RC           0x01
+#define BRIDGE_COMMAND      0x02
+#define BRIDGE_EXIT         0x03
+#define BRIDGE_ACK          0x81
+#define BRIDGE_STATE        0x82
+#define BRIDGE_STATS        0x83
+
+#define BRIDGE_PENDING      4
+#define BRIDGE_SILENCE_MS   500
+#define BRIDGE_SEQ_NONE     0xFF
+#define BRIDGE_REJECTED     0xFF    // BRIDGE_ACK result
+
+typedef struct __attribute__((packed)) {
+    int16_t pitch, roll, yaw;    // [deg]
+    int16_t vgx, vgy, vgz;       // [dm/s]
+    int16_t templ, temph;        // [deg C]
+    int16_t tof, h;              // [cm]
+    int16_t bat;                 // [%]
+    int16_t time;                // [s]
+    int16_t baro_cm;
+    int16_t agx, agy, agz;       // [0.001 g]
+} bridge_state_t;
+
+typedef struct {
+    uint32_t frames;             // Valid frames received
+    uint32_t crc_errors;
+    uint32_t setpoints;          // Received in BRIDGE_RC frames
+    uint32_t coalesced;          // Replaced within a batch, not handed on
+    uint32_t commands;
+    uint32_t rejected;
+    uint32_t acks;
+    uint32_t states;
+    uint32_t silences;           // Host went quiet, setpoint set to hover
+} bridge_stats_t;
+
+typedef struct {
+    // Upstream serial; one call per frame, writers must not interleave
+    void (*write)(const uint8_t *data, size_t length);
+    // Latest setpoint for the rc stream
+    void (*set_rc)(const rc_setpoint_t *setpoint);
+    // Queue an SDK command, false if it cannot be taken now
+    bool (*command)(const char *text);
+    uint32_t (*clock_ms)(void);
+} bridge_io_t;
+
+void bridge_init(const bridge_io_t *io);
+
+void bridge_enter(void);
+void bridge_exit(void);
+bool bridge_active(void);
+
+// Bytes received on serial while the bridge is active
+void bridge_receive(const uint8_t *data, size_t length);
+
+// Host silence failsafe, call at least every BRIDGE_SILENCE_MS / 5
+void bridge_poll(void);
+
+// Relay upstream, from the task that owns the command engine
+void bridge_on_response(const char *command, cmd_result_t result,
+                        const char *response, uint32_t rtt_ms);
+// A command taken by io->command() that the engine queue refused
+void bridge_on_dropped(const char *command);
+void bridge_on_state(const tello_state_t *state);
+void bridge_send_stats(void);
+
+// Counters are single words with one writer each, safe to read from
+// another task
+void bridge_get_stats(bridge_stats_t *stats);
+
+#endif
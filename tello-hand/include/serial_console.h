@@ -0,0 +1,54 @@
+/*
+ * Non-blocking serial command console.
+ *
+ * Replaces the disabled handler that waited in
+ * `Serial.readStringUntil('\n')` for up to the Stream timeout and then
+ * ran a `startsWith` chain over `String`s. Received bytes are fed one at
+ * a time into a fixed line buffer, as serial-echo does, so the reader
+ * takes only what is already there. A complete line is matched by its
+ * first word against a constant command table; the rest of the line is
+ * the handler's argument. Lines longer than the buffer are discarded
+ * whole rather than run truncated.
+ *
+ * Nothing allocates or waits, and the code does not depend on Arduino.
+ */
+
+#ifndef SERIAL_CONSOLE_H
+#define SERIAL_CONSOLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CONSOLE_LINE_LENGTH  64
+
+typedef void (*console_handler_t)(const char *argument);
+
+typedef struct {
+    const char *name;
+    console_handler_t handler;
+    bool argument;            // An argument is required
+} console_command_t;
+
+typedef struct {
+    char text[CONSOLE_LINE_LENGTH];
+    uint8_t length;
+    bool overflow;            // Current line too long, discarded at its end
+} console_line_t;
+
+typedef enum {
+    CONSOLE_OK = 0,
+    CONSOLE_EMPTY,            // Blank line, ignored
+    CONSOLE_UNKNOWN,          // Not in the table, `fallback` called if given
+    CONSOLE_NO_ARGUMENT       // Required argument missing, handler not called
+} console_result_t;
+
+// Add one received byte; true when `line->text` holds a complete line.
+// "\n", "\r" and "\r\n" all end a line.
+bool console_feed(console_line_t *line, char c);
+
+// Run the handler of the first word of `text`. Unknown commands go whole
+// to `fallback`, which may be NULL.
+console_result_t console_dispatch(const console_command_t *table, size_t count,
+                                  const char *text, console_handler_t fallback);
+
+#endif
@@ -0,0 +1,47 @@
+/*
+ * Per-task CPU load accounting.
+ *
+ * A task marks the start and end of its useful work with
+ * `task_load_begin()`/`task_load_end()`; the time spent blocked in
+ * FreeRTOS waits is not counted. `task_load_percent()` returns the busy
+ * share of the wall time since the previous call.
+ */
+
+#ifndef TASK_LOAD_H
+#define TASK_LOAD_H
+
+#include <stdint.h>
+#include <esp_timer.h>
+
+typedef struct {
+    const char *name;
+    volatile uint32_t busy_us;   // Busy time in the current window
+    int64_t started_us;          // Start of the running work slice
+    int64_t window_us;           // Start of the current window
+} task_load_t;
+
+static inline void task_load_begin(task_load_t *load)
+{
+    load->started_us = esp_timer_get_time();
+}
+
+
+static inline void task_load_end(task_load_t *load)
+{
+    load->busy_us += (uint32_t) (esp_timer_get_time() - load->started_us);
+}
+
+
+// Busy share of the window [%], starts a new window
+static inline float task_load_percent(task_load_t *load)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed = now - load->window_us;
+    float percent = elapsed > 0 ? 100.0f * load->busy_us / elapsed : 0.0f;
+
+    load->busy_us = 0;
+    load->window_us = now;
+    return percent;
+}
+
+#endif
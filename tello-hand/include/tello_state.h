@@ -0,0 +1,64 @@
+/*
+ * Parser for the Tello state stream.
+ *
+ * Once in SDK mode the drone sends its state to UDP port 8890 about ten
+ * times per second, as one text datagram of `key:value;` pairs:
+ *
+ *   pitch:0;roll:0;yaw:0;vgx:0;vgy:0;vgz:0;templ:60;temph:62;tof:10;h:0;
+ *   bat:87;baro:-38.56;time:0;agx:-3.00;agy:1.00;agz:-999.00;\r\n
+ *
+ * `tello_state_parse()` reads the datagram in place, without copying it,
+ * without a terminating null character and without `String`/heap use,
+ * into a typed `tello_state_t`. Unknown keys (e.g. the mission pad fields
+ * of SDK 2.0) are skipped. No Arduino dependency, so it builds on the host.
+ */
+
+#ifndef TELLO_STATE_H
+#define TELLO_STATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TELLO_STATE_PORT        8890
+
+// Longest datagram the receiver reads, the real ones are about 150 bytes
+#define TELLO_STATE_MAX_LENGTH  256
+
+// Bits of `tello_state_t.fields`
+typedef enum {
+    TELLO_STATE_PITCH  = 1 << 0,
+    TELLO_STATE_ROLL   = 1 << 1,
+    TELLO_STATE_YAW    = 1 << 2,
+    TELLO_STATE_VGX    = 1 << 3,
+    TELLO_STATE_VGY    = 1 << 4,
+    TELLO_STATE_VGZ    = 1 << 5,
+    TELLO_STATE_TEMPL  = 1 << 6,
+    TELLO_STATE_TEMPH  = 1 << 7,
+    TELLO_STATE_TOF    = 1 << 8,
+    TELLO_STATE_HEIGHT = 1 << 9,
+    TELLO_STATE_BAT    = 1 << 10,
+    TELLO_STATE_BARO   = 1 << 11,
+    TELLO_STATE_TIME   = 1 << 12,
+    TELLO_STATE_AGX    = 1 << 13,
+    TELLO_STATE_AGY    = 1 << 14,
+    TELLO_STATE_AGZ    = 1 << 15
+} tello_state_field_t;
+
+typedef struct {
+    int16_t pitch, roll, yaw;   // Attitude [deg]
+    int16_t vgx, vgy, vgz;      // Speed [dm/s]
+    int16_t templ, temph;       // Lowest and highest temperature [deg C]
+    int16_t tof;                // Time-of-flight distance [cm]
+    int16_t h;                  // Height [cm]
+    int16_t bat;                // Battery [%]
+    int16_t time;               // Motors on [s]
+    float baro;                 // Barometer height [m]
+    float agx, agy, agz;        // Acceleration [0.001 g]
+    uint32_t fields;            // TELLO_STATE_* present in the datagram
+} tello_state_t;
+
+// Parse one datagram of `length` bytes. Fields missing from the datagram
+// keep their previous value. Returns false if no known field was found.
+bool tello_state_parse(const char *data, size_t length, tello_state_t *state);
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ * WiFi link to the Tello as a state machine, run by its own task.
+ *
+ * The system event handler only posts LINK_EVENT_UP/LINK_EVENT_DOWN and
+ * the comms task posts LINK_EVENT_ACK for each answered command; joining,
+ * the Tello session and the timeouts all happen in `link_poll()`:
+ *
+ *   LINK_DOWN      waiting for the next attempt
+ *   LINK_JOINING   join with the cached BSSID and channel, no scan
+ *   LINK_SCANNING  join with a full scan (the config portal at boot)
+ *   LINK_SESSION   got an IP, "command" sent, waiting for an answer
+ *   LINK_UP        the drone answered
+ *   LINK_OFF       the config portal timed out, reset needed
+ *
+ * The access point of the last link is kept, by the caller in RTC memory,
+ * so a drop and also a restart rejoin without scanning all channels.
+ * After LINK_FAST_ATTEMPTS failed fast joins, LINK_FAST_RETRY_MS apart,
+ * a full scan follows, then fast joins again. The rc stream is not
+ * touched: it keeps the latest setpoint and resumes as soon as the socket
+ * works again.
+ *
+ * Each recovery from a drop is timed from the drop to the first answer
+ * and handed to `link_io_t.report`.
+ *
+ * `link_rejoin()` moves to another network: the link leaves the current
+ * one, forgets its access point and joins with a full scan after
+ * LINK_RETRY_MS, so the disconnect of the old link lands in LINK_DOWN.
+ *
+ * The code does not depend on Arduino; the WiFi driver and the session
+ * are provided through `link_io_t`.
+ */
+
+#ifndef WIFI_LINK_H
+#define WIFI_LINK_H
+
+#include <stdint.h>
+
+#define LINK_FAST_ATTEMPTS        8
+#define LINK_FAST_TIMEOUT_MS      2000
+#define LINK_FAST_RETRY_MS        250     // Pause after a failed fast join
+#define LINK_SCAN_TIMEOUT_MS      10000
+#define LINK_SESSION_TIMEOUT_MS   3000    // Without an answer "command" is sent again
+#define LINK_RETRY_MS             500     // Pause after a failed scan
+
+typedef enum {
+    LINK_DOWN,
+    LINK_JOINING,
+    LINK_SCANNING,
+    LINK_SESSION,
+    LINK_UP,
+    LINK_OFF
+} link_state_t;
+
+typedef enum {
+    LINK_EVENT_UP,       // Got an IP
+    LINK_EVENT_DOWN,     // Disconnected, also a failed join
+    LINK_EVENT_ACK       // The drone answered a command
+} link_event_t;
+
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+} link_ap_t;
+
+typedef struct {
+    uint32_t down_ms;        // Drop to the IP
+    uint32_t join_ms;        // Last join attempt to the IP
+    uint32_t ack_ms;         // IP to the first answer
+    uint32_t total_ms;       // Drop to the first answer
+    uint8_t attempts;        // Join attempts, fast and scanning
+    bool fast;               // Joined without a scan
+} link_reconnect_t;
+
+typedef struct {
+    uint32_t reconnects;
+    uint32_t fast;           // Of those, joined without a scan
+    uint32_t last_ms;        // Drop to the first answer
+    uint32_t max_ms;
+} link_stats_t;
+
+typedef struct {
+    // Start joining `ap` on its channel, or with a full scan if NULL. May
+    // block (the config portal); false if the link cannot come up at all.
+    bool (*join)(const link_ap_t *ap);
+    // The link is up: fill in the access point, open the sockets and
+    // start the Tello session; `resumed` after a drop
+    void (*up)(link_ap_t *ap, bool resumed);
+    // No answer yet on this link: start the session again, sockets as they are
+    void (*session)(void);
+    void (*down)(void);
+    // Disconnect on purpose, for link_rejoin()
+    void (*leave)(void);
+    void (*report)(const link_reconnect_t *reconnect);
+} link_io_t;
+
+// `cached`: access point of an earlier link, or NULL
+void link_begin(const link_io_t *io, const link_ap_t *cached);
+
+// Events are posted by one task each: UP/DOWN by the WiFi event task,
+// ACK by the comms task
+void link_post(link_event_t event);
+
+// Leave the current network and scan for the one the caller now joins,
+// from any task; also call link_poll() or wake the link task
+void link_rejoin(void);
+
+// Handle posted events and timeouts, returns the time until the next
+// timeout [ms]; also call it after each link_post()
+uint32_t link_poll(uint32_t now_ms);
+
+link_state_t link_state(void);
+const char *link_state_name(link_state_t state);
+void link_get_stats(link_stats_t *stats);
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Boot stage timing, see `boot_timing.h`.
+ */
+
+#include <atomic>
+#include <esp_timer.h>
+#include "boot_timing.h"
+
+typedef enum {
+    STAGE_PENDING = 0,
+    STAGE_RUNNING,
+    STAGE_DONE,
+    STAGE_FAILED
+} stage_state_t;
+
+static const char *names[BOOT_STAGES] = {"serial", "display", "buttons", "imu", "wifi", "drone"};
+
+// Written by the task that runs the stage, read by the UI task once the
+// state says the times are complete
+static uint32_t start_us[BOOT_STAGES];
+static uint32_t end_us[BOOT_STAGES];
+static const char *notes[BOOT_STAGES];
+static std::atomic<uint8_t> states[BOOT_STAGES];
+
+
+void boot_stage_start(boot_stage_t stage)
+{
+    if (states[stage].load(std::memory_order_acquire) != STAGE_PENDING)
+        return;
+    start_us[stage] = esp_timer_get_time();
+    states[stage].store(STAGE_RUNNING, std::memory_order_release);
+}
+
+
+static void finish(boot_stage_t stage, uint8_t state, const char *note)
+{
+    uint8_t expected = STAGE_RUNNING;
+
+    if (states[stage].load(std::memory_order_acquire) != STAGE_RUNNING)
+        return;
+    end_us[stage] = esp_timer_get_time();
+    notes[stage] = note;
+    states[stage].compare_exchange_strong(expected, state);
+}
+
+
+void boot_stage_done(boot_stage_t stage, const char *note)
+{
+    finish(stage, STAGE_DONE, note);
+}
+
+
+void boot_stage_fail(boot_stage_t stage, const char *note)
+{
+    finish(stage, STAGE_FAILED, note);
+}
+
+
+bool boot_settled(void)
+{
+    bool all_done = true;
+    bool failed = false;
+
+    for (uint8_t i = 0; i < BOOT_STAGES; i++) {
+        uint8_t state = states[i].load(std::memory_order_acquire);
+        if (state == STAGE_RUNNING)
+            return false;
+        if (state == STAGE_FAILED)
+            failed = true;
+        if (state != STAGE_DONE)
+            all_done = false;
+    }
+    return all_done || failed;
+}
+
+
+void boot_report(Print &out)
+{
+    uint32_t ready_us = 0;
+    bool ready = true;
+
+    for (uint8_t i = 0; i < BOOT_STAGES; i++) {
+        uint8_t state = states[i].load(std::memory_order_acquire);
+        if (state == STAGE_PENDING) {
+            out.printf("boot: %-8s not started\n", names[i]);
+            ready = false;
+            continue;
+        }
+        if (state == STAGE_RUNNING) {
+            out.printf("boot: %-8s %6lu ..        ms\n", names[i], start_us[i] / 1000UL);
+            ready = false;
+            continue;
+        }
+        out.printf("boot: %-8s %6lu .. %6lu ms%s%s%s\n", names[i], start_us[i] / 1000UL,
+                   end_us[i] / 1000UL, state == STAGE_FAILED ? "  failed" : "",
+                   notes[i] ? "  " : "", notes[i] ? notes[i] : "");
+        if (state == STAGE_FAILED)
+            ready = false;
+        if (end_us[i] > ready_us)
+            ready_us = end_us[i];
+    }
+    if (ready)
+        out.printf("boot: ready after %lu ms\n", ready_us / 1000UL);
+    else
+        out.printf("boot: not ready\n");
+}
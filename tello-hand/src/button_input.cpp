@@ -0,0 +1,182 @@
+/*
+ * Interrupt-driven buttons, see `button_input.h`.
+ */
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <freertos/queue.h>
+#include "button_input.h"
+
+
+typedef struct {
+    uint8_t button;
+    uint8_t pin;
+    bool pressed;                // Last reported level
+    bool locked;                 // Debounce lock-out running
+    int64_t unlock_us;
+    uint8_t sequence_count;      // 0: no sequence
+    uint8_t presses;             // Of the sequence in progress
+    uint32_t sequence_window_us;
+    int64_t sequence_start_us;
+} button_pin_t;
+
+static button_pin_t buttons[BUTTON_INPUT_MAX];
+static uint8_t button_count = 0;
+
+static QueueHandle_t queue = NULL;
+static TaskHandle_t notify_task = NULL;
+static hw_timer_t *timer = NULL;
+
+// Both interrupts and the stats readers
+static portMUX_TYPE input_mux = portMUX_INITIALIZER_UNLOCKED;
+static button_input_stats_t stats = {};
+
+
+static void IRAM_ATTR post(const button_pin_t *b, button_event_type_t type, uint8_t count,
+                           int64_t now, BaseType_t *woken)
+{
+    button_event_t event = {b->button, (uint8_t) type, count, now};
+
+    if (xQueueSendFromISR(queue, &event, woken) != pdTRUE) {
+        stats.overflows++;
+        return;
+    }
+    stats.events++;
+    if (notify_task != NULL)
+        vTaskNotifyGiveFromISR(notify_task, woken);
+}
+
+
+// New level: post it, count the sequence and start the lock-out
+static void IRAM_ATTR report(button_pin_t *b, bool pressed, int64_t now, BaseType_t *woken)
+{
+    b->pressed = pressed;
+    post(b, pressed ? BUTTON_EVENT_PRESS : BUTTON_EVENT_RELEASE, 0, now, woken);
+
+    if (pressed && b->sequence_count > 0) {
+        if (b->presses == 0 || now - b->sequence_start_us > b->sequence_window_us) {
+            b->presses = 0;
+            b->sequence_start_us = now;
+        }
+        if (++b->presses == b->sequence_count) {
+            post(b, BUTTON_EVENT_SEQUENCE, b->presses, now, woken);
+            b->presses = 0;
+        }
+    }
+    b->locked = true;
+    b->unlock_us = now + BUTTON_DEBOUNCE_MS * 1000;
+}
+
+
+// Either edge of a button pin
+static void IRAM_ATTR on_edge(void *arg)
+{
+    button_pin_t *b = (button_pin_t *) arg;
+    int64_t now = esp_timer_get_time();
+    BaseType_t woken = pdFALSE;
+
+    portENTER_CRITICAL_ISR(&input_mux);
+    // Read again, a glitch shorter than the interrupt latency is gone
+    bool pressed = digitalRead(b->pin) == LOW;
+    if (b->locked || pressed == b->pressed)
+        stats.bounces++;
+    else
+        report(b, pressed, now, &woken);
+    portEXIT_CRITICAL_ISR(&input_mux);
+    portYIELD_FROM_ISR(woken);
+}
+
+
+// Timer tick: end the lock-outs that are due, with the level settled by now
+static void IRAM_ATTR on_tick(void)
+{
+    int64_t now = esp_timer_get_time();
+    BaseType_t woken = pdFALSE;
+
+    portENTER_CRITICAL_ISR(&input_mux);
+    for (uint8_t i = 0; i < button_count; i++) {
+        button_pin_t *b = &buttons[i];
+        if (!b->locked || now < b->unlock_us)
+            continue;
+        b->locked = false;
+        bool pressed = digitalRead(b->pin) == LOW;
+        if (pressed != b->pressed)
+            report(b, pressed, now, &woken);
+    }
+    portEXIT_CRITICAL_ISR(&input_mux);
+    portYIELD_FROM_ISR(woken);
+}
+
+
+static button_pin_t *find(uint8_t button)
+{
+    for (uint8_t i = 0; i < button_count; i++) {
+        if (buttons[i].button == button)
+            return &buttons[i];
+    }
+    return NULL;
+}
+
+
+bool button_input_add(uint8_t button, uint8_t pin)
+{
+    if (button_count == BUTTON_INPUT_MAX || find(button) != NULL)
+        return false;
+    button_pin_t *b = &buttons[button_count++];
+    memset(b, 0, sizeof(*b));
+    b->button = button;
+    b->pin = pin;
+    return true;
+}
+
+
+void button_input_sequence(uint8_t button, uint8_t count, uint32_t window_ms)
+{
+    button_pin_t *b = find(button);
+
+    if (b == NULL)
+        return;
+    b->sequence_count = count;
+    b->sequence_window_us = window_ms * 1000;
+}
+
+
+void button_input_begin(TaskHandle_t task)
+{
+    queue = xQueueCreate(BUTTON_INPUT_QUEUE, sizeof(button_event_t));
+    notify_task = task;
+
+    for (uint8_t i = 0; i < button_count; i++) {
+        button_pin_t *b = &buttons[i];
+        pinMode(b->pin, INPUT_PULLUP);
+        b->pressed = digitalRead(b->pin) == LOW;
+        attachInterruptArg(b->pin, on_edge, b, CHANGE);
+    }
+
+    timer = timerBegin(BUTTON_INPUT_TIMER, BUTTON_INPUT_DIVIDER, true);
+    timerAttachInterrupt(timer, on_tick, true);
+    timerAlarmWrite(timer, BUTTON_INPUT_TICK_US, true);
+    timerAlarmEnable(timer);
+}
+
+
+bool button_input_read(button_event_t *event)
+{
+    if (queue == NULL || xQueueReceive(queue, event, 0) != pdTRUE)
+        return false;
+
+    uint32_t latency_us = esp_timer_get_time() - event->time_us;
+    portENTER_CRITICAL(&input_mux);
+    if (latency_us > stats.latency_max_us)
+        stats.latency_max_us = latency_us;
+    portEXIT_CRITICAL(&input_mux);
+    return true;
+}
+
+
+void button_input_get_stats(button_input_stats_t *out)
+{
+    portENTER_CRITICAL(&input_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&input_mux);
+}
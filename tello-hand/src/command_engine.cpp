@@ -0,0 +1,265 @@
+/*
+ * Non-blocking Tello command engine, see `command_engine.h`.
+ */
+
+#include <string.h>
+#include "command_engine.h"
+
+
+typedef enum {
+    ENGINE_IDLE = 0,
+    ENGINE_AWAIT_RESPONSE
+} engine_state_t;
+
+typedef struct {
+    char text[CMD_MAX_LENGTH];
+    uint32_t timeout_ms;
+} pending_cmd_t;
+
+static const cmd_transport_t *transport = NULL;
+static cmd_response_cb_t response_cb = NULL;
+static engine_state_t state = ENGINE_IDLE;
+
+// Queued acknowledged commands (ring buffer)
+static pending_cmd_t queue[CMD_QUEUE_LENGTH];
+static uint8_t queue_head = 0;
+static uint8_t queue_count = 0;
+
+// Command waiting for its answer
+static pending_cmd_t active;
+static uint32_t active_sent_ms = 0;
+
+static uint8_t rx_buffer[CMD_MAX_LENGTH];
+
+// Response callbacks may submit follow-up commands
+static bool polling = false;
+
+// Expired commands whose answers may still arrive, and since when
+static uint8_t late_answers = 0;
+static uint32_t last_expiry_ms = 0;
+
+static cmd_engine_stats_t stats = {};
+
+
+static bool starts_with(const char *text, const char *prefix)
+{
+    return strncmp(text, prefix, strlen(prefix)) == 0;
+}
+
+
+static bool send_text(const char *text)
+{
+    // Keep sending the terminating null character as the original firmware did
+    return transport->send((const uint8_t *) text, strlen(text) + 1);
+}
+
+
+static cmd_result_t classify_response(const char *response)
+{
+    if (strstr(response, "error") != NULL)
+        return CMD_RESULT_ERROR;
+    if (strstr(response, "timeout") != NULL)
+        return CMD_RESULT_TIMEOUT;
+    if (strstr(response, "ok") != NULL)
+        return CMD_RESULT_OK;
+    return CMD_RESULT_VALUE;
+}
+
+
+// Read commands ("battery?") answer with a value, all others with "ok"
+static bool answer_matches(const char *command, cmd_result_t result)
+{
+    bool read = command[strlen(command) - 1] == '?';
+
+    if (result == CMD_RESULT_OK)
+        return !read;
+    if (result == CMD_RESULT_VALUE)
+        return read;
+    return true;    // "error" and "timeout" answer both kinds
+}
+
+
+static void complete_active(cmd_result_t result, const char *response)
+{
+    uint32_t rtt_ms = transport->now_ms() - active_sent_ms;
+
+    state = ENGINE_IDLE;
+    if (result == CMD_RESULT_NO_RESPONSE || result == CMD_RESULT_PREEMPTED) {
+        if (result == CMD_RESULT_NO_RESPONSE)
+            stats.expired++;
+        else
+            stats.preempted++;
+        // Its answer may still arrive
+        if (late_answers < CMD_QUEUE_LENGTH)
+            late_answers++;
+        last_expiry_ms = transport->now_ms();
+    }
+    else {
+        stats.completed++;
+    }
+    if (response_cb != NULL)
+        response_cb(active.text, result, response, rtt_ms);
+}
+
+
+uint32_t cmd_default_timeout(const char *command)
+{
+    if (strstr(command, "takeoff") != NULL)
+        return CMD_TIMEOUT_TAKEOFF;
+    if (strstr(command, "land") != NULL)
+        return CMD_TIMEOUT_LAND;
+    return CMD_TIMEOUT_DEFAULT;
+}
+
+
+bool cmd_is_priority(const char *command)
+{
+    return strcmp(command, "emergency") == 0 || strcmp(command, "land") == 0;
+}
+
+
+// Safety lane: end the current wait and go out ahead of the queue
+static bool submit_priority(const char *command, uint32_t timeout_ms)
+{
+    bool emergency = strcmp(command, "emergency") == 0;
+    bool was_polling = polling;
+
+    // Callbacks of the preempted command only queue, they do not send
+    polling = true;
+    if (state == ENGINE_AWAIT_RESPONSE && (emergency || !cmd_is_priority(active.text)))
+        complete_active(CMD_RESULT_PREEMPTED, "");
+    polling = was_polling;
+
+    if (emergency) {
+        stats.flushed += queue_count;
+        queue_count = 0;
+    }
+    else if (queue_count == CMD_QUEUE_LENGTH) {
+        // Make room by dropping the newest queued command
+        stats.flushed++;
+        queue_count--;
+    }
+
+    queue_head = (queue_head + CMD_QUEUE_LENGTH - 1) % CMD_QUEUE_LENGTH;
+    pending_cmd_t *slot = &queue[queue_head];
+    strcpy(slot->text, command);
+    slot->timeout_ms = timeout_ms;
+    queue_count++;
+    stats.submitted++;
+    stats.priority++;
+    if (queue_count > stats.depth_max)
+        stats.depth_max = queue_count;
+
+    if (!polling)
+        cmd_engine_poll();
+    return true;
+}
+
+
+void cmd_engine_init(const cmd_transport_t *t, cmd_response_cb_t on_response)
+{
+    transport = t;
+    response_cb = on_response;
+    state = ENGINE_IDLE;
+    queue_head = 0;
+    queue_count = 0;
+    late_answers = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+
+bool cmd_engine_submit(const char *command, uint32_t timeout_ms)
+{
+    // rc commands are never acknowledged by the drone
+    if (starts_with(command, "rc ")) {
+        stats.rc_sent++;
+        return send_text(command);
+    }
+
+    if (command[0] == '\0' || strlen(command) >= CMD_MAX_LENGTH) {
+        stats.dropped++;
+        return false;
+    }
+
+    // Takeoff and land always get their long deadlines
+    uint32_t type_timeout = cmd_default_timeout(command);
+    if (timeout_ms == 0 || type_timeout != CMD_TIMEOUT_DEFAULT)
+        timeout_ms = type_timeout;
+
+    if (cmd_is_priority(command))
+        return submit_priority(command, timeout_ms);
+    if (queue_count == CMD_QUEUE_LENGTH) {
+        stats.dropped++;
+        return false;
+    }
+
+    pending_cmd_t *slot = &queue[(queue_head + queue_count) % CMD_QUEUE_LENGTH];
+    strcpy(slot->text, command);
+    slot->timeout_ms = timeout_ms;
+    queue_count++;
+    stats.submitted++;
+    if (queue_count > stats.depth_max)
+        stats.depth_max = queue_count;
+
+    // Do not wait for the next poll if the line is free
+    if (!polling)
+        cmd_engine_poll();
+    return true;
+}
+
+
+void cmd_engine_poll(void)
+{
+    polling = true;
+
+    int length = transport->receive(rx_buffer, sizeof(rx_buffer) - 1);
+
+    if (late_answers > 0 && transport->now_ms() - last_expiry_ms >= CMD_LATE_ANSWER_MS)
+        late_answers = 0;
+
+    if (length > 0) {
+        rx_buffer[length] = '\0';
+        cmd_result_t result = classify_response((const char *) rx_buffer);
+        if (state != ENGINE_AWAIT_RESPONSE ||
+            (late_answers > 0 && !answer_matches(active.text, result))) {
+            // Late answer to an already expired command
+            stats.stale++;
+            if (late_answers > 0)
+                late_answers--;
+        }
+        else {
+            complete_active(result, (const char *) rx_buffer);
+        }
+    }
+    else if (state == ENGINE_AWAIT_RESPONSE &&
+             transport->now_ms() - active_sent_ms >= active.timeout_ms) {
+        complete_active(CMD_RESULT_NO_RESPONSE, "");
+    }
+
+    if (state == ENGINE_IDLE && queue_count > 0) {
+        active = queue[queue_head];
+        queue_head = (queue_head + 1) % CMD_QUEUE_LENGTH;
+        queue_count--;
+
+        active_sent_ms = transport->now_ms();
+        state = ENGINE_AWAIT_RESPONSE;
+        if (!send_text(active.text))
+            complete_active(CMD_RESULT_NO_RESPONSE, "");
+    }
+
+    polling = false;
+}
+
+
+void cmd_engine_get_stats(cmd_engine_stats_t *out)
+{
+    *out = stats;
+    out->depth = queue_count;
+    out->waiting = state == ENGINE_AWAIT_RESPONSE;
+}
+
+
+bool cmd_engine_busy(void)
+{
+    return state != ENGINE_IDLE || queue_count > 0;
+}
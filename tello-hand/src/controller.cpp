@@ -0,0 +1,325 @@
+/*
+ * Controller logic, see `controller.h`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "controller.h"
+#include "control_curve.h"
+#include "hal.h"
+
+#define TEXT_LENGTH  96
+
+// Motions: https://i.ytimg.com/vi/FXabvMSQNxA/maxresdefault.jpg
+static int mpuRoll = 0;
+static int mpuPitch = 0;
+static int mpuYaw = 0;
+
+static rc_setpoint_t gestureCmd = {0, 0, 0, 0};
+static rc_setpoint_t lastGestureCmd = {0, 0, 0, 0};
+
+static volatile bool in_flight = false;
+static volatile bool in_transition = false;  // Takeoff or land waits for its answer
+static volatile bool in_rc_btn_motion = false;
+static volatile bool command_error = false;
+static bool gestures = true;
+static bool replaying = false;
+
+
+static int clamp_rc(int value)
+{
+    return value < -100 ? -100 : (value > 100 ? 100 : value);
+}
+
+
+// rc packets are only streamed while the drone is in the air
+static void set_in_flight(bool state)
+{
+    hal_led(HAL_LED_IN_FLIGHT, state);
+    in_flight = state;
+    in_rc_btn_motion = false;
+    hal_rc_enable(state);
+    if (!state) {
+        hal_recording(false);
+    }
+}
+
+
+static void set_rc(int rollValue, int pitchValue, int throttleValue, int yawValue)
+{
+    rc_setpoint_t sp;
+
+    sp.roll = clamp_rc(rollValue);
+    sp.pitch = clamp_rc(pitchValue);
+    sp.throttle = clamp_rc(throttleValue);
+    sp.yaw = clamp_rc(yawValue);
+    hal_rc_set(&sp);
+}
+
+
+// Button rc motion: first press starts it, second press returns to hover
+static void process_rc_button(const char *name, int rollValue, int pitchValue,
+                              int throttleValue, int yawValue)
+{
+    char text[TEXT_LENGTH];
+
+    if (!in_flight || !gestures || replaying)
+        return;
+    snprintf(text, sizeof(text), "%s button is pressed", name);
+    hal_log(text);
+    if (in_rc_btn_motion) {
+        set_rc(0, 0, 0, 0);
+        in_rc_btn_motion = false;
+    }
+    else {
+        set_rc(rollValue, pitchValue, throttleValue, yawValue);
+        in_rc_btn_motion = true;
+    }
+}
+
+
+static void process_land()
+{
+    in_transition = true;
+    controller_command("land", 20);
+    // IN_FLIGHT is cleared by controller_on_response()
+}
+
+
+static void process_takeoff()
+{
+    // The flight log starts with the takeoff command
+    hal_recording(true);
+    in_transition = true;
+    controller_command("takeoff", 40);
+    // IN_FLIGHT is set by controller_on_response()
+}
+
+
+static void on_takeoff_button()
+{
+    hal_log("Takeoff button is pressed");
+    if (in_transition || hal_replay_running()) {
+        hal_log("Takeoff/land or replay in progress, ignored");
+        return;
+    }
+    if (in_flight) {
+        process_land();
+    }
+    else {
+        process_takeoff();
+    }
+}
+
+
+static void on_kill_button()
+{
+    hal_log("KILL button is pressed");
+    if (hal_replay_running()) {
+        // Stops the schedule, "emergency" follows on the priority lane
+        hal_replay_abort();
+    }
+    else if (!hal_link_connected()) {
+        hal_log("Kill Button Pressed, no connection");
+        hal_log("Enabling OTA Update");
+        hal_log("Perform Update in browser tab or window");
+        hal_log("Clearing recent Tello SSID and restarting.");
+        hal_reset_wifi();
+        return;
+    }
+    // Also during a takeoff or land wait: the priority lane preempts it
+    if (in_flight || in_transition) {
+        controller_command("emergency", 10);
+        set_in_flight(false);
+        in_transition = false;
+    }
+}
+
+
+static void on_reset_wifi_button()
+{
+    hal_show(true, "Controller WiFi Reset\nUse ManageTello AP\n"
+                   "On Phone or Computer\nTo Connect to Tello");
+    hal_log("Kill Button Double Pressed");
+    hal_log("Erasing WiFi Config, restarting...");
+    hal_reset_wifi();
+}
+
+
+void controller_set_angles(int roll, int pitch, int yaw)
+{
+    mpuRoll = roll;
+    mpuPitch = pitch;
+    mpuYaw = yaw;
+}
+
+
+void controller_set_gestures(bool enabled)
+{
+    gestures = enabled;
+}
+
+
+void controller_on_replay(bool running)
+{
+    replaying = running;
+    set_in_flight(running);
+}
+
+
+void controller_button(button_t button)
+{
+    switch (button) {
+        case BUTTON_TAKEOFF:
+            on_takeoff_button();
+        break;
+
+        case BUTTON_KILL:
+            on_kill_button();
+        break;
+
+        case BUTTON_KILL_DOUBLE:
+            on_reset_wifi_button();
+        break;
+
+        case BUTTON_UP:
+            process_rc_button("UP", 0, 0, 30, 0);
+        break;
+
+        case BUTTON_DOWN:
+            process_rc_button("DOWN", 0, 0, -30, 0);
+        break;
+
+        case BUTTON_CW:
+            process_rc_button("CW", 0, 0, 0, 50);
+        break;
+
+        case BUTTON_CCW:
+            process_rc_button("CCW", 0, 0, 0, -50);
+        break;
+
+        default:
+        break;
+    }
+}
+
+
+void controller_update(void)
+{
+    char gestureText[RC_FORMAT_MAX_LENGTH];
+
+    // Deadband, expo and max rate come from the CONTROL_PROFILE tables
+    lastGestureCmd = gestureCmd;
+    gestureCmd.roll = curve_lookup(rollCurve, mpuRoll);
+    gestureCmd.pitch = curve_lookup(pitchCurve, mpuPitch);
+    gestureCmd.throttle = 0;
+    gestureCmd.yaw = 0;
+
+    if (command_error) {
+        hal_log("Command Error: Attempt to Land");
+        controller_command("land", 40);
+        if (in_flight) {
+            set_in_flight(false);
+        }
+        command_error = false;
+    }
+
+    // Tello nose direction is pilot perspective
+    // The rc streaming task sends the latest setpoint at a fixed rate
+    if (in_flight && gestures && !replaying) {
+        if (!rc_setpoint_equal(&gestureCmd, &lastGestureCmd) && !in_rc_btn_motion) {
+            hal_rc_set(&gestureCmd);
+            rc_format(gestureText, &gestureCmd);
+            hal_log(gestureText);
+        }
+    }
+}
+
+
+void controller_start_session(const char *ssid)
+{
+    char text[TEXT_LENGTH];
+
+    controller_command("command", 20);
+    controller_command("command", 10);
+
+    snprintf(text, sizeof(text), "Tello SSID:\n%s\n\nConnected!", ssid);
+    hal_show(true, text);
+}
+
+
+void controller_command(const char *command, int udp_delay_ticks)
+{
+    char text[TEXT_LENGTH];
+
+    // Out first, the serial log may block
+    bool queued = hal_command(command, udp_delay_ticks * UDP_TICK_MS);
+    hal_log(command);
+    snprintf(text, sizeof(text), "Command:\n%s", command);
+    hal_show(true, text);
+    if (!queued) {
+        hal_log("Command ring full, dropped");
+    }
+}
+
+
+void controller_on_response(const char *command, cmd_result_t result,
+                            const char *response, uint32_t rtt_ms)
+{
+    char text[TEXT_LENGTH];
+
+    if (result == CMD_RESULT_PREEMPTED) {
+        snprintf(text, sizeof(text), "%s preempted after %u ms", command, (unsigned) rtt_ms);
+        hal_log(text);
+    }
+    else if (result != CMD_RESULT_NO_RESPONSE) {
+        snprintf(text, sizeof(text), "%s (%u ms)", response, (unsigned) rtt_ms);
+        hal_log(text);
+        snprintf(text, sizeof(text), "Response: \n%s", response);
+        hal_show(false, text);
+
+        if (strcmp(command, "battery?") == 0 && result == CMD_RESULT_VALUE) {
+            controller_on_battery(atoi(response), false);
+        }
+        else if (result == CMD_RESULT_TIMEOUT) {
+            hal_log("Command timed out, ignoring for now");
+        }
+    }
+    else if (in_flight) {
+        hal_show(true, "No command response: \nLanding NOW!");
+        command_error = true;
+    }
+
+    // Flight state follows the end of the takeoff/land wait
+    if (strcmp(command, "takeoff") == 0) {
+        // A takeoff ended by "emergency" or "land" never reaches the air
+        if (result != CMD_RESULT_PREEMPTED)
+            set_in_flight(true);
+        in_transition = false;
+    }
+    else if (strcmp(command, "land") == 0) {
+        set_in_flight(false);
+        in_transition = false;
+    }
+}
+
+
+void controller_on_battery(int percent, bool first)
+{
+    char text[TEXT_LENGTH];
+
+    if (percent < TELLO_BATTERY_LOW) {
+        hal_led(HAL_LED_BATTERY_LOW, true);
+    }
+    if (first) {
+        snprintf(text, sizeof(text), "Tello battery: %d%%", percent);
+        hal_show(false, text);
+    }
+}
+
+
+bool controller_in_flight(void)
+{
+    return in_flight;
+}
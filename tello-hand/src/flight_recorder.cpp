@@ -0,0 +1,302 @@
+/*
+ * Binary flight recorder, see `flight_recorder.h`.
+ */
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <esp_timer.h>
+#include "flight_recorder.h"
+#include "hal.h"
+
+
+// Logged by the control and comms tasks, written out by the flush task.
+// `head` and `tail` count records; the ring holds whole blocks, so a block
+// starting at a multiple of FLIGHT_REC_BLOCK_RECORDS is contiguous. Each
+// flight starts at such a multiple.
+static flight_record_t ring[FLIGHT_REC_CAPACITY];
+static portMUX_TYPE ring_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t head = 0;
+static uint32_t tail = 0;
+static bool recording = false;
+static uint32_t flight_at = 0;      // First record of the current flight
+static uint32_t start_ms = 0;
+static flight_record_t last = {};   // Setpoint and angles carried into every record
+static flight_recorder_stats_t stats = {};
+
+// Start and stop, handled by the flush task in order: a stop writes the
+// records up to `at` and closes the file, a start skips to `at` and opens
+// it again. Only the flush task moves `tail`.
+typedef enum {
+    REQUEST_OPEN,
+    REQUEST_CLOSE
+} request_type_t;
+
+typedef struct {
+    uint8_t type;                // request_type_t
+    uint32_t at;                 // Record index
+} request_t;
+
+#define FLIGHT_REC_REQUESTS  4
+
+static TaskHandle_t flush_task = NULL;
+static QueueHandle_t requests = NULL;
+static File file;
+
+
+static flight_command_t command_id(const char *command)
+{
+    if (strncmp(command, "rc ", 3) == 0)
+        return FLIGHT_CMD_RC;
+    if (strcmp(command, "command") == 0)
+        return FLIGHT_CMD_COMMAND;
+    if (strcmp(command, "takeoff") == 0)
+        return FLIGHT_CMD_TAKEOFF;
+    if (strcmp(command, "land") == 0)
+        return FLIGHT_CMD_LAND;
+    if (strcmp(command, "emergency") == 0)
+        return FLIGHT_CMD_EMERGENCY;
+    if (strcmp(command, "battery?") == 0)
+        return FLIGHT_CMD_BATTERY;
+    return FLIGHT_CMD_OTHER;
+}
+
+
+// Copy one record into the ring, no flash access
+static void append(flight_record_t *record, bool update_last)
+{
+    bool block_full = false;
+
+    portENTER_CRITICAL(&ring_mux);
+    if (update_last) {
+        last.rc = record->rc;
+        last.roll = record->roll;
+        last.pitch = record->pitch;
+        last.yaw = record->yaw;
+    }
+    else {
+        record->rc = last.rc;
+        record->roll = last.roll;
+        record->pitch = last.pitch;
+        record->yaw = last.yaw;
+    }
+    if (recording) {
+        if (head - tail >= FLIGHT_REC_CAPACITY) {
+            stats.dropped++;
+        }
+        else {
+            record->time_ms = millis() - start_ms;
+            ring[head % FLIGHT_REC_CAPACITY] = *record;
+            head++;
+            stats.records++;
+            block_full = head % FLIGHT_REC_BLOCK_RECORDS == 0;
+        }
+    }
+    portEXIT_CRITICAL(&ring_mux);
+
+    if (block_full)
+        xTaskNotifyGive(flush_task);
+}
+
+
+// At most one block, starting at a block boundary
+static void write_records(uint32_t from, uint32_t count)
+{
+    int64_t start = esp_timer_get_time();
+
+    if (count == 0)
+        return;
+    if (file) {
+        file.write((const uint8_t *) &ring[from % FLIGHT_REC_CAPACITY],
+                   count * sizeof(flight_record_t));
+        file.flush();
+    }
+
+    uint32_t elapsed = esp_timer_get_time() - start;
+    portENTER_CRITICAL(&ring_mux);
+    tail += count;
+    stats.blocks++;
+    if (elapsed > stats.flush_max_us)
+        stats.flush_max_us = elapsed;
+    portEXIT_CRITICAL(&ring_mux);
+}
+
+
+static void open_file(uint32_t at)
+{
+    portENTER_CRITICAL(&ring_mux);
+    tail = at;
+    portEXIT_CRITICAL(&ring_mux);
+
+    file = LittleFS.open(FLIGHT_REC_PATH, FILE_WRITE);
+    if (file) {
+        flight_file_header_t header = {FLIGHT_REC_MAGIC, FLIGHT_REC_VERSION,
+                                       sizeof(flight_record_t)};
+        file.write((const uint8_t *) &header, sizeof(header));
+    }
+    else {
+        hal_log("Flight recorder: cannot open " FLIGHT_REC_PATH);
+    }
+}
+
+
+// The rest of the flight, then the file is closed
+static void close_file(uint32_t at)
+{
+    for (;;) {
+        portENTER_CRITICAL(&ring_mux);
+        uint32_t from = tail;
+        portEXIT_CRITICAL(&ring_mux);
+        if (from == at)
+            break;
+        uint32_t count = at - from;
+        write_records(from, count < FLIGHT_REC_BLOCK_RECORDS ? count : FLIGHT_REC_BLOCK_RECORDS);
+    }
+    if (file)
+        file.close();
+}
+
+
+static void flush_task_loop(void *parameter)
+{
+    request_t request;
+    bool open = false;
+    uint32_t opened_at = 0;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        while (xQueueReceive(requests, &request, 0) == pdTRUE) {
+            if (request.type == REQUEST_OPEN) {
+                open_file(request.at);
+                open = true;
+                opened_at = request.at;
+            }
+            else {
+                close_file(request.at);
+                open = false;
+            }
+        }
+
+        // Full blocks of the open flight; once a newer one has started,
+        // its queued requests come first, on the next notification
+        while (open) {
+            portENTER_CRITICAL(&ring_mux);
+            uint32_t from = tail;
+            uint32_t available = flight_at == opened_at ? head - tail : 0;
+            portEXIT_CRITICAL(&ring_mux);
+            if (available < FLIGHT_REC_BLOCK_RECORDS)
+                break;
+            write_records(from, FLIGHT_REC_BLOCK_RECORDS);
+        }
+    }
+}
+
+
+bool flight_recorder_begin(void)
+{
+    if (!LittleFS.begin(true)) {
+        hal_log("LittleFS mount failed, flight recorder off");
+        return false;
+    }
+    requests = xQueueCreate(FLIGHT_REC_REQUESTS, sizeof(request_t));
+    xTaskCreatePinnedToCore(flush_task_loop, "recorder", FLIGHT_REC_STACK, NULL,
+                            FLIGHT_REC_PRIORITY, &flush_task, FLIGHT_REC_CORE);
+    return true;
+}
+
+
+// Called by the control task only, so requests are queued in order
+void flight_recorder_start(void)
+{
+    request_t stop = {REQUEST_CLOSE, 0};
+    request_t start = {REQUEST_OPEN, 0};
+
+    if (flush_task == NULL)
+        return;
+    // The flush task is behind by more than a stop and a start
+    if (uxQueueSpacesAvailable(requests) < 2) {
+        hal_log("Flight recorder: still closing the last flight, not recording");
+        return;
+    }
+
+    portENTER_CRITICAL(&ring_mux);
+    bool was_recording = recording;
+    stop.at = head;
+    // The old flight's records stay until the flush task has written them
+    head = (head + FLIGHT_REC_BLOCK_RECORDS - 1) / FLIGHT_REC_BLOCK_RECORDS *
+           FLIGHT_REC_BLOCK_RECORDS;
+    start.at = head;
+    flight_at = head;
+    start_ms = millis();
+    stats.records = 0;
+    stats.dropped = 0;
+    recording = true;
+    portEXIT_CRITICAL(&ring_mux);
+
+    if (was_recording)
+        xQueueSend(requests, &stop, 0);
+    xQueueSend(requests, &start, 0);
+    xTaskNotifyGive(flush_task);
+}
+
+
+void flight_recorder_stop(void)
+{
+    request_t stop = {REQUEST_CLOSE, 0};
+
+    if (flush_task == NULL)
+        return;
+
+    portENTER_CRITICAL(&ring_mux);
+    bool was_recording = recording;
+    recording = false;
+    stop.at = head;
+    portEXIT_CRITICAL(&ring_mux);
+
+    if (was_recording) {
+        xQueueSend(requests, &stop, 0);
+        xTaskNotifyGive(flush_task);
+    }
+}
+
+
+void flight_recorder_log_setpoint(const rc_setpoint_t *rc, int16_t roll, int16_t pitch, int16_t yaw)
+{
+    flight_record_t record = {};
+    record.event = FLIGHT_EVENT_SETPOINT;
+    record.command = FLIGHT_CMD_RC;
+    record.rc = *rc;
+    record.roll = roll;
+    record.pitch = pitch;
+    record.yaw = yaw;
+    append(&record, true);
+}
+
+
+void flight_recorder_log_command(const char *command)
+{
+    flight_record_t record = {};
+    record.event = FLIGHT_EVENT_COMMAND;
+    record.command = command_id(command);
+    append(&record, false);
+}
+
+
+void flight_recorder_log_response(const char *command, uint8_t result, uint32_t rtt_ms)
+{
+    flight_record_t record = {};
+    record.event = FLIGHT_EVENT_RESPONSE;
+    record.command = command_id(command);
+    record.result = result;
+    record.rtt_ms = rtt_ms > UINT16_MAX ? UINT16_MAX : rtt_ms;
+    append(&record, false);
+}
+
+
+void flight_recorder_get_stats(flight_recorder_stats_t *out)
+{
+    portENTER_CRITICAL(&ring_mux);
+    *out = stats;
+    out->active = recording;
+    portEXIT_CRITICAL(&ring_mux);
+}
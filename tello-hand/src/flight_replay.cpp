@@ -0,0 +1,271 @@
+/*
+ * Timer-driven flight replay, see `flight_replay.h`.
+ */
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "flight_replay.h"
+#include "rc_stream.h"
+
+
+typedef struct __attribute__((packed)) {
+    uint32_t offset_us;   // From the start of the replay
+    uint8_t command;      // flight_command_t
+    rc_setpoint_t rc;     // Setpoint of FLIGHT_CMD_RC events
+} replay_event_t;
+
+// Commands sent as text, NULL ones are not replayed
+static const char *const command_text[FLIGHT_REPLAY_COMMANDS] = {
+    NULL,          // FLIGHT_CMD_RC, formatted from the setpoint
+    "command",
+    "takeoff",
+    "land",
+    "emergency",
+    NULL,          // FLIGHT_CMD_BATTERY, a query
+    NULL           // FLIGHT_CMD_OTHER, text not recorded
+};
+
+static replay_send_fn_t send_fn = NULL;
+static replay_event_t *schedule = NULL;
+static uint32_t event_count = 0;
+static uint32_t next_event = 0;
+
+static hw_timer_t *timer = NULL;
+static TaskHandle_t replay_task = NULL;
+static volatile bool running = false;
+static volatile bool abort_requested = false;
+
+static portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+static flight_replay_stats_t stats = {};
+static uint64_t jitter_sum[FLIGHT_REPLAY_COMMANDS];
+
+
+// Alarm at the offset of the next event: only wake the task
+static void IRAM_ATTR on_alarm(void)
+{
+    BaseType_t woken = pdFALSE;
+
+    vTaskNotifyGiveFromISR(replay_task, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+
+static void send_text(const char *text)
+{
+    send_fn((const uint8_t *) text, strlen(text) + 1);
+}
+
+
+static void send_event(const replay_event_t *event)
+{
+    if (event->command == FLIGHT_CMD_RC) {
+        char packet[RC_FORMAT_MAX_LENGTH];
+        size_t length = rc_format(packet, &event->rc);
+        send_fn((const uint8_t *) packet, length + 1);
+        // The streaming task refreshes the setpoint until the next event
+        rc_stream_set(event->rc.roll, event->rc.pitch, event->rc.throttle, event->rc.yaw);
+        rc_stream_enable(true);
+    }
+    else {
+        send_text(command_text[event->command]);
+        if (event->command == FLIGHT_CMD_LAND || event->command == FLIGHT_CMD_EMERGENCY)
+            rc_stream_enable(false);
+    }
+}
+
+
+static void record_jitter(uint32_t index, uint8_t command, uint32_t late_us)
+{
+    portENTER_CRITICAL(&stats_mux);
+    flight_replay_jitter_t *jitter = &stats.command[command];
+    jitter->count++;
+    jitter_sum[command] += late_us;
+    if (late_us >= jitter->jitter_max_us) {
+        jitter->jitter_max_us = late_us;
+        jitter->worst_event = index;
+    }
+    stats.sent++;
+    portEXIT_CRITICAL(&stats_mux);
+}
+
+
+static void finish(bool aborted)
+{
+    timerAlarmDisable(timer);
+    timerStop(timer);
+    rc_stream_enable(false);
+
+    portENTER_CRITICAL(&stats_mux);
+    stats.aborted = aborted;
+    portEXIT_CRITICAL(&stats_mux);
+    abort_requested = false;
+    running = false;
+}
+
+
+static void replay_task_loop(void *parameter)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (!running)
+            continue;
+        if (abort_requested) {
+            finish(true);
+            continue;
+        }
+
+        // Send every event that is due
+        uint64_t now = timerRead(timer);
+        while (next_event < event_count && schedule[next_event].offset_us <= now) {
+            const replay_event_t *event = &schedule[next_event];
+            record_jitter(next_event, event->command, now - event->offset_us);
+            send_event(event);
+            next_event++;
+            now = timerRead(timer);
+        }
+        if (next_event == event_count) {
+            finish(false);
+            continue;
+        }
+
+        // One-shot alarm at the absolute offset of the next event
+        uint32_t due = schedule[next_event].offset_us;
+        timerAlarmWrite(timer, due, false);
+        timerAlarmEnable(timer);
+        if (timerRead(timer) >= due) {
+            // Passed while arming, the alarm would not fire
+            xTaskNotifyGive(replay_task);
+        }
+    }
+}
+
+
+void flight_replay_begin(replay_send_fn_t send)
+{
+    send_fn = send;
+    timer = timerBegin(FLIGHT_REPLAY_TIMER, FLIGHT_REPLAY_DIVIDER, true);
+    timerStop(timer);
+    timerAttachInterrupt(timer, on_alarm, true);
+    xTaskCreatePinnedToCore(replay_task_loop, "replay", FLIGHT_REPLAY_STACK, NULL,
+                            FLIGHT_REPLAY_PRIORITY, &replay_task, FLIGHT_REPLAY_CORE);
+}
+
+
+static bool replayable(const flight_record_t *record)
+{
+    if (record->event == FLIGHT_EVENT_SETPOINT)
+        return true;
+    return record->event == FLIGHT_EVENT_COMMAND && record->command < FLIGHT_REPLAY_COMMANDS &&
+           command_text[record->command] != NULL;
+}
+
+
+uint32_t flight_replay_load(const char *path)
+{
+    flight_file_header_t header;
+    flight_record_t records[16];
+
+    if (running)
+        return 0;
+
+    File file = LittleFS.open(path, FILE_READ);
+    if (!file)
+        return 0;
+    if (file.read((uint8_t *) &header, sizeof(header)) != sizeof(header) ||
+        header.magic != FLIGHT_REC_MAGIC || header.record_size != sizeof(flight_record_t)) {
+        file.close();
+        return 0;
+    }
+
+    uint32_t remaining = (file.size() - sizeof(header)) / sizeof(flight_record_t);
+    if (remaining > FLIGHT_REPLAY_MAX_EVENTS)
+        remaining = FLIGHT_REPLAY_MAX_EVENTS;
+    free(schedule);
+    event_count = 0;
+    schedule = (replay_event_t *) malloc(remaining * sizeof(replay_event_t));
+    if (schedule == NULL) {
+        file.close();
+        return 0;
+    }
+
+    // Offsets count from the first replayed event
+    uint32_t first_ms = 0;
+    while (remaining > 0) {
+        uint32_t chunk = remaining < 16 ? remaining : 16;
+        if (file.read((uint8_t *) records, chunk * sizeof(flight_record_t)) !=
+            chunk * sizeof(flight_record_t))
+            break;
+        remaining -= chunk;
+
+        for (uint32_t i = 0; i < chunk; i++) {
+            if (!replayable(&records[i]))
+                continue;
+            if (event_count == 0)
+                first_ms = records[i].time_ms;
+            replay_event_t *event = &schedule[event_count++];
+            event->offset_us = (records[i].time_ms - first_ms) * 1000;
+            event->command = records[i].event == FLIGHT_EVENT_SETPOINT ? FLIGHT_CMD_RC
+                                                                       : records[i].command;
+            event->rc = records[i].rc;
+        }
+    }
+    file.close();
+
+    portENTER_CRITICAL(&stats_mux);
+    stats.events = event_count;
+    stats.duration_ms = event_count ? schedule[event_count - 1].offset_us / 1000 : 0;
+    portEXIT_CRITICAL(&stats_mux);
+    return event_count;
+}
+
+
+bool flight_replay_start(void)
+{
+    if (running || event_count == 0 || replay_task == NULL)
+        return false;
+
+    portENTER_CRITICAL(&stats_mux);
+    memset(stats.command, 0, sizeof(stats.command));
+    memset(jitter_sum, 0, sizeof(jitter_sum));
+    stats.sent = 0;
+    stats.aborted = false;
+    portEXIT_CRITICAL(&stats_mux);
+
+    next_event = 0;
+    abort_requested = false;
+    running = true;
+    timerWrite(timer, 0);
+    timerStart(timer);
+    // First events are due at offset 0
+    xTaskNotifyGive(replay_task);
+    return true;
+}
+
+
+void flight_replay_abort(void)
+{
+    if (!running)
+        return;
+    timerAlarmDisable(timer);
+    abort_requested = true;
+    xTaskNotifyGive(replay_task);
+}
+
+
+bool flight_replay_running(void)
+{
+    return running;
+}
+
+
+void flight_replay_get_stats(flight_replay_stats_t *out)
+{
+    portENTER_CRITICAL(&stats_mux);
+    *out = stats;
+    for (uint8_t i = 0; i < FLIGHT_REPLAY_COMMANDS; i++) {
+        if (out->command[i].count > 0)
+            out->command[i].jitter_avg_us = jitter_sum[i] / out->command[i].count;
+    }
+    portEXIT_CRITICAL(&stats_mux);
+    out->running = running;
+}
@@ -0,0 +1,119 @@
+/*
+ * Shared I2C bus scheduler, see `i2c_bus.h`.
+ */
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <esp_timer.h>
+#include "i2c_bus.h"
+
+
+typedef struct {
+    uint32_t transactions;
+    uint64_t wait_sum_us;
+    uint32_t wait_max_us;
+} client_window_t;
+
+static SemaphoreHandle_t bus_mutex = NULL;
+static volatile bool imu_waiting = false;
+// Written on core 1, read on core 0: a 64-bit value needs the lock
+static portMUX_TYPE next_mux = portMUX_INITIALIZER_UNLOCKED;
+static int64_t next_imu_read_us = 0;
+
+// Statistics, updated by the bus holder only
+static portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+static client_window_t window[I2C_CLIENT_COUNT];
+static uint64_t window_busy_us = 0;
+static int64_t window_start_us = 0;
+static int64_t acquired_us = 0;
+static int64_t requested_us[I2C_CLIENT_COUNT];
+
+
+// A display chunk may start only if it ends before the IMU needs the bus
+static bool display_may_start(void)
+{
+    if (imu_waiting)
+        return false;
+
+    portENTER_CRITICAL(&next_mux);
+    int64_t due = next_imu_read_us;
+    portEXIT_CRITICAL(&next_mux);
+    int64_t now = esp_timer_get_time();
+    return due == 0 || now + I2C_BUS_CHUNK_US <= due || now >= due + I2C_BUS_CHUNK_US;
+}
+
+
+void i2c_bus_begin(uint32_t clock_hz)
+{
+    Wire.setClock(clock_hz);
+    bus_mutex = xSemaphoreCreateMutex();
+    window_start_us = esp_timer_get_time();
+}
+
+
+void i2c_bus_acquire(i2c_client_t client)
+{
+    requested_us[client] = esp_timer_get_time();
+
+    if (client == I2C_CLIENT_IMU) {
+        imu_waiting = true;
+    }
+    else {
+        // Step aside until the IMU read is done or far enough away
+        while (!display_may_start())
+            vTaskDelay(1);
+    }
+
+    xSemaphoreTake(bus_mutex, portMAX_DELAY);
+    if (client == I2C_CLIENT_IMU)
+        imu_waiting = false;
+    acquired_us = esp_timer_get_time();
+
+    uint32_t wait_us = acquired_us - requested_us[client];
+    portENTER_CRITICAL(&stats_mux);
+    window[client].transactions++;
+    window[client].wait_sum_us += wait_us;
+    if (wait_us > window[client].wait_max_us)
+        window[client].wait_max_us = wait_us;
+    portEXIT_CRITICAL(&stats_mux);
+}
+
+
+void i2c_bus_release(i2c_client_t client)
+{
+    uint32_t busy_us = esp_timer_get_time() - acquired_us;
+
+    portENTER_CRITICAL(&stats_mux);
+    window_busy_us += busy_us;
+    portEXIT_CRITICAL(&stats_mux);
+
+    xSemaphoreGive(bus_mutex);
+}
+
+
+void i2c_bus_set_next_imu_read(int64_t due_us)
+{
+    portENTER_CRITICAL(&next_mux);
+    next_imu_read_us = due_us;
+    portEXIT_CRITICAL(&next_mux);
+}
+
+
+void i2c_bus_get_stats(i2c_bus_stats_t *stats)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&stats_mux);
+    int64_t elapsed = now - window_start_us;
+    stats->utilization = elapsed > 0 ? 100.0f * window_busy_us / elapsed : 0.0f;
+    for (int i = 0; i < I2C_CLIENT_COUNT; i++) {
+        client_window_t *w = &window[i];
+        stats->client[i].transactions = w->transactions;
+        stats->client[i].wait_avg_us = w->transactions ? w->wait_sum_us / w->transactions : 0;
+        stats->client[i].wait_max_us = w->wait_max_us;
+        *w = client_window_t();
+    }
+    window_busy_us = 0;
+    window_start_us = now;
+    portEXIT_CRITICAL(&stats_mux);
+}
@@ -0,0 +1,159 @@
+/*
+ * MPU6050 FIFO driver, see `imu_fifo.h`.
+ */
+
+#include <Arduino.h>
+#include <Wire.h>
+#include "imu_fifo.h"
+
+// MPU6050 registers
+#define REG_SMPLRT_DIV     0x19
+#define REG_CONFIG         0x1A
+#define REG_FIFO_EN        0x23
+#define REG_INT_PIN_CFG    0x37
+#define REG_INT_ENABLE     0x38
+#define REG_INT_STATUS     0x3A
+#define REG_USER_CTRL      0x6A
+#define REG_FIFO_COUNTH    0x72
+#define REG_FIFO_R_W       0x74
+
+#define FIFO_EN_ACCEL_GYRO 0x78   // XG, YG, ZG and ACCEL
+#define USER_CTRL_FIFO_EN  0x40
+#define USER_CTRL_FIFO_RST 0x04
+#define INT_DATA_RDY       0x01
+#define INT_FIFO_OFLOW     0x10
+
+
+static TaskHandle_t notify_task = NULL;
+static volatile uint8_t pending = 0;
+static int16_t offsets[6] = {0, 0, 0, 0, 0, 0};
+static imu_fifo_stats_t stats = {};
+
+
+static void write_register(uint8_t reg, uint8_t value)
+{
+    Wire.beginTransmission(IMU_FIFO_ADDRESS);
+    Wire.write(reg);
+    Wire.write(value);
+    Wire.endTransmission();
+}
+
+
+static uint8_t read_registers(uint8_t reg, uint8_t *data, uint8_t length)
+{
+    Wire.beginTransmission(IMU_FIFO_ADDRESS);
+    Wire.write(reg);
+    Wire.endTransmission(false);
+    uint8_t received = Wire.requestFrom((uint8_t) IMU_FIFO_ADDRESS, (size_t) length);
+    for (uint8_t i = 0; i < received; i++)
+        data[i] = Wire.read();
+    stats.transactions++;
+    return received;
+}
+
+
+static void reset_fifo(void)
+{
+    write_register(REG_USER_CTRL, USER_CTRL_FIFO_RST);
+    write_register(REG_USER_CTRL, USER_CTRL_FIFO_EN);
+}
+
+
+// Data ready: wake the IMU task once a whole batch is waiting
+static void IRAM_ATTR on_data_ready(void)
+{
+    BaseType_t woken = pdFALSE;
+
+    if (++pending >= IMU_FIFO_BATCH) {
+        pending = 0;
+        vTaskNotifyGiveFromISR(notify_task, &woken);
+    }
+    portYIELD_FROM_ISR(woken);
+}
+
+
+bool imu_fifo_begin(uint8_t int_pin, TaskHandle_t task)
+{
+    notify_task = task;
+
+    write_register(REG_CONFIG, IMU_FIFO_DLPF);
+    write_register(REG_SMPLRT_DIV, 1000 / IMU_FIFO_RATE_HZ - 1);
+    write_register(REG_FIFO_EN, FIFO_EN_ACCEL_GYRO);
+    // Active high, push-pull, 50 us pulse, cleared on any read
+    write_register(REG_INT_PIN_CFG, 0x10);
+    write_register(REG_INT_ENABLE, INT_DATA_RDY | INT_FIFO_OFLOW);
+    reset_fifo();
+
+    pinMode(int_pin, INPUT);
+    attachInterrupt(digitalPinToInterrupt(int_pin), on_data_ready, RISING);
+    return true;
+}
+
+
+void imu_fifo_set_offsets(const int16_t values[6])
+{
+    for (uint8_t axis = 0; axis < 6; axis++)
+        offsets[axis] = values[axis];
+}
+
+
+// Big-endian value of `axis` less its offset, saturated to int16
+static int16_t axis_value(const uint8_t *p, uint8_t axis)
+{
+    int32_t value = (int16_t) ((p[2 * axis] << 8) | p[2 * axis + 1]) - offsets[axis];
+    return value > INT16_MAX ? INT16_MAX : (value < INT16_MIN ? INT16_MIN : value);
+}
+
+
+uint16_t imu_fifo_read(imu_raw_sample_t *samples, uint16_t max)
+{
+    uint8_t data[IMU_FIFO_READ_SAMPLES * IMU_FIFO_SAMPLE_SIZE];
+    uint8_t status;
+
+    stats.wakeups++;
+    read_registers(REG_INT_STATUS, &status, 1);
+    if (status & INT_FIFO_OFLOW) {
+        // Samples are lost and the FIFO may be misaligned, start over
+        reset_fifo();
+        stats.overflows++;
+        return 0;
+    }
+
+    if (read_registers(REG_FIFO_COUNTH, data, 2) != 2)
+        return 0;
+    uint16_t available = ((data[0] << 8) | data[1]) / IMU_FIFO_SAMPLE_SIZE;
+    if (available > max)
+        available = max;
+
+    uint16_t count = 0;
+    while (count < available) {
+        uint16_t chunk = available - count;
+        if (chunk > IMU_FIFO_READ_SAMPLES)
+            chunk = IMU_FIFO_READ_SAMPLES;
+
+        uint8_t length = chunk * IMU_FIFO_SAMPLE_SIZE;
+        if (read_registers(REG_FIFO_R_W, data, length) != length)
+            break;
+
+        for (uint16_t i = 0; i < chunk; i++) {
+            const uint8_t *p = data + i * IMU_FIFO_SAMPLE_SIZE;
+            imu_raw_sample_t *out = &samples[count + i];
+            // Accel X, Y, Z then gyro X, Y, Z
+            out->ax = axis_value(p, 0);
+            out->ay = axis_value(p, 1);
+            out->az = axis_value(p, 2);
+            out->gx = axis_value(p, 3);
+            out->gy = axis_value(p, 4);
+            out->gz = axis_value(p, 5);
+        }
+        count += chunk;
+    }
+    stats.samples += count;
+    return count;
+}
+
+
+void imu_fifo_get_stats(imu_fifo_stats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,180 @@
+/*
+ * Latency tracing, see `latency_trace.h`.
+ */
+
+#include "latency_trace.h"
+
+#ifdef LATENCY_TRACE
+
+#include <esp_timer.h>
+
+typedef struct {
+    uint32_t count;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint32_t buckets[TRACE_BUCKETS];
+} histogram_t;
+
+static const char *const names[TRACE_HISTOGRAMS] = {
+    "imu_read", "fusion", "imu_to_control", "mapping", "setpoint_to_send",
+    "udp_send", "sample_to_send",
+    "ack_command", "ack_takeoff", "ack_land", "ack_emergency", "ack_other"
+};
+
+static histogram_t histograms[TRACE_HISTOGRAMS];
+static portMUX_TYPE trace_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t cycles_per_us = 240;
+
+// Setpoint waiting for its first rc packet, 0 if none
+static int64_t setpoint_us = 0;
+static int64_t setpoint_sample_us = 0;
+
+
+static uint32_t bucket_index(uint64_t ns)
+{
+    if (ns < (1 << TRACE_SUB_BUCKET_BITS))
+        return ns;
+
+    uint32_t exponent = 63 - __builtin_clzll(ns);
+    if (exponent > TRACE_MAX_EXPONENT)
+        return TRACE_BUCKETS - 1;
+    uint32_t sub = (ns >> (exponent - TRACE_SUB_BUCKET_BITS)) & ((1 << TRACE_SUB_BUCKET_BITS) - 1);
+    return ((exponent - TRACE_SUB_BUCKET_BITS + 1) << TRACE_SUB_BUCKET_BITS) + sub;
+}
+
+
+// Largest value counted in a bucket
+static uint64_t bucket_limit(uint32_t index)
+{
+    if (index < (1 << TRACE_SUB_BUCKET_BITS))
+        return index;
+
+    uint32_t exponent = (index >> TRACE_SUB_BUCKET_BITS) + TRACE_SUB_BUCKET_BITS - 1;
+    uint64_t sub = index & ((1 << TRACE_SUB_BUCKET_BITS) - 1);
+    uint64_t width = 1ULL << (exponent - TRACE_SUB_BUCKET_BITS);
+    return (((1ULL << TRACE_SUB_BUCKET_BITS) + sub) << (exponent - TRACE_SUB_BUCKET_BITS)) + width - 1;
+}
+
+
+static void record_ns(trace_histogram_t histogram, uint64_t ns)
+{
+    histogram_t *h = &histograms[histogram];
+
+    portENTER_CRITICAL(&trace_mux);
+    if (h->count == 0 || ns < h->min_ns)
+        h->min_ns = ns;
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+    h->count++;
+    h->buckets[bucket_index(ns)]++;
+    portEXIT_CRITICAL(&trace_mux);
+}
+
+
+void trace_begin(void)
+{
+    cycles_per_us = ESP.getCpuFreqMHz();
+    memset(histograms, 0, sizeof(histograms));
+}
+
+
+void trace_record_cycles(trace_histogram_t histogram, uint32_t start_cycles)
+{
+    uint32_t cycles = trace_cycles() - start_cycles;
+    record_ns(histogram, (uint64_t) cycles * 1000 / cycles_per_us);
+}
+
+
+void trace_record_us(trace_histogram_t histogram, uint32_t elapsed_us)
+{
+    record_ns(histogram, (uint64_t) elapsed_us * 1000);
+}
+
+
+void trace_setpoint(int64_t sample_us)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&trace_mux);
+    // A setpoint replaced before it was sent only counts once, from its sample
+    if (setpoint_us == 0)
+        setpoint_us = now;
+    setpoint_sample_us = sample_us;
+    portEXIT_CRITICAL(&trace_mux);
+}
+
+
+void trace_setpoint_sent(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&trace_mux);
+    int64_t published = setpoint_us;
+    int64_t sampled = setpoint_sample_us;
+    setpoint_us = 0;
+    portEXIT_CRITICAL(&trace_mux);
+
+    if (published != 0) {
+        trace_record_us(TRACE_SETPOINT_TO_SEND, now - published);
+        trace_record_us(TRACE_SAMPLE_TO_SEND, now - sampled);
+    }
+}
+
+
+void trace_ack(const char *command, uint32_t rtt_ms)
+{
+    trace_histogram_t histogram = TRACE_ACK_OTHER;
+
+    if (strcmp(command, "command") == 0)
+        histogram = TRACE_ACK_COMMAND;
+    else if (strcmp(command, "takeoff") == 0)
+        histogram = TRACE_ACK_TAKEOFF;
+    else if (strcmp(command, "land") == 0)
+        histogram = TRACE_ACK_LAND;
+    else if (strcmp(command, "emergency") == 0)
+        histogram = TRACE_ACK_EMERGENCY;
+    trace_record_us(histogram, rtt_ms * 1000);
+}
+
+
+static uint64_t percentile(const histogram_t *h, uint32_t per_mille)
+{
+    uint32_t rank = ((uint64_t) h->count * per_mille + 999) / 1000;
+    uint32_t seen = 0;
+
+    for (uint32_t i = 0; i < TRACE_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            return bucket_limit(i) < h->max_ns ? bucket_limit(i) : h->max_ns;
+    }
+    return h->max_ns;
+}
+
+
+// One line per histogram, times in us:
+//   trace <name> n=<count> min=.. p50=.. p90=.. p99=.. max=.. | <bucket>:<count> ...
+void trace_dump(Print &out)
+{
+    static histogram_t copy;
+
+    for (uint8_t i = 0; i < TRACE_HISTOGRAMS; i++) {
+        portENTER_CRITICAL(&trace_mux);
+        copy = histograms[i];
+        memset(&histograms[i], 0, sizeof(histogram_t));
+        portEXIT_CRITICAL(&trace_mux);
+        if (copy.count == 0)
+            continue;
+
+        out.printf("trace %s n=%u min=%.1f p50=%.1f p90=%.1f p99=%.1f max=%.1f |", names[i],
+                   copy.count, copy.min_ns / 1000.0, percentile(&copy, 500) / 1000.0,
+                   percentile(&copy, 900) / 1000.0, percentile(&copy, 990) / 1000.0,
+                   copy.max_ns / 1000.0);
+        for (uint32_t b = 0; b < TRACE_BUCKETS; b++) {
+            if (copy.buckets[b] != 0)
+                out.printf(" %u:%u", b, copy.buckets[b]);
+        }
+        out.println();
+    }
+}
+
+#endif
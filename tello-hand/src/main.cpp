@@ -10,9 +10,6 @@
  *                   Adafruit_ESP32_SH1106 (Version 1.0.2)
  *                   MPU6050_light (Version 1.1.0)
  *                   WiFiManager
- *                   EasyButton (Version 2.0.3)
- *                     (In .pio/libdeps/EasyButton/src/EasyButtonTouch.h
- *                      comment lines 10--31 to disable `Filter.h`)
  *
  * License: MIT
  * 
@@ -36,7 +33,28 @@
 #include <MPU6050_light.h>
 #include <Adafruit_GFX.h>
 #include <Adafruit_SH1106.h>
-#include <EasyButton.h>
+#include "button_input.h"
+#include "command_engine.h"
+#include "serial_console.h"
+#include "serial_bridge.h"
+#include "rc_stream.h"
+#include "spsc_ring.h"
+#include "task_load.h"
+#include "oled_renderer.h"
+#include "i2c_bus.h"
+#include "imu_fifo.h"
+#include "tello_state.h"
+#include "flight_recorder.h"
+#include "flight_replay.h"
+#include "latency_trace.h"
+#include "controller.h"
+#include "boot_timing.h"
+#include "wifi_link.h"
+#include "hal.h"
+#include <imu_fusion.h>
+#include <imu_calibration.h>
+#include <serial_frame.h>
+#include <Preferences.h>
 
 
 // Config pins
@@ -49,6 +67,7 @@
 // #define LED_BATT_GREEN       12
 // #define LED_BATT_YELLOW      12
 // #define COMMAND_TICK         13
+// MPU6050 INT: IMU_INT_PIN (build flag, GPIO 13)
 
 // Buttons:
 #define TAKEOFF_PIN          25
@@ -58,9 +77,6 @@
 #define CW_PIN               32
 #define CCW_PIN              39
 
-// How many commands before Tello battery
-#define BATTERY_CHECK_LIMIT  10
-
 // Controller battery pin
 #define VBATPIN              35
 
@@ -77,6 +93,25 @@ const float MAX_BATTERY_VOLTAGE = 4.2;
 const char * udpAddress = "192.168.10.1";
 const int udpPort = 8889;
 
+// Pipeline: IMU sampling -> control mapping -> UDP comms, display/serial UI
+#define IMU_PERIOD_MS        5
+// With the MPU6050 INT pin wired (IMU_INT_PIN), poll only if an interrupt is lost
+#define IMU_FIFO_TIMEOUT_MS  (4 * IMU_FIFO_BATCH * 1000 / IMU_FIFO_RATE_HZ)
+#define CONTROL_TIMEOUT_MS   20
+#define UI_PERIOD_MS         (1000 / OLED_FPS)
+// How often task load and rc streaming statistics are printed [ms]
+#define LOAD_REPORT_INTERVAL_MS 5000
+#define UI_TEXT_LENGTH       96
+
+// Serial monitor and console; the UART receive buffer holds more than
+// one UI period of console input
+#ifndef SERIAL_BAUD
+#define SERIAL_BAUD          921600
+#endif
+#define SERIAL_RX_BUFFER     1024
+// Answer wait of a ground station command, as for console commands [ms]
+#define BRIDGE_TIMEOUT_MS    (20 * UDP_TICK_MS)
+
 // Components:
 // OLED SH1106 display connected to I2C (SDA, SCL pins)
 #define OLED_RESET 4  // Reset pin
@@ -85,33 +120,47 @@ Adafruit_SH1106 display(OLED_RESET);
 // Motion sensor
 MPU6050 mpu(Wire);
 
-// Buttons
-EasyButton takeoffButton(TAKEOFF_PIN);
-EasyButton killButton(KILL_PIN);
-EasyButton upButton(UP_PIN);
-EasyButton downButton(DOWN_PIN);
-EasyButton cwButton(CW_PIN);
-EasyButton ccwButton(CCW_PIN);
-
-// Motions: https://i.ytimg.com/vi/FXabvMSQNxA/maxresdefault.jpg
-int roll = 0;
+// Quaternion fusion of the raw accel/gyro samples
+// MPU6050_light default ranges: +-2 g, +-500 deg/s
+#define GYRO_LSB_PER_DPS     65.5
+#define ACC_LSB_PER_G        16384.0
+#ifdef IMU_FUSION_FIXED
+mahony_fx_t fusion;
+#else
+mahony_t fusion;
+#endif
+#ifndef IMU_INT_PIN
+uint32_t imuSamples = 0;    // Polled samples, written by the IMU task only
+#endif
+
+// Sensor offsets, loaded from NVS on boot and updated by the IMU task
+// when a still period shows gyro drift, see lib/imu_calibration
+imu_cal_t imuCal;
+imu_drift_t imuDrift;
+
+// Buttons, ids are the controller's button_t
+const struct {
+    button_t button;
+    uint8_t pin;
+} buttonPins[] = {
+    {BUTTON_TAKEOFF, TAKEOFF_PIN},
+    {BUTTON_KILL, KILL_PIN},
+    {BUTTON_UP, UP_PIN},
+    {BUTTON_DOWN, DOWN_PIN},
+    {BUTTON_CW, CW_PIN},
+    {BUTTON_CCW, CCW_PIN}
+};
+
+// Newest IMU angles, recorded with each setpoint
 int mpuRoll = 0;
-int AbsRoll = 0;
-int pitch = 0;
 int mpuPitch = 0;
-int AbsPitch = 0;
 int mpuYaw = 0;
-int yaw = 0;
-int throttle = 0;
+#ifdef LATENCY_TRACE
+int64_t mpuSampleUs = 0;   // When the sample behind mpuRoll/mpuPitch was read
+#endif
 
 // Commands: https://dl-cdn.ryzerobotics.com/downloads/Tello/Tello%20SDK%202.0%20User%20Guide.pdf
 String tello_ssid = "";
-String rcCmdBegin = "rc ";
-String rcCmdEnd = " 0 0";
-String pitchString = "0";
-String rollString = "0";
-String gestureCmd = "rc 0 0 0 0";
-String lastGestureCmd = "rc 0 0 0 0";
 // String lastCommand;
 // unsigned long last_since_takeoff = 0;
 // unsigned long this_since_takeoff = 0;
@@ -123,17 +172,81 @@ WiFiManager wm;
 
 // The UDP library class
 WiFiUDP udp;
+// Tello state stream, read by the comms task only
+WiFiUDP stateUdp;
+// Shared by the comms and the rc streaming task
+SemaphoreHandle_t udpMutex;
 
 // Are we currently connected?
-boolean connected;
-boolean in_flight = false;
-boolean in_rc_btn_motion = false;
-// boolean inSerialMotion = false;
-boolean command_error = false;
-boolean battery_checked = false;
-
-int battery_check_tick = 0;
-uint8_t buffer[50];
+volatile boolean connected;
+volatile boolean link_up = false;        // Set by the link task, handled by control
+boolean replaying = false;               // Flight replay started by the control task
+
+// Access point of the last link for a join without a scan. RTC memory is
+// kept over restarts and deep sleep, not over power cycles.
+#define LINK_CACHE_MAGIC  0x4B4E494C
+typedef struct {
+    uint32_t magic;
+    link_ap_t ap;
+    uint16_t crc;
+} link_cache_t;
+RTC_NOINIT_ATTR link_cache_t linkCache;
+
+// Open network named by the console "connect", joined instead of the saved
+// one. Written by the control task, read by the link task.
+char consoleSsid[33] = "";
+portMUX_TYPE consoleSsidMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Latest drone state, written by the comms task
+tello_state_t droneState = {};
+uint32_t droneStateTime = 0;
+uint32_t droneStateCount = 0;
+portMUX_TYPE droneStateMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Messages between the pipeline tasks
+typedef struct {
+    uint32_t time_ms;
+    int16_t roll;
+    int16_t pitch;
+    int16_t yaw;
+#ifdef LATENCY_TRACE
+    uint32_t trace_cycles;   // Queued, cycle counter of core 1
+    int64_t trace_us;        // Read from the sensor, esp_timer
+#endif
+} imu_sample_t;
+
+typedef struct {
+    char text[CMD_MAX_LENGTH];
+    uint32_t timeout_ms;
+} command_msg_t;
+
+typedef struct {
+    boolean clear;
+    char text[UI_TEXT_LENGTH];
+} ui_msg_t;
+
+typedef struct {
+    char text[CONSOLE_LINE_LENGTH];
+} console_msg_t;
+
+SpscRing<imu_sample_t, 16> imuRing;        // IMU -> control
+SpscRing<command_msg_t, 16> commandRing;   // control -> comms
+SpscRing<command_msg_t, 4> priorityRing;   // control -> comms, emergency and land
+SpscRing<ui_msg_t, 16> controlUiRing;      // control -> UI
+SpscRing<ui_msg_t, 16> commsUiRing;        // comms -> UI
+SpscRing<ui_msg_t, 16> bootUiRing;         // boot stages -> UI, pushed under bootUiMux
+SpscRing<console_msg_t, 4> consoleRing;    // UI -> control, serial console lines
+SpscRing<command_msg_t, BRIDGE_PENDING> bridgeRing;   // UART -> comms, ground station commands
+SpscRing<imu_cal_t, 2> calRing;            // IMU -> UI, recalibrated offsets to store
+
+TaskHandle_t controlTask;
+TaskHandle_t commsTask;
+TaskHandle_t linkTask;
+portMUX_TYPE bootUiMux = portMUX_INITIALIZER_UNLOCKED;
+task_load_t imuLoad = {"imu"};
+task_load_t controlLoad = {"control"};
+task_load_t commsLoad = {"comms"};
+task_load_t uiLoad = {"ui"};
 
 
 void toggle_led(int ledToToggle)
@@ -143,149 +256,285 @@ void toggle_led(int ledToToggle)
 }
 
 
-void run_command(String command, int udp_delay_ticks)
+// Ask the UI task to show `text`, optionally on a cleared display
+void post_ui(SpscRing<ui_msg_t, 16> &ring, boolean clear, const char *text)
 {
-    int packetSize = 0;
-    boolean responseExpected = true;
+    ui_msg_t msg;
+    msg.clear = clear;
+    strncpy(msg.text, text, UI_TEXT_LENGTH - 1);
+    msg.text[UI_TEXT_LENGTH - 1] = '\0';
+    ring.push(msg);
+}
 
-    display.clearDisplay();
-    display.setCursor(0, 0);
-    // digitalWrite(COMMAND_TICK, LOW);
-    Serial.println(command);
-    display.println("Command:");
-    display.println(command);
-    display.display();
-
-    // Special delay cases
-    if (command.indexOf("takeoff") >= 0)
-        udp_delay_ticks = 40;
-    if (command.indexOf("land") >= 0)
-        udp_delay_ticks = 20;
-    if (command.indexOf("rc ") >= 0) {
-        udp_delay_ticks = 0;
-        responseExpected = false;
-        // digitalWrite(COMMAND_TICK, HIGH);
-    }
-
-    memset(buffer, 0, 50);
-    command.getBytes(buffer, command.length()+1);
-    // Only send data when connected
-    // Send a packet
+
+// Command engine transport over the Tello UDP socket
+bool udp_send(const uint8_t *data, size_t length)
+{
+    xSemaphoreTake(udpMutex, portMAX_DELAY);
+    TRACE_START(send_start);
     udp.beginPacket(udpAddress, udpPort);
-    udp.write(buffer, command.length()+1);
-    udp.endPacket();
-    // Serial.println("endPacket called");
-    // Allow for an rc command to not need any further processing after sending.
-    memset(buffer, 0, 50);
-
-    for (int x = 0; x < udp_delay_ticks; x++) {
-        delay(500);
-        // toggle_led(COMMAND_TICK);
-        // Serial.print(x);
-        packetSize = udp.parsePacket();
-        if (packetSize)
-            break;
-    }
+    udp.write(data, length);
+    bool ok = udp.endPacket() == 1;
+    TRACE_STAGE(TRACE_UDP_SEND, send_start);
+    xSemaphoreGive(udpMutex);
+    return ok;
+}
 
-    // Serial.println("packetSize: " + String(packetSize));
-    if (packetSize && responseExpected) {
-        if (udp.read(buffer, 50) > 0) {
-            // digitalWrite(COMMAND_TICK, HIGH);
-            String commandResponse = String((char *) buffer);
-            Serial.println(commandResponse);
-            display.println("Response: ");
-            display.println(commandResponse);
-            display.display();
-
-            bool parseResponse = (commandResponse.indexOf("error") == -1) && (commandResponse.indexOf("ok") == -1);
-            if (command.equalsIgnoreCase("battery?") && parseResponse) {
-                int battery = commandResponse.toInt();
-                if (battery < 30) {
-                    // digitalWrite(LED_BATT_GREEN, LOW);
-                    digitalWrite(LED_BATT_RED, HIGH);
-                    // digitalWrite(LED_BATT_YELLOW, LOW);
-                }
-                /* else if (battery > 20) {
-                    digitalWrite(LED_BATT_GREEN, LOW);
-                    digitalWrite(LED_BATT_RED, LOW);
-                    digitalWrite(LED_BATT_YELLOW, HIGH);
-                }
-                */
-                /* else {
-                    digitalWrite(LED_BATT_GREEN, LOW);
-                    digitalWrite(LED_BATT_RED, HIGH);
-                    // digitalWrite(LED_BATT_YELLOW, LOW);
-                }
-                */
-            }
-            else if (commandResponse.indexOf("timeout") >= 0) {
-                // digitalWrite(COMMAND_TICK, LOW);
-                Serial.println("Command timed out, ignoring for now");
-            }
-        }
-        else {
-            // digitalWrite(COMMAND_TICK, LOW);
-            command_error = true;
+
+int udp_receive(uint8_t *data, size_t size)
+{
+    int length = 0;
+
+    xSemaphoreTake(udpMutex, portMAX_DELAY);
+    if (udp.parsePacket())
+        length = udp.read(data, size);
+    xSemaphoreGive(udpMutex);
+    return length;
+}
+
+
+uint32_t clock_ms()
+{
+    return millis();
+}
+
+
+const cmd_transport_t telloTransport = {udp_send, udp_receive, clock_ms};
+
+
+// Drain the state stream (comms task). The drone sends about 10 datagrams/s
+// once in SDK mode; this replaces polling with "battery?" commands.
+void receive_tello_state()
+{
+    static char datagram[TELLO_STATE_MAX_LENGTH];
+    static tello_state_t state = {};
+
+    while (stateUdp.parsePacket() > 0) {
+        int length = stateUdp.read((uint8_t *) datagram, sizeof(datagram));
+        if (length <= 0 || !tello_state_parse(datagram, length, &state))
+            continue;
+
+        portENTER_CRITICAL(&droneStateMux);
+        boolean first = droneStateCount == 0;
+        droneState = state;
+        droneStateTime = millis();
+        droneStateCount++;
+        portEXIT_CRITICAL(&droneStateMux);
+
+        if (state.fields & TELLO_STATE_BAT) {
+            controller_on_battery(state.bat, first);
         }
+        bridge_on_state(&state);
     }
-    else if (in_flight && responseExpected) {
-        display.clearDisplay();
-        display.setCursor(0, 0);
-        display.println("No command response: ");
-        display.println("Landing NOW!");
-        display.display();
-        command_error = true;
+}
+
+
+// Called by the command engine (comms task) when an acknowledged command completes
+void on_command_response(const char *command, cmd_result_t result, const char *response, uint32_t rtt_ms)
+{
+    flight_recorder_log_response(command, result, rtt_ms);
+    if (result != CMD_RESULT_NO_RESPONSE && result != CMD_RESULT_PREEMPTED) {
+        TRACE_ACK(command, rtt_ms);
+        boot_stage_done(BOOT_DRONE);
+        link_post(LINK_EVENT_ACK);
+        if (linkTask != NULL)
+            xTaskNotifyGive(linkTask);
     }
-    // delay(100);   
+    controller_on_response(command, result, response, rtt_ms);
+    bridge_on_response(command, result, response, rtt_ms);
+}
+
+
+// Tello SDK mode after the link comes up, which also starts the state stream
+void start_tello_session()
+{
+    // A new session reports its first battery level again
+    portENTER_CRITICAL(&droneStateMux);
+    droneStateCount = 0;
+    portEXIT_CRITICAL(&droneStateMux);
+
+    tello_ssid = WiFi.SSID();
+    controller_start_session(tello_ssid.c_str());
 }
 
 
-// Wifi event handler
+// Wifi event handler, runs in the system event task: the link task does
+// the work, see wifi_link.h
 void WiFiEvent(WiFiEvent_t event)
 {
     switch (event) {
         case SYSTEM_EVENT_STA_GOT_IP:
-            // When connected set 
-            Serial.print("WiFi connected! IP address: ");
-            Serial.println(WiFi.localIP());
-            digitalWrite(LED_CONN_GREEN, HIGH);
-            // digitalWrite(LED_CONN_RED, LOW);
-
-            // Initializes the UDP state
-            // This initializes the transfer buffer
-            udp.begin(WiFi.localIP(), udpPort);
-            connected = true;
-            run_command("command", 20);
-            run_command("battery?", 20);
-            battery_check_tick = 0;
-            run_command("command", 10);
-
-            display.clearDisplay();
-            display.setCursor(0, 0);
-            display.println("Tello SSID:");
-            display.println(tello_ssid);
-            display.println("");
-            display.println("Connected!");
-            display.display();
-            delay(2000);
-            run_command("battery?", 10);
+            link_post(LINK_EVENT_UP);
         break;
 
         case SYSTEM_EVENT_STA_DISCONNECTED:
-            Serial.println("WiFi lost connection");
-            digitalWrite(LED_CONN_GREEN, LOW);
-            // digitalWrite(LED_CONN_RED, HIGH);
-            // digitalWrite(LED_BATT_YELLOW, HIGH);
-            digitalWrite(LED_BATT_RED, LOW);
-            // digitalWrite(LED_BATT_GREEN, LOW);
-            connected = false;
+            link_post(LINK_EVENT_DOWN);
         break;
     
         default:
-        break;
+            return;
+    }
+    if (linkTask != NULL)
+        xTaskNotifyGive(linkTask);
+}
+
+
+const link_ap_t *link_cache_load()
+{
+    uint16_t crc = frame_crc16(0xFFFF, (const uint8_t *) &linkCache.ap, sizeof(linkCache.ap));
+    if (linkCache.magic != LINK_CACHE_MAGIC || linkCache.crc != crc)
+        return NULL;
+    return &linkCache.ap;
+}
+
+
+// Copy of consoleSsid, empty for the saved network
+void console_ssid(char *ssid)
+{
+    portENTER_CRITICAL(&consoleSsidMux);
+    memcpy(ssid, consoleSsid, sizeof(consoleSsid));
+    portEXIT_CRITICAL(&consoleSsidMux);
+}
+
+
+void link_cache_store(const link_ap_t *ap)
+{
+    linkCache.ap = *ap;
+    linkCache.crc = frame_crc16(0xFFFF, (const uint8_t *) ap, sizeof(*ap));
+    linkCache.magic = LINK_CACHE_MAGIC;
+}
+
+
+// Link io, called by the link task. A fast join names the channel and the
+// BSSID, so the driver probes one channel instead of scanning all of them.
+bool wifi_join(const link_ap_t *ap)
+{
+    static bool portal_done = false;
+    char ssid[sizeof(consoleSsid)];
+
+    // A network from the console is never saved
+    console_ssid(ssid);
+    if (ssid[0] != '\0') {
+        WiFi.persistent(false);
+        if (ap != NULL)
+            WiFi.begin(ssid, NULL, ap->channel, ap->bssid, true);
+        else
+            WiFi.begin(ssid);
+        return true;
+    }
+
+    // Rejoins leave the saved config alone: no flash write on each one,
+    // and no BSSID stored for the portal
+    WiFi.persistent(ap == NULL && !portal_done);
+    if (ap != NULL) {
+        WiFi.begin(wm.getWiFiSSID(true).c_str(), wm.getWiFiPass(true).c_str(),
+                   ap->channel, ap->bssid, true);
+        return true;
+    }
+    if (portal_done) {
+        // Any access point with the saved SSID, on any channel
+        WiFi.begin(wm.getWiFiSSID(true).c_str(), wm.getWiFiPass(true).c_str());
+        return true;
+    }
+
+    // First scan since boot: join the saved network, or run the config
+    // portal for up to 45 s
+    portal_done = true;
+    // wm.resetSettings(); // uncomment to force new Tello Binding here
+    bool res;
+    res = wm.autoConnect("ManageTello","telloadmin"); // password protected ap
+    // res = wm.autoConnect(manageTello.c_str(),"telloadmin"); // password protected ap
+    WiFi.setAutoReconnect(false);
+    if (!res) {
+        Serial.println("Failed to connect or hit timeout");
+        boot_stage_fail(BOOT_WIFI, "config portal timeout");
+        hal_show(true, "Reset Controller\nUse ManageTello AP\n"
+                       "On Phone or Computer\nTo Connect to Tello");
+
+        // ESP.restart();
+        return false;
+    }
+    //if you get here you have connected to the WiFi    
+    Serial.println("connected with DroneBlocks controller to Tello WiFi :)");
+    return true;
+}
+
+
+// The control task starts the Tello session. A retry leaves the sockets
+// alone, the comms task may be reading the state stream.
+void wifi_session()
+{
+    link_up = true;
+    if (controlTask != NULL)
+        xTaskNotifyGive(controlTask);
+}
+
+
+void wifi_up(link_ap_t *ap, bool resumed)
+{
+    char ssid[sizeof(consoleSsid)];
+
+    memcpy(ap->bssid, WiFi.BSSID(), sizeof(ap->bssid));
+    ap->channel = WiFi.channel();
+    // After a restart the saved network is joined again
+    console_ssid(ssid);
+    if (ssid[0] == '\0')
+        link_cache_store(ap);
+
+    // When connected set 
+    Serial.print("WiFi connected! IP address: ");
+    Serial.println(WiFi.localIP());
+    digitalWrite(LED_CONN_GREEN, HIGH);
+    // digitalWrite(LED_CONN_RED, LOW);
+
+    // Initializes the UDP state
+    // This initializes the transfer buffer; the rc stream sends on it. The
+    // comms task only reads the state stream once `connected` is set.
+    xSemaphoreTake(udpMutex, portMAX_DELAY);
+    udp.begin(WiFi.localIP(), udpPort);
+    xSemaphoreGive(udpMutex);
+    stateUdp.begin(TELLO_STATE_PORT);
+    connected = true;
+    if (!resumed) {
+        boot_stage_done(BOOT_WIFI);
+        boot_stage_start(BOOT_DRONE);
     }
+    wifi_session();
+}
+
+
+void wifi_down()
+{
+    Serial.println("WiFi lost connection");
+    digitalWrite(LED_CONN_GREEN, LOW);
+    // digitalWrite(LED_CONN_RED, HIGH);
+    // digitalWrite(LED_BATT_YELLOW, HIGH);
+    digitalWrite(LED_BATT_RED, LOW);
+    // digitalWrite(LED_BATT_GREEN, LOW);
+    connected = false;
 }
 
+
+void wifi_report(const link_reconnect_t *r)
+{
+    if (bridge_active())
+        return;
+    Serial.printf("link: reconnected in %lu ms: ip after %lu ms (%s join %lu ms, %u attempts), "
+                  "first answer %lu ms later\n",
+                  (unsigned long) r->total_ms, (unsigned long) r->down_ms,
+                  r->fast ? "fast" : "scanning", (unsigned long) r->join_ms, r->attempts,
+                  (unsigned long) r->ack_ms);
+}
+
+
+void wifi_leave()
+{
+    WiFi.disconnect();
+}
+
+
+const link_io_t linkIo = {wifi_join, wifi_up, wifi_session, wifi_down, wifi_leave, wifi_report};
+
 /*
 void writeFile(fs::FS &fs, const char * path, const char * message)
 {
@@ -347,196 +596,948 @@ void appendLastCommand()
 }
 */
 
-void processCommand(String command)
+// Replay the last recorded flight from the hardware timer schedule
+void processFlightReplay()
 {
-    // appendLastCommand();
-    if (in_rc_btn_motion) {
-        run_command("rc 0 0 0 0", 0);
-        // lastCommand = "rc 0 0 0 0";
-        in_rc_btn_motion = false;
+    char text[UI_TEXT_LENGTH];
+
+    uint32_t events = flight_replay_load(FLIGHT_REC_PATH);
+    if (events == 0) {
+        Serial.println("No flight to replay");
+        return;
+    }
+    flight_replay_stats_t stats;
+    flight_replay_get_stats(&stats);
+    Serial.printf("Start of flight replay: %u events, %u ms\n", events, stats.duration_ms);
+    snprintf(text, sizeof(text), "Replay:\n%u events\nKILL to abort", events);
+    post_ui(controlUiRing, true, text);
+
+    if (flight_replay_start()) {
+        replaying = true;
+        controller_on_replay(true);
+    }
+}
+
+
+// Per command type send jitter, once the replay has ended
+void report_replay()
+{
+    static const char *const names[FLIGHT_REPLAY_COMMANDS] = {
+        "rc", "command", "takeoff", "land", "emergency", "battery?", "other"
+    };
+    flight_replay_stats_t stats;
+
+    flight_replay_get_stats(&stats);
+    Serial.printf("... end of flight replay%s: %u of %u events sent\n",
+                  stats.aborted ? " (aborted)" : "", stats.sent, stats.events);
+    for (uint8_t i = 0; i < FLIGHT_REPLAY_COMMANDS; i++) {
+        const flight_replay_jitter_t &jitter = stats.command[i];
+        if (jitter.count > 0) {
+            Serial.printf("  %-9s %4u sent, jitter avg %u us max %u us (event %u)\n", names[i],
+                          jitter.count, jitter.jitter_avg_us, jitter.jitter_max_us, jitter.worst_event);
+        }
+    }
+}
+
+// Controller HAL, see hal.h
+
+uint32_t hal_millis(void)
+{
+    return millis();
+}
+
+
+void hal_log(const char *text)
+{
+    // The ground station reads frames only, text would just cost bandwidth
+    if (!bridge_active())
+        Serial.println(text);
+}
+
+
+// The controller shows commands from the control task and answers from the comms task
+void hal_show(bool clear, const char *text)
+{
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+    if (task == commsTask) {
+        post_ui(commsUiRing, clear, text);
+    }
+    else if (task == controlTask) {
+        post_ui(controlUiRing, clear, text);
     }
     else {
-        run_command(command, 0);
-        // lastCommand = command;
-        in_rc_btn_motion = true;
+        // setup(), the IMU and the WiFi boot stage
+        portENTER_CRITICAL(&bootUiMux);
+        post_ui(bootUiRing, clear, text);
+        portEXIT_CRITICAL(&bootUiMux);
     }
-    battery_check_tick++;
 }
 
 
-void processSerialCommand(String command)
+void hal_led(hal_led_t led, bool on)
 {
-    // appendLastCommand();
-    // Serial.println(command);
-    run_command(command, 20);
-    // lastCommand = command;
-    battery_check_tick++;
+    switch (led) {
+        case HAL_LED_IN_FLIGHT:
+            digitalWrite(IN_FLIGHT, on ? HIGH : LOW);
+        break;
+
+        case HAL_LED_BATTERY_LOW:
+            // digitalWrite(LED_BATT_GREEN, !on);
+            digitalWrite(LED_BATT_RED, on ? HIGH : LOW);
+            // digitalWrite(LED_BATT_YELLOW, LOW);
+        break;
+    }
 }
 
-/*
-void processFlightReplay()
+
+// Pass a command to the comms task, called from the control task only.
+// Emergency and land take their own ring and wake the comms task at once.
+bool hal_command(const char *command, uint32_t timeout_ms)
 {
-    flightFile = SPIFFS.open(flightFilePath, FILE_READ);
-    if (flightFile) {
-        Serial.println("Start of Flight File...");
-        digitalWrite(IN_FLIGHT, HIGH);
-        in_flight = true;
-
-        while (flightFile.available()) {
-            String command = flightFile.readStringUntil('\n');
-            int commaPosition = command.indexOf(',');
-            if (commaPosition != -1) {
-                run_command(command.substring(0, commaPosition), 20);
-                commandDelay = command.substring(commaPosition + 1, command.length()).toInt();
-                // Serial.println(command);
-                // Serial.println(command.substring(0, commaPosition));
-                // Serial.println(commandDelay);
-                delay(commandDelay);
-                // delay(500);
-            }
-            else {
-                run_command(command, 40);
-                // delay(500);
-                // Serial.println(command);
-            }
-        }
-        digitalWrite(IN_FLIGHT, LOW);
-        in_flight = false;
-        Serial.println("... end of Flight File");
-        flightFile.close();
+    command_msg_t msg;
+
+    // digitalWrite(COMMAND_TICK, LOW);
+    strncpy(msg.text, command, CMD_MAX_LENGTH - 1);
+    msg.text[CMD_MAX_LENGTH - 1] = '\0';
+    msg.timeout_ms = timeout_ms;
+    if (cmd_is_priority(msg.text)) {
+        if (!priorityRing.push(msg))
+            return false;
+        if (commsTask != NULL)
+            xTaskNotifyGive(commsTask);
     }
+    else if (!commandRing.push(msg)) {
+        return false;
+    }
+    flight_recorder_log_command(command);
+    return true;
+}
+
+
+// New rc setpoint for the streaming task, recorded with the current IMU angles
+void hal_rc_set(const rc_setpoint_t *sp)
+{
+    rc_stream_set(sp->roll, sp->pitch, sp->throttle, sp->yaw);
+    TRACE_SETPOINT(mpuSampleUs);
+    flight_recorder_log_setpoint(sp, mpuRoll, mpuPitch, mpuYaw);
 }
-*/
 
-// Callbacks
-void onResetWiFiButtonPressed()
-{ 
-    display.clearDisplay();
-    display.setCursor(0, 0);
-    display.println("Controller WiFi Reset");
-    display.println("Use ManageTello AP");
-    display.println("On Phone or Computer");
-    display.println("To Connect to Tello");
-    display.display();
-
-    Serial.println("Kill Button Double Pressed");
-    Serial.println("Erasing WiFi Config, restarting...");
+
+void hal_rc_enable(bool on)
+{
+    rc_stream_enable(on);
+}
+
+
+bool hal_link_connected(void)
+{
+    return connected;
+}
+
+
+void hal_reset_wifi(void)
+{
+    // Let the UI task draw the last message before restarting
+    delay(2 * UI_PERIOD_MS);
     wm.resetSettings();
-    ESP.restart();      
+    linkCache.magic = 0;
+    ESP.restart();
 }
 
 
-void onCWButtonPressed()
+void hal_recording(bool on)
 {
-    if (in_flight) {
-        Serial.println("CW button is pressed");
-        processCommand("rc 0 0 0 50");
-    }
+    if (on)
+        flight_recorder_start();
+    else
+        flight_recorder_stop();
+}
+
+
+void hal_replay_abort(void)
+{
+    flight_replay_abort();
+}
+
+
+bool hal_replay_running(void)
+{
+    return replaying;
 }
 
 
-void onCCWButtonPressed()
+// Console commands, run in the control task, see serial_console.h
+// The link task joins it, see link_rejoin()
+void console_connect(const char *ssid)
 {
-    if (in_flight) {
-        Serial.println("CCW button is pressed");
-        processCommand("rc 0 0 0 -50");
+    if (controller_in_flight()) {
+        Serial.println("Not while in flight");
+        return;
+    }
+    if (strlen(ssid) >= sizeof(consoleSsid)) {
+        Serial.println("SSID too long");
+        return;
     }
+    portENTER_CRITICAL(&consoleSsidMux);
+    strcpy(consoleSsid, ssid);
+    portEXIT_CRITICAL(&consoleSsidMux);
+    Serial.printf("Connecting to %s\n", ssid);
+    link_rejoin();
+    if (linkTask != NULL)
+        xTaskNotifyGive(linkTask);
+}
+
+
+void console_start(const char *argument)
+{
+    if (!controller_in_flight())
+        controller_button(BUTTON_TAKEOFF);
+}
+
+
+void console_stop(const char *argument)
+{
+    if (controller_in_flight())
+        controller_button(BUTTON_TAKEOFF);
 }
 
 
-void onUpButtonPressed()
+void console_kill(const char *argument)
 {
-    if (in_flight) {
-        Serial.println("UP button is pressed");
-        processCommand("rc 0 0 30 0");
+    // Unlike the button, never resets the WiFi settings
+    if (!connected) {
+        Serial.println("Not connected");
+        return;
     }
+    controller_button(BUTTON_KILL);
 }
 
 
-void onDownButtonPressed()
+void console_replay(const char *argument)
 {
-    if (in_flight) {
-        Serial.println("DOWN button is pressed");
-        processCommand("rc 0 0 -30 0");
+    if (!connected || controller_in_flight() || replaying) {
+        Serial.println("Replay needs a connected drone on the ground");
+        return;
     }
+    processFlightReplay();
 }
 
 
-void onKillButtonPressed()
+// SDK command as typed, "raw battery?" or any line not in the table
+void console_raw(const char *command)
 {
-    Serial.println("KILL button is pressed");
     if (!connected) {
-        Serial.println("Kill Button Pressed, no connection");
-        Serial.println("Enabling OTA Update");
-        Serial.println("Perform Update in browser tab or window");
-        Serial.println("Clearing recent Tello SSID and restarting.");
-        wm.resetSettings();
-        ESP.restart();  
-    }
-    if (in_flight) {
-        run_command("emergency", 10);
-        battery_check_tick++;
-        digitalWrite(IN_FLIGHT, LOW);
-        in_flight = false;
-        // deleteFile(SPIFFS, flightFilePath);
+        Serial.println("Not connected");
+        return;
     }
-    else {
-        // processFlightReplay();
+    controller_command(command, 20);
+}
+
+
+// Ground station mode until it sends BRIDGE_EXIT, see serial_bridge.h
+void console_bridge(const char *argument)
+{
+    bridge_enter();
+    Serial.println("bridge: on");
+}
+
+
+constexpr console_command_t consoleCommands[] = {
+    {"connect", console_connect, true},
+    {"start", console_start, false},
+    {"stop", console_stop, false},
+    {"kill", console_kill, false},
+    {"replay", console_replay, false},
+    {"raw", console_raw, true},
+    {"bridge", console_bridge, false}
+};
+
+
+// Bridge io, called from the UART event task and the comms task. Each
+// frame is one Serial.write(), which holds the UART lock for the call.
+void bridge_write(const uint8_t *data, size_t length)
+{
+    Serial.write(data, length);
+}
+
+
+void bridge_set_rc(const rc_setpoint_t *sp)
+{
+    rc_stream_set(sp->roll, sp->pitch, sp->throttle, sp->yaw);
+    flight_recorder_log_setpoint(sp, mpuRoll, mpuPitch, mpuYaw);
+}
+
+
+// Straight to the comms task, the control task is not involved
+bool bridge_command(const char *text)
+{
+    command_msg_t msg;
+
+    if (!connected)
+        return false;
+    strncpy(msg.text, text, CMD_MAX_LENGTH - 1);
+    msg.text[CMD_MAX_LENGTH - 1] = '\0';
+    msg.timeout_ms = BRIDGE_TIMEOUT_MS;
+    if (!bridgeRing.push(msg))
+        return false;
+    if (commsTask != NULL)
+        xTaskNotifyGive(commsTask);
+    return true;
+}
+
+
+const bridge_io_t bridgeIo = {bridge_write, bridge_set_rc, bridge_command, clock_ms};
+
+
+// UART event task: frames are decoded as they arrive, console lines are
+// left to read_console()
+void on_serial_receive()
+{
+    uint8_t data[64];
+
+    if (!bridge_active())
+        return;
+    int available = Serial.available();
+    while (available > 0) {
+        size_t length = Serial.read(data, min(available, (int) sizeof(data)));
+        if (length == 0)
+            break;
+        bridge_receive(data, length);
+        available -= length;
     }
 }
 
 
-void processLand()
+// Button events, taken from the input queue by the control task
+void on_button_event(const button_event_t &event)
 {
-    // appendLastCommand();
-    run_command("land", 20);
-    // appendFile(SPIFFS, flightFilePath, "land,2\n");
-    // appendFile(SPIFFS, flightFilePath, "battery?,2\n");
-    digitalWrite(IN_FLIGHT, LOW);
-    in_flight = false;
+    if (event.type == BUTTON_EVENT_PRESS) {
+        controller_button((button_t) event.button);
+    }
+    else if (event.type == BUTTON_EVENT_SEQUENCE && event.button == BUTTON_KILL) {
+        controller_button(BUTTON_KILL_DOUBLE);
+    }
+}
+
+
+// Buttons, gesture mapping and the end of a replay, run by the control task
+void control_update()
+{
+    static bool bridged = false;
+    button_event_t event;
+
+    // Presses are queued by the button interrupts, in order
+    while (button_input_read(&event)) {
+        on_button_event(event);
+    }
+
+    // The ground station sends the setpoints while bridged
+    if (bridged != bridge_active()) {
+        bridged = !bridged;
+        controller_set_gestures(!bridged);
+        if (!bridged)
+            Serial.println("bridge: off");
+    }
+    bridge_poll();
+    controller_set_angles(mpuRoll, mpuPitch, mpuYaw);
+    controller_update();
+
+    if (replaying && !flight_replay_running()) {
+        replaying = false;
+        controller_on_replay(false);
+        report_replay();
+    }
+
+    // Console lines, assembled by the UI task
+    console_msg_t line;
+    while (consoleRing.pop(line)) {
+        console_result_t result = console_dispatch(consoleCommands,
+                                                   sizeof(consoleCommands) / sizeof(consoleCommands[0]),
+                                                   line.text, console_raw);
+        if (result == CONSOLE_NO_ARGUMENT) {
+            Serial.printf("%s: argument missing\n", line.text);
+        }
+    }
 }
 
 
-void processTakeoff()
+// NVS record of the offsets, see imu_calibration.h
+imu_cal_status_t load_calibration(float temp_c)
 {
-    // writeFile(SPIFFS, flightFilePath, "command,2\n");
-    // appendFile(SPIFFS, flightFilePath, "battery?,2\n");
-    run_command("takeoff", 40);
-    digitalWrite(IN_FLIGHT, HIGH);
-    // takeoff_time = millis();
-    // last_since_takeoff = 0;
-    in_flight = true;
-    // lastCommand = "takeoff";
-    // appendLastCommand(); // Will be takeoff
-    // lastCommand = "rc 0 0 0 0"; // This is basic hover
+    Preferences prefs;
+
+    prefs.begin(IMU_CAL_NAMESPACE, true);
+    size_t length = prefs.getBytes(IMU_CAL_KEY, &imuCal, sizeof(imuCal));
+    prefs.end();
+    return imu_cal_check(&imuCal, length, temp_c);
+}
+
+
+void store_calibration(imu_cal_t *cal)
+{
+    Preferences prefs;
+    char text[80];
+
+    imu_cal_seal(cal);
+    prefs.begin(IMU_CAL_NAMESPACE, false);
+    bool stored = prefs.putBytes(IMU_CAL_KEY, cal, sizeof(*cal)) == sizeof(*cal);
+    prefs.end();
+    snprintf(text, sizeof(text), "IMU offsets %s: gyro %.2f %.2f %.2f deg/s at %.1f C",
+             stored ? "stored" : "not stored", cal->gyro[0], cal->gyro[1], cal->gyro[2], cal->temp_c);
+    hal_log(text);
 }
 
 
-void onTakeoffButtonPressed()
+// Boot stage of the IMU task: the MPU6050 and its offsets, through the bus
+// scheduler since the UI task is already drawing. False if the sensor
+// does not answer.
+bool imu_boot()
 {
-    Serial.println("Takeoff button is pressed");
-    if (in_flight) {
-        processLand();
+    char text[UI_TEXT_LENGTH];
+
+    boot_stage_start(BOOT_IMU);
+    i2c_bus_acquire(I2C_CLIENT_IMU);
+    uint8_t status = mpu.begin();
+    if (status == 0)
+        mpu.update();
+    i2c_bus_release(I2C_CLIENT_IMU);
+    Serial.printf("MPU6050 status: %u\n", status);
+    if (status != 0) {
+        snprintf(text, sizeof(text), "MPU6050 status: %u", status);
+        hal_show(false, text);
+        boot_stage_fail(BOOT_IMU, "no MPU6050");
+        return false;
     }
-    else {
-        processTakeoff();
+
+    // Stored offsets need no still board; drift is corrected in the background
+    float temp_c = mpu.getTemp();
+    imu_cal_status_t cal_status = load_calibration(temp_c);
+    if (cal_status == IMU_CAL_OK || cal_status == IMU_CAL_TEMPERATURE) {
+        mpu.setAccOffsets(imuCal.acc[0], imuCal.acc[1], imuCal.acc[2]);
+        mpu.setGyroOffsets(imuCal.gyro[0], imuCal.gyro[1], imuCal.gyro[2]);
+        Serial.printf("IMU offsets loaded (%s): measured at %.1f C, now %.1f C, %u recalibrations\n",
+                      imu_cal_status_name(cal_status), imuCal.temp_c, temp_c, imuCal.updates);
+        boot_stage_done(BOOT_IMU, "offsets loaded");
+        return true;
+    }
+
+    // Get the idle controller position; the display is frozen while
+    // calcOffsets() holds the bus
+    Serial.printf("IMU offsets %s\n", imu_cal_status_name(cal_status));
+    Serial.println("Calculating offsets, do not move MPU6050...");
+    hal_show(true, "Calibrating IMU\nDo not move");
+    vTaskDelay(pdMS_TO_TICKS(1000));
+    i2c_bus_acquire(I2C_CLIENT_IMU);
+    mpu.calcOffsets();
+    i2c_bus_release(I2C_CLIENT_IMU);
+    imuCal.acc[0] = mpu.getAccXoffset();
+    imuCal.acc[1] = mpu.getAccYoffset();
+    imuCal.acc[2] = mpu.getAccZoffset();
+    imuCal.gyro[0] = mpu.getGyroXoffset();
+    imuCal.gyro[1] = mpu.getGyroYoffset();
+    imuCal.gyro[2] = mpu.getGyroZoffset();
+    for (uint8_t axis = 0; axis < 3; axis++)
+        imuCal.gyro_base[axis] = imuCal.gyro[axis];
+    imuCal.temp_c = temp_c;
+    imuCal.updates = 0;
+    store_calibration(&imuCal);
+    hal_show(true, "IMU calibrated");
+    boot_stage_done(BOOT_IMU, "offsets measured");
+    return true;
+}
+
+
+// Background recalibration (IMU task): the residual gyro bias of a still
+// period goes into the offsets, the UI task stores them. False if the
+// offsets are already at their limit.
+bool recalibrate_gyro(const float bias[3], float temp_c)
+{
+    if (!imu_cal_correct(&imuCal, bias))
+        return false;
+    imuCal.temp_c = temp_c;
+    calRing.push(imuCal);
+    return true;
+}
+
+
+#ifdef IMU_INT_PIN
+// Die temperature, read between two FIFO drains [deg C]
+float read_temperature()
+{
+    i2c_bus_acquire(I2C_CLIENT_IMU);
+    int16_t raw = (mpu.readData(0x41) << 8) | mpu.readData(0x42);   // TEMP_OUT_H/L
+    i2c_bus_release(I2C_CLIENT_IMU);
+    return raw / 340.0f + 36.53f;
+}
+
+
+// Pipeline stage 1 (core 1): drain the MPU6050 FIFO, woken by its data-ready interrupt
+void imu_task(void *parameter)
+{
+    static imu_raw_sample_t samples[IMU_FIFO_MAX_SAMPLES];
+    euler_t angles;
+    float bias[3];
+
+    // Without a sensor the angles stay 0: hover, the buttons still work
+    if (!imu_boot())
+        vTaskSuspend(NULL);
+
+#ifdef IMU_FUSION_FIXED
+    mahony_fx_init(&fusion, MAHONY_KP, MAHONY_KI, GYRO_LSB_PER_DPS);
+#else
+    mahony_init(&fusion, MAHONY_KP, MAHONY_KI);
+#endif
+    imu_drift_init(&imuDrift, IMU_FIFO_RATE_HZ);
+
+    // The MPU6050_light calibration, now applied to the raw counts
+    int16_t offsets[6];
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        offsets[axis] = lroundf(imuCal.acc[axis] * ACC_LSB_PER_G);
+        offsets[3 + axis] = lroundf(imuCal.gyro[axis] * GYRO_LSB_PER_DPS);
+    }
+    imu_fifo_set_offsets(offsets);
+    i2c_bus_acquire(I2C_CLIENT_IMU);
+    imu_fifo_begin(IMU_INT_PIN, xTaskGetCurrentTaskHandle());
+    i2c_bus_release(I2C_CLIENT_IMU);
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(IMU_FIFO_TIMEOUT_MS));
+        task_load_begin(&imuLoad);
+        int64_t read_us = esp_timer_get_time();
+
+        TRACE_START(read_start);
+        i2c_bus_acquire(I2C_CLIENT_IMU);
+        uint16_t count = imu_fifo_read(samples, IMU_FIFO_MAX_SAMPLES);
+        i2c_bus_release(I2C_CLIENT_IMU);
+        TRACE_STAGE(TRACE_IMU_READ, read_start);
+        i2c_bus_set_next_imu_read(read_us + IMU_FIFO_BATCH * IMU_FIFO_SAMPLE_US);
+
+        // Each sample exactly once, spaced by the sensor's sample clock
+        TRACE_START(fusion_start);
+        for (uint16_t i = 0; i < count; i++) {
+            const imu_raw_sample_t &s = samples[i];
+            const float acc[3] = {s.ax / ACC_LSB_PER_G, s.ay / ACC_LSB_PER_G, s.az / ACC_LSB_PER_G};
+            const float gyro[3] = {s.gx / GYRO_LSB_PER_DPS, s.gy / GYRO_LSB_PER_DPS, s.gz / GYRO_LSB_PER_DPS};
+            if (!controller_in_flight() && imu_drift_update(&imuDrift, acc, gyro, bias)
+                && recalibrate_gyro(bias, read_temperature())) {
+                for (uint8_t axis = 0; axis < 3; axis++)
+                    offsets[3 + axis] = lroundf(imuCal.gyro[axis] * GYRO_LSB_PER_DPS);
+                imu_fifo_set_offsets(offsets);
+            }
+#ifdef IMU_FUSION_FIXED
+            mahony_fx_update(&fusion, s.ax, s.ay, s.az, s.gx, s.gy, s.gz, IMU_FIFO_SAMPLE_US);
+#else
+            mahony_update(&fusion, s.ax, s.ay, s.az,
+                          s.gx / GYRO_LSB_PER_DPS, s.gy / GYRO_LSB_PER_DPS, s.gz / GYRO_LSB_PER_DPS,
+                          IMU_FIFO_SAMPLE_US * 1e-6f);
+#endif
+        }
+
+        if (count > 0) {
+#ifdef IMU_FUSION_FIXED
+            mahony_fx_euler(&fusion, &angles);
+#else
+            mahony_euler(&fusion, &angles);
+#endif
+            TRACE_STAGE(TRACE_FUSION, fusion_start);
+            imu_sample_t sample;
+            sample.time_ms = millis();
+            sample.roll = lroundf(angles.roll);
+            sample.pitch = lroundf(angles.pitch);
+            sample.yaw = lroundf(angles.yaw);
+#ifdef LATENCY_TRACE
+            sample.trace_us = read_us;
+            sample.trace_cycles = trace_cycles();
+#endif
+            imuRing.push(sample);
+        }
+
+        task_load_end(&imuLoad);
+        if (count > 0) {
+            xTaskNotifyGive(controlTask);
+        }
+    }
+}
+#else
+// Pipeline stage 1 (core 1): sample the MPU6050 at a fixed rate
+void imu_task(void *parameter)
+{
+    euler_t angles;
+    float bias[3];
+
+    // Without a sensor the angles stay 0: hover, the buttons still work
+    if (!imu_boot())
+        vTaskSuspend(NULL);
+    TickType_t wake = xTaskGetTickCount();
+    uint32_t last_us = micros();
+
+#ifdef IMU_FUSION_FIXED
+    mahony_fx_init(&fusion, MAHONY_KP, MAHONY_KI, GYRO_LSB_PER_DPS);
+#else
+    mahony_init(&fusion, MAHONY_KP, MAHONY_KI);
+#endif
+    imu_drift_init(&imuDrift, 1000 / IMU_PERIOD_MS);
+
+    for (;;) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(IMU_PERIOD_MS));
+        task_load_begin(&imuLoad);
+
+        // Burst read of the MPU6050, ahead of any display chunk
+        int64_t read_us = esp_timer_get_time();
+        TRACE_START(read_start);
+        i2c_bus_acquire(I2C_CLIENT_IMU);
+        mpu.update();
+        i2c_bus_release(I2C_CLIENT_IMU);
+        imuSamples++;
+        TRACE_STAGE(TRACE_IMU_READ, read_start);
+        i2c_bus_set_next_imu_read(read_us + IMU_PERIOD_MS * 1000);
+
+        const float acc[3] = {mpu.getAccX(), mpu.getAccY(), mpu.getAccZ()};
+        const float gyro[3] = {mpu.getGyroX(), mpu.getGyroY(), mpu.getGyroZ()};
+        if (!controller_in_flight() && imu_drift_update(&imuDrift, acc, gyro, bias)
+            && recalibrate_gyro(bias, mpu.getTemp())) {
+            mpu.setGyroOffsets(imuCal.gyro[0], imuCal.gyro[1], imuCal.gyro[2]);
+        }
+
+        TRACE_START(fusion_start);
+        uint32_t now_us = micros();
+#ifdef IMU_FUSION_FIXED
+        mahony_fx_update(&fusion,
+                         mpu.getAccX() * ACC_LSB_PER_G, mpu.getAccY() * ACC_LSB_PER_G,
+                         mpu.getAccZ() * ACC_LSB_PER_G, mpu.getGyroX() * GYRO_LSB_PER_DPS,
+                         mpu.getGyroY() * GYRO_LSB_PER_DPS, mpu.getGyroZ() * GYRO_LSB_PER_DPS,
+                         now_us - last_us);
+        mahony_fx_euler(&fusion, &angles);
+#else
+        mahony_update(&fusion, mpu.getAccX(), mpu.getAccY(), mpu.getAccZ(),
+                      mpu.getGyroX(), mpu.getGyroY(), mpu.getGyroZ(), (now_us - last_us) * 1e-6f);
+        mahony_euler(&fusion, &angles);
+#endif
+        last_us = now_us;
+        TRACE_STAGE(TRACE_FUSION, fusion_start);
+
+        imu_sample_t sample;
+        sample.time_ms = millis();
+        sample.roll = lroundf(angles.roll);
+        sample.pitch = lroundf(angles.pitch);
+        sample.yaw = lroundf(angles.yaw);
+#ifdef LATENCY_TRACE
+        sample.trace_us = read_us;
+        sample.trace_cycles = trace_cycles();
+#endif
+        imuRing.push(sample);
+
+        task_load_end(&imuLoad);
+        xTaskNotifyGive(controlTask);
+    }
+}
+#endif
+
+
+// Pipeline stage 2 (core 1): buttons and gesture mapping, woken by each IMU
+// sample and by each button event
+void control_task(void *parameter)
+{
+    imu_sample_t sample;
+
+    button_input_begin(xTaskGetCurrentTaskHandle());
+    boot_stage_done(BOOT_BUTTONS);
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONTROL_TIMEOUT_MS));
+        task_load_begin(&controlLoad);
+
+        // Only the newest sample matters for the setpoint
+        while (imuRing.pop(sample)) {
+            mpuRoll = sample.roll;
+            mpuPitch = sample.pitch;
+            mpuYaw = sample.yaw;
+            TRACE_STAGE(TRACE_IMU_TO_CONTROL, sample.trace_cycles);
+#ifdef LATENCY_TRACE
+            mpuSampleUs = sample.trace_us;
+#endif
+        }
+
+        if (link_up) {
+            link_up = false;
+            start_tello_session();
+        }
+        TRACE_START(mapping_start);
+        control_update();
+        TRACE_STAGE(TRACE_MAPPING, mapping_start);
+
+        task_load_end(&controlLoad);
+    }
+}
+
+
+// Pipeline stage 3 (core 0): owns the command engine and the UDP responses
+void comms_task(void *parameter)
+{
+    command_msg_t msg;
+
+    for (;;) {
+        task_load_begin(&commsLoad);
+        // The engine sends these ahead of its queue, preempting any wait
+        while (priorityRing.pop(msg)) {
+            cmd_engine_submit(msg.text, msg.timeout_ms);
+        }
+        while (commandRing.pop(msg)) {
+            if (!cmd_engine_submit(msg.text, msg.timeout_ms)) {
+                hal_log("Command queue full, dropped");
+            }
+        }
+        while (bridgeRing.pop(msg)) {
+            flight_recorder_log_command(msg.text);
+            if (!cmd_engine_submit(msg.text, msg.timeout_ms)) {
+                bridge_on_dropped(msg.text);
+            }
+        }
+        // Send queued commands and handle responses without blocking
+        if (connected) {
+            receive_tello_state();
+            cmd_engine_poll();
+        }
+        task_load_end(&commsLoad);
+        // One tick, or less when a priority command is posted
+        ulTaskNotifyTake(pdTRUE, 1);
+    }
+}
+
+
+// Draw a status update into the renderer's back buffer
+void show_ui_message(const ui_msg_t &msg)
+{
+    GFXcanvas1 &screen = oled_canvas();
+
+    if (msg.clear) {
+        screen.fillScreen(BLACK);
+        screen.setCursor(0, 0);
+    }
+    screen.println(msg.text);
+}
+
+
+void report_load(uint32_t elapsed_ms)
+{
+    Serial.printf("load: imu %.1f%% control %.1f%% comms %.1f%% ui %.1f%%, ring drops %u/%u/%u\n",
+                  task_load_percent(&imuLoad), task_load_percent(&controlLoad),
+                  task_load_percent(&commsLoad), task_load_percent(&uiLoad),
+                  imuRing.drops(), commandRing.drops(),
+                  controlUiRing.drops() + commsUiRing.drops());
+
+    oled_stats_t oled;
+    oled_get_stats(&oled);
+    Serial.printf("oled: %u frames, %u pages written, %u skipped, flush %u us (max %u us)\n",
+                  oled.frames, oled.pages_written, oled.pages_skipped,
+                  oled.last_flush_us, oled.max_flush_us);
+
+    i2c_bus_stats_t bus;
+    i2c_bus_get_stats(&bus);
+    Serial.printf("i2c: %.1f%% busy, imu %u reads wait avg %u us max %u us, "
+                  "display %u chunks wait avg %u us max %u us\n",
+                  bus.utilization,
+                  bus.client[I2C_CLIENT_IMU].transactions, bus.client[I2C_CLIENT_IMU].wait_avg_us,
+                  bus.client[I2C_CLIENT_IMU].wait_max_us,
+                  bus.client[I2C_CLIENT_DISPLAY].transactions, bus.client[I2C_CLIENT_DISPLAY].wait_avg_us,
+                  bus.client[I2C_CLIENT_DISPLAY].wait_max_us);
+
+#ifdef IMU_INT_PIN
+    static imu_fifo_stats_t last;
+    imu_fifo_stats_t fifo;
+    imu_fifo_get_stats(&fifo);
+    Serial.printf("imu: %lu samples/s, %lu i2c transactions/s, %lu wakeups/s, %u overflows\n",
+                  (fifo.samples - last.samples) * 1000UL / elapsed_ms,
+                  (fifo.transactions - last.transactions) * 1000UL / elapsed_ms,
+                  (fifo.wakeups - last.wakeups) * 1000UL / elapsed_ms, fifo.overflows);
+    last = fifo;
+#else
+    // Transactions also count the temperature reads of the drift check
+    static uint32_t last_samples = 0;
+    uint32_t samples = imuSamples;
+    Serial.printf("imu: %lu samples/s, %lu i2c transactions/s\n",
+                  (samples - last_samples) * 1000UL / elapsed_ms,
+                  bus.client[I2C_CLIENT_IMU].transactions * 1000UL / elapsed_ms);
+    last_samples = samples;
+#endif
+    Serial.printf("imu cal: gyro offsets %.2f %.2f %.2f deg/s, %u still periods, %u recalibrations\n",
+                  imuCal.gyro[0], imuCal.gyro[1], imuCal.gyro[2], imuDrift.still, imuCal.updates);
+
+    link_stats_t link;
+    link_get_stats(&link);
+    Serial.printf("link: %s, %lu reconnects (%lu fast), last %lu ms, max %lu ms\n",
+                  link_state_name(link_state()), (unsigned long) link.reconnects,
+                  (unsigned long) link.fast, (unsigned long) link.last_ms,
+                  (unsigned long) link.max_ms);
+
+    portENTER_CRITICAL(&droneStateMux);
+    tello_state_t state = droneState;
+    uint32_t state_time = droneStateTime;
+    uint32_t state_count = droneStateCount;
+    portEXIT_CRITICAL(&droneStateMux);
+    if (state_count > 0) {
+        Serial.printf("tello: bat %d%% h %d cm tof %d cm, %u states, last %lu ms ago\n",
+                      state.bat, state.h, state.tof, state_count, millis() - state_time);
+    }
+
+    flight_recorder_stats_t recorder;
+    flight_recorder_get_stats(&recorder);
+    if (recorder.records > 0) {
+        Serial.printf("recorder: %u records, %u dropped, %u flash writes (max %u us)%s\n",
+                      recorder.records, recorder.dropped, recorder.blocks, recorder.flush_max_us,
+                      recorder.active ? ", recording" : "");
+    }
+
+    button_input_stats_t buttons;
+    button_input_get_stats(&buttons);
+    if (buttons.events > 0) {
+        Serial.printf("buttons: %u events, %u bounces ignored, %u lost, edge to control max %u us\n",
+                      buttons.events, buttons.bounces, buttons.overflows, buttons.latency_max_us);
+    }
+
+    cmd_engine_stats_t commands;
+    cmd_engine_get_stats(&commands);
+    if (commands.submitted > 0) {
+        Serial.printf("cmd: depth %u (max %u)%s, %u answered, %u expired, %u stale answers, %u dropped, "
+                      "%u priority (%u preempted, %u flushed)\n",
+                      commands.depth, commands.depth_max, commands.waiting ? ", waiting" : "",
+                      commands.completed, commands.expired, commands.stale, commands.dropped,
+                      commands.priority, commands.preempted, commands.flushed);
+    }
+
+    if (controller_in_flight()) {
+        rc_stream_stats_t stats;
+        rc_stream_get_stats(&stats);
+        Serial.printf("rc: %u sent, %.1f Hz, jitter avg %u us max %u us, %u keep-alive, %u errors, "
+                      "%u setpoints (%u coalesced)\n",
+                      stats.sent, stats.rate_hz, stats.jitter_avg_us, stats.jitter_max_us,
+                      stats.keepalives, stats.send_errors, stats.updates, stats.coalesced);
+    }
+}
+
+
+// Serial console input: takes only the bytes already received, never waits
+void read_console()
+{
+    static console_line_t line;
+    console_msg_t msg;
+
+    // Bridge frames are taken by on_serial_receive()
+    if (bridge_active())
+        return;
+    int available = Serial.available();
+    while (available-- > 0) {
+        if (console_feed(&line, Serial.read())) {
+            strcpy(msg.text, line.text);
+            if (!consoleRing.push(msg)) {
+                Serial.println("Console busy, line dropped");
+            }
+        }
+    }
+}
+
+
+// Pipeline stage 4 (core 0, lowest priority): display, serial reports and console.
+// Renders at most OLED_FPS frames/s and only sends the pages that changed.
+void ui_task(void *parameter)
+{
+    ui_msg_t msg;
+    imu_cal_t cal;
+    bool cal_pending = false;
+    bool boot_reported = false;
+    unsigned long report_time = millis();
+#ifdef LATENCY_TRACE
+    unsigned long trace_time = millis();
+#endif
+    TickType_t wake = xTaskGetTickCount();
+
+    for (;;) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(UI_PERIOD_MS));
+        task_load_begin(&uiLoad);
+        while (bootUiRing.pop(msg)) {
+            show_ui_message(msg);
+        }
+        // Command first, then its response
+        while (controlUiRing.pop(msg)) {
+            show_ui_message(msg);
+        }
+        while (commsUiRing.pop(msg)) {
+            show_ui_message(msg);
+        }
+        oled_flush();
+        read_console();
+
+        // Recalibrated offsets, the newest one is written once on the ground
+        while (calRing.pop(cal)) {
+            cal_pending = true;
+        }
+        if (cal_pending && !controller_in_flight()) {
+            store_calibration(&cal);
+            cal_pending = false;
+        }
+
+        if (!boot_reported && boot_settled()) {
+            boot_report(Serial);
+            boot_reported = true;
+        }
+        if (millis() - report_time >= LOAD_REPORT_INTERVAL_MS) {
+            if (bridge_active())
+                bridge_send_stats();
+            else
+                report_load(millis() - report_time);
+            report_time = millis();
+        }
+#ifdef LATENCY_TRACE
+        if (millis() - trace_time >= TRACE_DUMP_INTERVAL_MS && !bridge_active()) {
+            TRACE_DUMP(Serial);
+            trace_time = millis();
+        }
+#endif
+        task_load_end(&uiLoad);
+    }
+}
+
+
+// Core 0: the WiFi link state machine. At boot this is the WiFi stage,
+// which may run the config portal for up to 45 s while the pipeline is
+// already running.
+void link_task(void *parameter)
+{
+    boot_stage_start(BOOT_WIFI);
+    connected = false;
+    WiFi.mode(WIFI_STA);
+    // Rejoining is up to the link, without the driver's full scan
+    WiFi.setAutoReconnect(false);
+    WiFi.onEvent(WiFiEvent);
+
+    link_begin(&linkIo, link_cache_load());
+    for (;;) {
+        uint32_t wait_ms = link_poll(millis());
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_ms));
     }
-    run_command("battery?", 10);
-    battery_check_tick = 0;
 }
 
 
+// Staged boot: the display and the UI task first, then the pipeline, while
+// the IMU stage runs in the IMU task and WiFi in the link task. Each
+// stage is timed, see boot_timing.h.
 void setup(void)
 {
+    boot_stage_start(BOOT_SERIAL);
     wm.setConfigPortalTimeout(45);  // Auto close configportal after 45 seconds
 
     // Init hardware serial
-    Serial.begin(115200);
+    Serial.setRxBufferSize(SERIAL_RX_BUFFER);
+    Serial.begin(SERIAL_BAUD);
     while (!Serial);
+    bridge_init(&bridgeIo);
+    Serial.onReceive(on_serial_receive);
+    TRACE_BEGIN();
 
     String manageTello = "ManageTello";
     // manageTello = manageTello + "456";
     Serial.println(manageTello);
+    boot_stage_done(BOOT_SERIAL);
 /*
     if( !SPIFFS.begin(FORMAT_SPIFFS_IF_FAILED) ) {
         Serial.println("SPIFFS Mount Failed");
@@ -545,31 +1546,15 @@ void setup(void)
 */
     // Initialize OLED display with I2C address 0x3C
     // SSD1306_SWITCHCAPVCC = generate display voltage from 3.3V internally
+    boot_stage_start(BOOT_DISPLAY);
     display.begin(SH1106_SWITCHCAPVCC, 0x3c);
-    delay(500);
-    display.display();
-    display.setTextSize(1);
-    display.setTextColor(WHITE);
-    display.setRotation(0);
-    display.clearDisplay();
-    display.setCursor(0, 0);
-
-    // Initialize MPU6050 sensor
-    uint8_t status = mpu.begin();
-    Serial.print(F("MPU6050 status: "));
-    Serial.println(status);
-    display.print("MPU6050 status: ");
-    display.println(status);
-    display.display();
-    while (status != 0) {
-        // Loop here if could not connect to MPU6050
-    }
-    // Get the idle controller position
-    Serial.print(F("Calculating offsets, do not move MPU6050... "));
-    delay(1000);
-    mpu.calcOffsets();
-    Serial.println("Done");
-    delay(100);
+
+    // From now on only the UI task draws, through the renderer, and all
+    // I2C traffic goes through the bus scheduler in fast mode
+    oled_begin();
+    i2c_bus_begin(I2C_BUS_CLOCK_HZ);
+    xTaskCreatePinnedToCore(ui_task, "ui", 4096, NULL, 1, NULL, 0);
+    boot_stage_done(BOOT_DISPLAY);
 
     // Configure LEDs
     // pinMode(LED_CONN_RED, OUTPUT);
@@ -594,219 +1579,36 @@ void setup(void)
     Serial.print("Controller Battery %: " ); 
     Serial.println(batteryFraction);
 
-    display.clearDisplay();
-    display.setCursor(0, 0);
-    display.println("Controller Batt %:");
-    display.println(batteryFraction);
-    display.display();
-
-    delay(2000);
-
-    cwButton.begin();
-    ccwButton.begin();
-    takeoffButton.begin();
-    killButton.begin();
-    upButton.begin();
-    downButton.begin();
-    cwButton.onPressed(onCWButtonPressed);
-    ccwButton.onPressed(onCCWButtonPressed);
-    takeoffButton.onPressed(onTakeoffButtonPressed);
-    killButton.onPressed(onKillButtonPressed);
-    killButton.onSequence(2, 2000, onResetWiFiButtonPressed);
-    upButton.onPressed(onUpButtonPressed);
-    downButton.onPressed(onDownButtonPressed);
-
-    connected = false;
-    WiFi.mode(WIFI_STA);
-    WiFi.onEvent(WiFiEvent);
+    char text[UI_TEXT_LENGTH];
+    snprintf(text, sizeof(text), "Controller Batt %%:\n%d", batteryFraction);
+    hal_show(true, text);
 
-  // wm.resetSettings(); // uncomment to force new Tello Binding here
-
-    bool res;
-    res = wm.autoConnect("ManageTello","telloadmin"); // password protected ap
-    // res = wm.autoConnect(manageTello.c_str(),"telloadmin"); // password protected ap
-    if (!res) {
-        Serial.println("Failed to connect or hit timeout");
-        display.clearDisplay();
-        display.setCursor(0, 0);
-        display.println("Reset Controller");
-        display.println("Use ManageTello AP");
-        display.println("On Phone or Computer");
-        display.println("To Connect to Tello");
-        display.display();
-
-        // ESP.restart();
+    // Interrupts are attached by the control task, which handles the events
+    boot_stage_start(BOOT_BUTTONS);
+    for (const auto &b : buttonPins) {
+        button_input_add(b.button, b.pin);
     }
-    else {
-        //if you get here you have connected to the WiFi    
-        Serial.println("connected with DroneBlocks controller to Tello WiFi :)");
-        tello_ssid = (String)wm.getWiFiSSID();
-    }  
+    // Kill double press: WiFi reset
+    button_input_sequence(BUTTON_KILL, 2, 2000);
+
+    udpMutex = xSemaphoreCreateMutex();
+    cmd_engine_init(&telloTransport, on_command_response);
+    rc_stream_begin(udp_send, RC_STREAM_RATE_HZ);
+    flight_recorder_begin();
+    flight_replay_begin(udp_send);
+
+    // Start the pipeline: sensor and control on core 1, comms and UI on core 0.
+    // The control task first, the IMU task notifies it from its first sample.
+    xTaskCreatePinnedToCore(control_task, "control", 4096, NULL, 4, &controlTask, 1);
+    xTaskCreatePinnedToCore(imu_task, "imu", 4096, NULL, 5, NULL, 1);
+    xTaskCreatePinnedToCore(comms_task, "comms", 4096, NULL, 3, &commsTask, 0);
+    // WiFiManager runs its portal web server on this stack
+    xTaskCreatePinnedToCore(link_task, "link", 8192, NULL, 2, &linkTask, 0);
 }
 
 
 void loop()
 {
-    mpu.update();
-    mpuRoll = mpu.getAngleX();
-    mpuPitch = mpu.getAngleY();
-    mpuYaw = mpu.getAngleZ();
-
-    yaw = 0;
-    throttle = 0;
-
-    AbsPitch = abs(mpuPitch);
-    AbsRoll = abs(mpuRoll);
-
-    takeoffButton.read();
-    killButton.read();
-    cwButton.read();
-    ccwButton.read();
-    upButton.read();
-    downButton.read();
-
-    if (AbsRoll <= 10) {
-        roll = 0;
-    }
-    if (AbsPitch <= 15) {
-        pitch = 0;
-    }
-
-    if (mpuPitch < -15) {
-        AbsPitch = constrain(AbsPitch, 20, 40);
-        switch (AbsPitch) {
-            case 20:
-                pitch = 20;
-            break;
-            case 40:
-                pitch = 40;
-            break;
-            default:
-                pitch = 30;
-                // pitchString = String(AbsPitch);
-            break;          
-        }
-    }
-
-    if (mpuPitch > 15) {
-        AbsPitch = constrain(AbsPitch, 20, 40);
-        switch (AbsPitch) {
-            case 20:
-                pitch = -20;
-            break;
-            case 40:
-                pitch = -40;
-            break;
-            default:
-                pitch = -30;
-                // pitchString = "-" + AbsPitch;
-            break;          
-        }
-    }
-
-    if (mpuRoll < -10) {
-        AbsRoll = constrain(AbsRoll, 20, 40);
-        switch (AbsRoll) {
-            case 20:
-                roll = 20;
-            break;
-            case 40:
-                roll = 40;
-            break;
-            default:
-                roll = 30;
-                // rollString = String(AbsRoll);
-            break;          
-        }
-    }
-
-    if (mpuRoll > 10) {
-        AbsRoll = constrain(AbsRoll, 20, 40);
-        switch (AbsRoll) {
-            case 20:
-                roll = -20;
-            break;
-            case 40:
-                roll = -40;
-            break;
-            default:
-                roll = -30;
-                // rollString = "-" + AbsRoll;
-            break;          
-        }
-    }
-
-    lastGestureCmd = gestureCmd;
-    //  gestureCmd = rcCmdBegin + rollString + " " + pitchString + rcCmdEnd;
-    gestureCmd = "rc ";
-    gestureCmd = gestureCmd + roll + " " + pitch + " " + throttle + " " + yaw;  
-
-    if (command_error) {
-        Serial.println("Command Error: Attempt to Land");
-        run_command("land", 40);
-        run_command("battery?", 30);
-        battery_check_tick = 0;
-        if (in_flight) {
-            digitalWrite(IN_FLIGHT, LOW);
-            in_flight = false;      
-        }
-        command_error = false;
-    }
-
-    // Tello nose direction is pilot perspective
-    if (in_flight) {
-        if (!gestureCmd.equals(lastGestureCmd) && !in_rc_btn_motion) {
-            // lastCommand = lastGestureCmd;
-            // appendLastCommand();
-            run_command(gestureCmd, 0);
-            Serial.println(gestureCmd);
-        }
-        // else if (!in_rc_btn_motion && !inSerialMotion) {
-        //     // lastCommand = "rc 0 0 0 0"; //default last command
-        // }
-    }  
-
-    // Commands from serial monitor
-    /*
-    if (Serial.available()) {
-        String command = Serial.readStringUntil('\n');
-        char SSID[65];
-        if (command.length() == 0)
-            command = Serial.readStringUntil('\r');
-        if (command.length() > 0) {
-            command.trim();
-            if (command.startsWith("connect")) {
-                command.replace("connect", "");
-                command.trim();
-                strcpy(SSID, command.c_str());
-                WiFi.begin(SSID);
-            }
-            else if (command.startsWith("start")) {
-                inSerialMotion = true;
-                onTakeoffButtonPressed();
-            }
-            else if (command.startsWith("stop")) {
-                onTakeoffButtonPressed();
-                inSerialMotion = false;
-            }
-            // else if (command.startsWith("replay")) {
-            //     processFlightReplay();
-            // }
-            else if (command.startsWith("kill")) {
-                onKillButtonPressed();
-                inSerialMotion = false;
-            }
-            else if (connected) {
-                processSerialCommand(command);
-            }
-        }
-    }
-    */
-
-    if (battery_check_tick == BATTERY_CHECK_LIMIT) {
-        run_command("battery?", 10);
-        battery_check_tick = 0;
-    }
-    // delay(500);  
-    vTaskDelay(1);  
+    // All work runs in the pipeline tasks started by setup()
+    vTaskDelete(NULL);
 }
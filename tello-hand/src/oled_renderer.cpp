@@ -0,0 +1,116 @@
+/*
+ * Double-buffered SH1106 renderer, see `oled_renderer.h`.
+ */
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <esp_timer.h>
+#include "oled_renderer.h"
+#include "i2c_bus.h"
+
+
+static GFXcanvas1 canvas(OLED_WIDTH, OLED_HEIGHT);
+
+// Current frame and what the panel shows, both in SH1106 page layout
+static uint8_t frame[OLED_PAGES][OLED_WIDTH];
+static uint8_t front[OLED_PAGES][OLED_WIDTH];
+static bool front_valid = false;
+
+static oled_stats_t stats = {};
+
+
+static void set_address(uint8_t page, uint8_t column)
+{
+    Wire.beginTransmission(OLED_I2C_ADDRESS);
+    Wire.write((uint8_t) 0x00);           // Co = 0, D/C = 0: command stream
+    Wire.write(0xB0 | page);              // Page address
+    Wire.write(0x00 | (column & 0x0F));   // Lower column address
+    Wire.write(0x10 | (column >> 4));     // Higher column address
+    Wire.endTransmission();
+}
+
+
+// A page goes out in chunks, each one scheduled between IMU reads
+static void write_page(uint8_t page, const uint8_t *data)
+{
+    for (uint8_t x = 0; x < OLED_WIDTH; x += OLED_CHUNK_LENGTH) {
+        i2c_bus_acquire(I2C_CLIENT_DISPLAY);
+        set_address(page, x + OLED_COLUMN_OFFSET);
+
+        Wire.beginTransmission(OLED_I2C_ADDRESS);
+        Wire.write((uint8_t) 0x40);   // D/C = 1: data stream
+        Wire.write(data + x, OLED_CHUNK_LENGTH);
+        Wire.endTransmission();
+        i2c_bus_release(I2C_CLIENT_DISPLAY);
+    }
+}
+
+
+// Canvas rows are horizontal bytes (MSB left), SH1106 pages are vertical
+// bytes (LSB top) covering 8 rows each
+static void convert_page(uint8_t page, uint8_t *out)
+{
+    const uint8_t *rows = canvas.getBuffer() + page * 8 * (OLED_WIDTH / 8);
+
+    for (uint8_t xb = 0; xb < OLED_WIDTH / 8; xb++) {
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            uint8_t mask = 0x80 >> bit;
+            uint8_t column = 0;
+            for (uint8_t row = 0; row < 8; row++) {
+                if (rows[row * (OLED_WIDTH / 8) + xb] & mask)
+                    column |= 1 << row;
+            }
+            out[xb * 8 + bit] = column;
+        }
+    }
+}
+
+
+void oled_begin(void)
+{
+    canvas.fillScreen(BLACK);
+    canvas.setTextSize(1);
+    canvas.setTextColor(WHITE);
+    canvas.setCursor(0, 0);
+    front_valid = false;
+}
+
+
+GFXcanvas1 &oled_canvas(void)
+{
+    return canvas;
+}
+
+
+uint8_t oled_flush(void)
+{
+    int64_t start = esp_timer_get_time();
+    uint8_t written = 0;
+
+    for (uint8_t page = 0; page < OLED_PAGES; page++) {
+        convert_page(page, frame[page]);
+        if (front_valid && memcmp(frame[page], front[page], OLED_WIDTH) == 0) {
+            stats.pages_skipped++;
+            continue;
+        }
+        write_page(page, frame[page]);
+        memcpy(front[page], frame[page], OLED_WIDTH);
+        written++;
+    }
+    front_valid = true;
+
+    if (written > 0) {
+        stats.frames++;
+        stats.pages_written += written;
+        stats.last_flush_us = esp_timer_get_time() - start;
+        if (stats.last_flush_us > stats.max_flush_us)
+            stats.max_flush_us = stats.last_flush_us;
+    }
+    return written;
+}
+
+
+void oled_get_stats(oled_stats_t *out)
+{
+    *out = stats;
+}
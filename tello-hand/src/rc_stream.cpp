@@ -0,0 +1,171 @@
+/*
+ * Fixed-rate rc streaming task, see `rc_stream.h`.
+ */
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "rc_stream.h"
+#include "latency_trace.h"
+
+
+static rc_send_fn_t send_fn = NULL;
+static uint32_t period_us = 1000000 / RC_STREAM_RATE_HZ;
+
+// Shared with the control code
+static portMUX_TYPE setpoint_mux = portMUX_INITIALIZER_UNLOCKED;
+static rc_setpoint_t setpoint = {0, 0, 0, 0};
+static bool setpoint_fresh = false;      // Published, not sent yet
+static uint32_t setpoint_updates = 0;
+static uint32_t setpoint_coalesced = 0;
+static volatile bool enabled = false;
+
+// Counters, written by the task only
+static portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+static rc_stream_stats_t stats = {};
+static uint32_t window_sent = 0;
+static uint32_t window_jitter_samples = 0;  // Periods between full-rate packets
+static uint64_t window_jitter_sum = 0;
+static int64_t window_start_us = 0;
+
+
+// `timed`: jitter_us is a measured period error
+static void record_send(bool ok, bool keepalive, bool timed, uint32_t jitter_us)
+{
+    portENTER_CRITICAL(&stats_mux);
+    stats.sent++;
+    if (keepalive)
+        stats.keepalives++;
+    if (!ok)
+        stats.send_errors++;
+    window_sent++;
+    if (timed) {
+        window_jitter_samples++;
+        window_jitter_sum += jitter_us;
+        if (jitter_us > stats.jitter_max_us)
+            stats.jitter_max_us = jitter_us;
+    }
+    portEXIT_CRITICAL(&stats_mux);
+}
+
+
+static void rc_stream_task(void *parameter)
+{
+    char packet[RC_FORMAT_MAX_LENGTH];
+    TickType_t wake = xTaskGetTickCount();
+    const TickType_t period_ticks = pdMS_TO_TICKS(period_us / 1000);
+    // Whole ticks: at 30 Hz this is 33 ms, not 33333 us
+    const int64_t scheduled_us = (int64_t) period_ticks * portTICK_PERIOD_MS * 1000;
+    int64_t last_send_us = 0;
+    int64_t last_active_us = 0;
+    bool last_full_rate = false;
+
+    for (;;) {
+        vTaskDelayUntil(&wake, period_ticks);
+        if (!enabled) {
+            last_send_us = 0;
+            last_full_rate = false;
+            continue;
+        }
+
+        rc_setpoint_t sp;
+        portENTER_CRITICAL(&setpoint_mux);
+        sp = setpoint;
+        setpoint_fresh = false;
+        portEXIT_CRITICAL(&setpoint_mux);
+
+        int64_t now = esp_timer_get_time();
+        bool keepalive = false;
+        if (!rc_setpoint_is_hover(&sp)) {
+            last_active_us = now;
+        }
+        else if (now - last_active_us > RC_STREAM_HOLD_MS * 1000LL) {
+            // Hovering: only refresh the drone's rc timeout
+            if (last_send_us != 0 && now - last_send_us < RC_STREAM_KEEPALIVE_MS * 1000LL) {
+                last_full_rate = false;
+                continue;
+            }
+            keepalive = true;
+        }
+
+        size_t length = rc_format(packet, &sp);
+        bool ok = send_fn((const uint8_t *) packet, length + 1);
+        TRACE_SETPOINT_SENT();
+
+        // Period error only makes sense between two full-rate packets
+        uint32_t jitter_us = 0;
+        bool timed = last_full_rate && !keepalive;
+        if (timed) {
+            int64_t error = (now - last_send_us) - scheduled_us;
+            jitter_us = error < 0 ? -error : error;
+        }
+        last_send_us = now;
+        last_full_rate = !keepalive;
+        record_send(ok, keepalive, timed, jitter_us);
+    }
+}
+
+
+void rc_stream_begin(rc_send_fn_t send, uint16_t rate_hz)
+{
+    send_fn = send;
+    rate_hz = constrain(rate_hz, RC_STREAM_MIN_HZ, RC_STREAM_MAX_HZ);
+    period_us = 1000000 / rate_hz;
+    window_start_us = esp_timer_get_time();
+
+    xTaskCreatePinnedToCore(rc_stream_task, "rc_stream", RC_STREAM_STACK, NULL,
+                            RC_STREAM_PRIORITY, NULL, RC_STREAM_CORE);
+}
+
+
+void rc_stream_enable(bool enable)
+{
+    if (!enable)
+        rc_stream_set(0, 0, 0, 0);
+    enabled = enable;
+}
+
+
+void rc_stream_set(int roll, int pitch, int throttle, int yaw)
+{
+    rc_setpoint_t sp;
+    sp.roll = constrain(roll, -100, 100);
+    sp.pitch = constrain(pitch, -100, 100);
+    sp.throttle = constrain(throttle, -100, 100);
+    sp.yaw = constrain(yaw, -100, 100);
+
+    portENTER_CRITICAL(&setpoint_mux);
+    if (enabled && !rc_setpoint_equal(&sp, &setpoint)) {
+        setpoint_updates++;
+        if (setpoint_fresh)
+            setpoint_coalesced++;
+        setpoint_fresh = true;
+    }
+    setpoint = sp;
+    portEXIT_CRITICAL(&setpoint_mux);
+}
+
+
+void rc_stream_get_stats(rc_stream_stats_t *out)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&setpoint_mux);
+    uint32_t updates = setpoint_updates;
+    uint32_t coalesced = setpoint_coalesced;
+    portEXIT_CRITICAL(&setpoint_mux);
+
+    portENTER_CRITICAL(&stats_mux);
+    float window_s = (now - window_start_us) / 1e6f;
+    stats.rate_hz = window_s > 0 ? window_sent / window_s : 0;
+    stats.jitter_avg_us = window_jitter_samples ? window_jitter_sum / window_jitter_samples : 0;
+    stats.updates = updates;
+    stats.coalesced = coalesced;
+    *out = stats;
+
+    window_sent = 0;
+    window_jitter_samples = 0;
+    window_jitter_sum = 0;
+    window_start_us = now;
+    stats.jitter_max_us = 0;
+    portEXIT_CRITICAL(&stats_mux);
+}
@@ -0,0 +1,270 @@
+/*
+ * Serial-to-UDP bridge, see `serial_bridge.h`.
+ */
+
+#include <string.h>
+#include <atomic>
+#include "serial_bridge.h"
+#include "serial_frame.h"
+
+
+// Command waiting for its answer. The receiving side only fills free
+// slots, the responding side only frees used ones.
+typedef struct {
+    std::atomic<bool> used;
+    uint8_t seq;
+    uint32_t order;
+    char text[CMD_MAX_LENGTH];
+} pending_t;
+
+static const bridge_io_t *io = NULL;
+static std::atomic<bool> active{false};
+static frame_decoder_t decoder;
+static pending_t pending[BRIDGE_PENDING];
+static uint32_t next_order = 0;
+// Each counter has one writing task; `rejected` is counted by both sides
+// and added up in bridge_get_stats()
+static bridge_stats_t stats = {};
+static uint32_t dropped = 0;                 // Refused by the engine queue
+static std::atomic<uint32_t> last_frame_ms{0};
+static std::atomic<bool> rc_latched{false};  // A host setpoint is in effect
+
+
+static void send_frame(uint8_t type, const void *payload, size_t length)
+{
+    uint8_t frame[FRAME_MAX_LENGTH];
+
+    size_t frame_length = frame_encode(type, payload, length, frame);
+    if (frame_length > 0)
+        io->write(frame, frame_length);
+}
+
+
+static void send_ack(uint8_t seq, uint8_t result, uint32_t rtt_ms, const char *text)
+{
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    size_t length = strlen(text);
+
+    if (length > FRAME_MAX_PAYLOAD - 4)
+        length = FRAME_MAX_PAYLOAD - 4;
+    if (rtt_ms > UINT16_MAX)
+        rtt_ms = UINT16_MAX;
+    payload[0] = seq;
+    payload[1] = result;
+    payload[2] = rtt_ms & 0xFF;
+    payload[3] = rtt_ms >> 8;
+    memcpy(payload + 4, text, length);
+    send_frame(BRIDGE_ACK, payload, length + 4);
+}
+
+
+// Only the newest setpoint of a batch is handed on
+static void receive_rc(const uint8_t *payload, uint8_t length)
+{
+    rc_setpoint_t setpoint;
+
+    if (length == 0 || length % sizeof(setpoint) != 0)
+        return;
+    uint8_t count = length / sizeof(setpoint);
+    stats.setpoints += count;
+    stats.coalesced += count - 1;
+    memcpy(&setpoint, payload + length - sizeof(setpoint), sizeof(setpoint));
+    io->set_rc(&setpoint);
+    rc_latched.store(true, std::memory_order_release);
+}
+
+
+static void receive_command(const uint8_t *payload, uint8_t length)
+{
+    if (length < 2)
+        return;
+    uint8_t seq = payload[0];
+    size_t text_length = length - 1;
+    if (text_length >= CMD_MAX_LENGTH)
+        text_length = CMD_MAX_LENGTH - 1;
+    stats.commands++;
+
+    pending_t *slot = NULL;
+    for (uint8_t i = 0; i < BRIDGE_PENDING && slot == NULL; i++) {
+        if (!pending[i].used.load(std::memory_order_acquire))
+            slot = &pending[i];
+    }
+    if (slot == NULL) {
+        stats.rejected++;
+        send_ack(seq, BRIDGE_REJECTED, 0, "busy");
+        return;
+    }
+    slot->seq = seq;
+    slot->order = next_order++;
+    memcpy(slot->text, payload + 1, text_length);
+    slot->text[text_length] = '\0';
+    // Visible before the command can be answered
+    slot->used.store(true, std::memory_order_release);
+
+    if (!io->command(slot->text)) {
+        slot->used.store(false, std::memory_order_release);
+        stats.rejected++;
+        send_ack(seq, BRIDGE_REJECTED, 0, "not queued");
+    }
+}
+
+
+// Sequence of the oldest pending command with this text, the engine keeps
+// their order; BRIDGE_SEQ_NONE if the controller sent it itself
+static uint8_t take_pending(const char *command)
+{
+    pending_t *slot = NULL;
+    for (uint8_t i = 0; i < BRIDGE_PENDING; i++) {
+        pending_t *p = &pending[i];
+        if (!p->used.load(std::memory_order_acquire) || strcmp(p->text, command) != 0)
+            continue;
+        if (slot == NULL || (int32_t) (p->order - slot->order) < 0)
+            slot = p;
+    }
+    if (slot == NULL)
+        return BRIDGE_SEQ_NONE;
+    uint8_t seq = slot->seq;
+    slot->used.store(false, std::memory_order_release);
+    return seq;
+}
+
+
+void bridge_init(const bridge_io_t *bridge_io)
+{
+    io = bridge_io;
+    active = false;
+}
+
+
+void bridge_enter(void)
+{
+    frame_decoder_init(&decoder);
+    for (uint8_t i = 0; i < BRIDGE_PENDING; i++)
+        pending[i].used.store(false, std::memory_order_relaxed);
+    last_frame_ms = io->clock_ms();
+    rc_latched = false;
+    active = true;
+}
+
+
+void bridge_exit(void)
+{
+    active = false;
+}
+
+
+bool bridge_active(void)
+{
+    return active;
+}
+
+
+void bridge_receive(const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length && active; i++) {
+        if (!frame_decode(&decoder, data[i]))
+            continue;
+        stats.frames++;
+        last_frame_ms.store(io->clock_ms(), std::memory_order_release);
+        switch (decoder.type) {
+            case BRIDGE_RC:
+                receive_rc(decoder.payload, decoder.length);
+            break;
+
+            case BRIDGE_COMMAND:
+                receive_command(decoder.payload, decoder.length);
+            break;
+
+            case BRIDGE_EXIT:
+                bridge_exit();
+            break;
+
+            default:
+            break;
+        }
+    }
+    stats.crc_errors = decoder.crc_errors;
+}
+
+
+// The last setpoint would otherwise stay latched: the rc stream's
+// keep-alive repeats it for as long as the controller runs
+void bridge_poll(void)
+{
+    static const rc_setpoint_t hover = {0, 0, 0, 0};
+
+    if (!active || !rc_latched.load(std::memory_order_acquire))
+        return;
+    if (io->clock_ms() - last_frame_ms.load(std::memory_order_acquire) < BRIDGE_SILENCE_MS)
+        return;
+    rc_latched = false;
+    io->set_rc(&hover);
+    stats.silences++;
+}
+
+
+void bridge_on_response(const char *command, cmd_result_t result,
+                        const char *response, uint32_t rtt_ms)
+{
+    if (!active)
+        return;
+    stats.acks++;
+    send_ack(take_pending(command), result, rtt_ms, response);
+}
+
+
+void bridge_on_dropped(const char *command)
+{
+    if (!active)
+        return;
+    uint8_t seq = take_pending(command);
+    if (seq == BRIDGE_SEQ_NONE)
+        return;
+    dropped++;
+    send_ack(seq, BRIDGE_REJECTED, 0, "queue full");
+}
+
+
+void bridge_on_state(const tello_state_t *state)
+{
+    bridge_state_t packed;
+
+    if (!active)
+        return;
+    packed.pitch = state->pitch;
+    packed.roll = state->roll;
+    packed.yaw = state->yaw;
+    packed.vgx = state->vgx;
+    packed.vgy = state->vgy;
+    packed.vgz = state->vgz;
+    packed.templ = state->templ;
+    packed.temph = state->temph;
+    packed.tof = state->tof;
+    packed.h = state->h;
+    packed.bat = state->bat;
+    packed.time = state->time;
+    packed.baro_cm = (int16_t) (state->baro * 100.0f);
+    packed.agx = (int16_t) state->agx;
+    packed.agy = (int16_t) state->agy;
+    packed.agz = (int16_t) state->agz;
+    stats.states++;
+    send_frame(BRIDGE_STATE, &packed, sizeof(packed));
+}
+
+
+void bridge_send_stats(void)
+{
+    bridge_stats_t copy;
+
+    if (!active)
+        return;
+    bridge_get_stats(&copy);
+    send_frame(BRIDGE_STATS, &copy, sizeof(copy));
+}
+
+
+void bridge_get_stats(bridge_stats_t *out)
+{
+    *out = stats;
+    out->rejected += dropped;
+}
@@ -0,0 +1,72 @@
+/*
+ * Serial command console, see `serial_console.h`.
+ */
+
+#include <string.h>
+#include "serial_console.h"
+
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+
+bool console_feed(console_line_t *line, char c)
+{
+    if (c != '\n' && c != '\r') {
+        if (line->length < CONSOLE_LINE_LENGTH - 1)
+            line->text[line->length++] = c;
+        else
+            line->overflow = true;
+        return false;
+    }
+
+    // End of line; the "\n" of a "\r\n" ends an empty one
+    bool complete = !line->overflow && line->length > 0;
+    line->text[line->length] = '\0';
+    line->length = 0;
+    line->overflow = false;
+    return complete;
+}
+
+
+console_result_t console_dispatch(const console_command_t *table, size_t count,
+                                  const char *text, console_handler_t fallback)
+{
+    while (is_space(*text))
+        text++;
+    size_t end = strlen(text);
+    while (end > 0 && is_space(text[end - 1]))
+        end--;
+    if (end == 0)
+        return CONSOLE_EMPTY;
+
+    // Trimmed copy, the table handlers get a terminated argument
+    char line[CONSOLE_LINE_LENGTH];
+    if (end >= sizeof(line))
+        end = sizeof(line) - 1;
+    memcpy(line, text, end);
+    line[end] = '\0';
+
+    size_t word = 0;
+    while (line[word] != '\0' && !is_space(line[word]))
+        word++;
+    const char *argument = line + word;
+    while (is_space(*argument))
+        argument++;
+
+    for (size_t i = 0; i < count; i++) {
+        const console_command_t *command = &table[i];
+        if (strlen(command->name) != word || strncmp(command->name, line, word) != 0)
+            continue;
+        if (command->argument && *argument == '\0')
+            return CONSOLE_NO_ARGUMENT;
+        command->handler(argument);
+        return CONSOLE_OK;
+    }
+
+    if (fallback != NULL)
+        fallback(line);
+    return CONSOLE_UNKNOWN;
+}
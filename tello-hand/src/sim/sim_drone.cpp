@@ -0,0 +1,249 @@
+/*
+ * Simulated Tello, see `sim_drone.h`.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "sim_drone.h"
+
+#define ANSWER_QUEUE     8
+#define ANSWER_LENGTH    16
+#define HOVER_HEIGHT_CM  80
+#define BATTERY_DRAIN_MS 10000   // 1% per 10 s in the air
+
+typedef struct {
+    uint32_t due_ms;
+    char text[ANSWER_LENGTH];
+} answer_t;
+
+static sim_drone_config_t config;
+static sim_drone_stats_t stats;
+
+static answer_t answers[ANSWER_QUEUE];
+static uint32_t answer_head = 0;
+static uint32_t answer_count = 0;
+
+static int rc[4];                  // roll, pitch, throttle, yaw
+static uint32_t phase_end_ms = 0;  // End of a takeoff or landing
+static uint32_t last_command_ms = 0;
+static uint32_t last_rc_ms = 0;
+static uint32_t last_step_ms = 0;
+static uint32_t air_ms = 0;
+
+
+static void answer(const char *text, uint32_t due_ms)
+{
+    if (answer_count == ANSWER_QUEUE)
+        return;
+    answer_t *a = &answers[(answer_head + answer_count) % ANSWER_QUEUE];
+    a->due_ms = due_ms;
+    snprintf(a->text, ANSWER_LENGTH, "%s", text);
+    answer_count++;
+}
+
+
+static void error(uint32_t now_ms)
+{
+    stats.errors++;
+    answer("error", now_ms + config.answer_ms);
+}
+
+
+static void set_phase(sim_drone_phase_t phase, uint32_t now_ms, uint32_t duration_ms)
+{
+    stats.phase = phase;
+    phase_end_ms = now_ms + duration_ms;
+    memset(rc, 0, sizeof(rc));
+    last_rc_ms = now_ms;
+}
+
+
+void sim_drone_init(const sim_drone_config_t *drone_config)
+{
+    config = *drone_config;
+    memset(&stats, 0, sizeof(stats));
+    stats.battery = config.battery;
+    answer_head = 0;
+    answer_count = 0;
+    memset(rc, 0, sizeof(rc));
+    last_command_ms = 0;
+    last_rc_ms = 0;
+    last_step_ms = 0;
+    air_ms = 0;
+}
+
+
+static void receive_rc(const char *text, uint32_t now_ms)
+{
+    int values[4];
+
+    stats.rc_packets++;
+    if (sscanf(text, "rc %d %d %d %d", &values[0], &values[1], &values[2], &values[3]) != 4) {
+        stats.errors++;
+        return;
+    }
+    if (stats.phase != DRONE_FLYING) {
+        stats.rc_ignored++;
+        return;
+    }
+    if (now_ms - last_rc_ms > stats.rc_gap_max_ms)
+        stats.rc_gap_max_ms = now_ms - last_rc_ms;
+    last_rc_ms = now_ms;
+    memcpy(rc, values, sizeof(rc));
+}
+
+
+void sim_drone_receive(const uint8_t *data, size_t length, uint32_t now_ms)
+{
+    char text[64];
+
+    if (length >= sizeof(text))
+        length = sizeof(text) - 1;
+    memcpy(text, data, length);
+    text[length] = '\0';
+
+    sim_drone_step(now_ms);
+    if (strncmp(text, "rc ", 3) == 0) {
+        if (stats.phase != DRONE_OFF) {
+            last_command_ms = now_ms;
+            receive_rc(text, now_ms);
+        }
+        return;
+    }
+
+    // Not in SDK mode, the drone ignores everything but "command"
+    if (stats.phase == DRONE_OFF && strcmp(text, "command") != 0)
+        return;
+    stats.commands++;
+    last_command_ms = now_ms;
+
+    if (strcmp(text, "command") == 0) {
+        if (stats.phase == DRONE_OFF)
+            stats.phase = DRONE_LANDED;
+        answer("ok", now_ms + config.answer_ms);
+    }
+    else if (strcmp(text, "takeoff") == 0) {
+        if (stats.phase != DRONE_LANDED) {
+            error(now_ms);
+            return;
+        }
+        stats.flights++;
+        set_phase(DRONE_TAKING_OFF, now_ms, config.takeoff_ms);
+        answer("ok", phase_end_ms);
+    }
+    else if (strcmp(text, "land") == 0) {
+        if (stats.phase != DRONE_FLYING) {
+            error(now_ms);
+            return;
+        }
+        set_phase(DRONE_LANDING, now_ms, config.land_ms);
+        answer("ok", phase_end_ms);
+    }
+    else if (strcmp(text, "emergency") == 0) {
+        // Motors stop at once
+        if (stats.phase != DRONE_LANDED)
+            stats.emergencies++;
+        set_phase(DRONE_LANDED, now_ms, 0);
+        stats.z = 0;
+        answer("ok", now_ms + config.answer_ms);
+    }
+    else if (strcmp(text, "battery?") == 0) {
+        char value[ANSWER_LENGTH];
+        snprintf(value, sizeof(value), "%d", stats.battery);
+        answer(value, now_ms + config.answer_ms);
+    }
+    else {
+        error(now_ms);
+    }
+}
+
+
+int sim_drone_answer(uint8_t *data, size_t size, uint32_t now_ms)
+{
+    if (answer_count == 0 || (int32_t) (now_ms - answers[answer_head].due_ms) < 0)
+        return 0;
+
+    const answer_t *a = &answers[answer_head];
+    size_t length = strlen(a->text);
+    if (length > size)
+        length = size;
+    memcpy(data, a->text, length);
+    answer_head = (answer_head + 1) % ANSWER_QUEUE;
+    answer_count--;
+    return length;
+}
+
+
+void sim_drone_step(uint32_t now_ms)
+{
+    const float d2r = M_PI / 180.0f;
+    uint32_t dt_ms = now_ms - last_step_ms;
+
+    last_step_ms = now_ms;
+    switch (stats.phase) {
+        case DRONE_TAKING_OFF:
+            if ((int32_t) (now_ms - phase_end_ms) >= 0) {
+                stats.phase = DRONE_FLYING;
+                stats.z = HOVER_HEIGHT_CM;
+                last_rc_ms = now_ms;
+            }
+        break;
+
+        case DRONE_LANDING:
+            if ((int32_t) (now_ms - phase_end_ms) >= 0) {
+                stats.phase = DRONE_LANDED;
+                stats.z = 0;
+            }
+        break;
+
+        case DRONE_FLYING: {
+            // Body frame velocities from the rc setpoint, 1 cm/s per unit
+            float dt = dt_ms * 1e-3f;
+            float heading = stats.yaw * d2r;
+            float right = rc[0] * dt;
+            float forward = rc[1] * dt;
+            float dx = forward * cosf(heading) - right * sinf(heading);
+            float dy = forward * sinf(heading) + right * cosf(heading);
+            float dz = rc[2] * dt;
+
+            stats.x += dx;
+            stats.y += dy;
+            stats.z += dz;
+            if (stats.z < 20)
+                stats.z = 20;
+            stats.distance += sqrtf(dx * dx + dy * dy + dz * dz);
+            stats.yaw = fmodf(stats.yaw + rc[3] * dt + 540.0f, 360.0f) - 180.0f;
+
+            if (now_ms - last_command_ms > config.rc_timeout_ms) {
+                stats.auto_lands++;
+                set_phase(DRONE_LANDING, now_ms, config.land_ms);
+            }
+        }
+        break;
+
+        default:
+        break;
+    }
+
+    if (stats.phase != DRONE_OFF && stats.phase != DRONE_LANDED) {
+        air_ms += dt_ms;
+        while (air_ms >= BATTERY_DRAIN_MS && stats.battery > 0) {
+            air_ms -= BATTERY_DRAIN_MS;
+            stats.battery--;
+        }
+    }
+}
+
+
+void sim_drone_get_stats(sim_drone_stats_t *out)
+{
+    *out = stats;
+}
+
+
+const char *sim_drone_phase_name(sim_drone_phase_t phase)
+{
+    static const char *const names[] = {"off", "landed", "taking off", "flying", "landing"};
+    return names[phase];
+}
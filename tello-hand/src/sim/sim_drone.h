@@ -0,0 +1,64 @@
+/*
+ * Simulated Tello for the software-in-the-loop build.
+ *
+ * Answers the SDK commands after a configurable delay, flies the rc
+ * setpoints as velocities (1 cm/s or 1 deg/s per rc unit), drains the
+ * battery in the air and lands on its own when no command arrives for
+ * `rc_timeout_ms`, as the real drone does after 15 s. All times are
+ * simulation milliseconds given by the caller.
+ */
+
+#ifndef SIM_DRONE_H
+#define SIM_DRONE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+    DRONE_OFF = 0,        // Not in SDK mode yet
+    DRONE_LANDED,
+    DRONE_TAKING_OFF,
+    DRONE_FLYING,
+    DRONE_LANDING
+} sim_drone_phase_t;
+
+typedef struct {
+    uint32_t answer_ms;       // "command", "battery?", "emergency", ...
+    uint32_t takeoff_ms;
+    uint32_t land_ms;
+    uint32_t rc_timeout_ms;   // Lands after this long without a command in the air
+    int battery;              // Start level [%]
+} sim_drone_config_t;
+
+typedef struct {
+    sim_drone_phase_t phase;
+    uint32_t commands;        // Acknowledged commands received
+    uint32_t rc_packets;
+    uint32_t rc_ignored;      // rc packets while not flying
+    uint32_t errors;          // Answered with "error"
+    uint32_t flights;
+    uint32_t emergencies;
+    uint32_t auto_lands;      // Landed by the rc timeout
+    uint32_t rc_gap_max_ms;   // Longest time between two packets in the air
+    float x, y, z;            // Position [cm]
+    float yaw;                // Heading [deg]
+    float distance;           // Flown [cm]
+    int battery;              // [%]
+} sim_drone_stats_t;
+
+void sim_drone_init(const sim_drone_config_t *config);
+
+// Datagram from the controller, NUL terminated or not
+void sim_drone_receive(const uint8_t *data, size_t length, uint32_t now_ms);
+
+// Copy the next answer that is due into `data`, 0 if there is none
+int sim_drone_answer(uint8_t *data, size_t size, uint32_t now_ms);
+
+// Advance the flight to `now_ms`
+void sim_drone_step(uint32_t now_ms);
+
+void sim_drone_get_stats(sim_drone_stats_t *stats);
+
+const char *sim_drone_phase_name(sim_drone_phase_t phase);
+
+#endif
@@ -0,0 +1,522 @@
+/*
+ * Software-in-the-loop run of the tello-hand controller on Linux.
+ *
+ * The controller logic (`controller.cpp`), the command engine and the IMU
+ * fusion are the firmware's own code; this file implements `hal.h` on a
+ * virtual millisecond clock and stands in for the pipeline tasks:
+ *
+ *   imu      samples from a recorded trace, fused as in the firmware
+ *   control  controller_update() after every `batch` samples, buttons
+ *   comms    command engine against the simulated drone (`sim_drone.h`)
+ *   rc       latest setpoint at RC_STREAM_RATE_HZ while in flight
+ *
+ * Simulated time only advances in the loop, so a flight runs as fast as
+ * the host allows. The trace is a CSV file with one sample per line
+ *   t_us,ax,ay,az,gx,gy,gz[,...]
+ * in g and deg/s, as used by host/fusion_bench.cpp; without one a
+ * synthetic trace with a fixed gesture sequence is generated. The run is
+ * deterministic: `-o` writes every setpoint, command and answer with its
+ * simulated time, so two builds are compared with a plain diff.
+ *
+ * Build and run:
+ *   pio run -e native
+ *   .pio/build/native/program [-p button@s ...] [-b batch] [-d s] [-o events.csv] [-q] [trace.csv]
+ *
+ *   -p  press a button at a simulated time, e.g. -p takeoff@2 -p cw@10.5
+ *       (takeoff, kill, kill2, up, down, cw, ccw); default takeoff, climb
+ *       and land around the trace
+ *   -b  IMU samples per control update, 5 as with the FIFO (default)
+ *   -d  length of the synthetic trace [s], default 60
+ *   -o  event log CSV
+ *   -q  no controller log on stdout
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include <imu_fusion.h>
+#include "command_engine.h"
+#include "controller.h"
+#include "hal.h"
+#include "rc_format.h"
+#include "sim_drone.h"
+
+#ifndef RC_STREAM_RATE_HZ
+#define RC_STREAM_RATE_HZ    20
+#endif
+
+#define SIM_STEP_MS          1
+#define SYNTHETIC_RATE_HZ    200
+#define STATE_PERIOD_MS      100    // Tello state stream, 10 datagrams/s
+#define GYRO_LSB_PER_DPS     65.5
+#define ACC_LSB_PER_G        16384.0
+
+typedef struct {
+    uint32_t t_us;
+    float ax, ay, az;
+    float gx, gy, gz;
+} trace_sample_t;
+
+typedef struct {
+    uint32_t time_ms;
+    button_t button;
+} press_t;
+
+static const char *const button_names[BUTTONS] = {
+    "takeoff", "kill", "kill2", "up", "down", "cw", "ccw"
+};
+
+static const char *const result_names[] = {
+    "ok", "value", "error", "timeout", "no_response", "preempted"
+};
+
+// Simulated time [ms]
+static uint32_t sim_ms = 0;
+static bool quiet = false;
+static FILE *events = NULL;
+
+static rc_setpoint_t rc_setpoint = {0, 0, 0, 0};
+static bool rc_enabled = false;
+static bool restarted = false;
+
+static struct {
+    uint32_t updates;
+    uint32_t setpoints;
+    uint32_t commands;
+    uint32_t dropped;
+    uint32_t results[CMD_RESULTS];
+    uint32_t shows;
+    uint32_t datagrams;
+} counters;
+
+
+static void log_event(const char *event, const char *detail)
+{
+    if (events != NULL)
+        fprintf(events, "%u,%s,%s\n", sim_ms, event, detail);
+}
+
+
+// HAL
+
+uint32_t hal_millis(void)
+{
+    return sim_ms;
+}
+
+
+void hal_log(const char *text)
+{
+    if (!quiet)
+        printf("[%9.3f] %s\n", sim_ms / 1000.0, text);
+}
+
+
+void hal_show(bool, const char *)
+{
+    counters.shows++;
+}
+
+
+void hal_led(hal_led_t led, bool on)
+{
+    log_event(led == HAL_LED_IN_FLIGHT ? "led_in_flight" : "led_battery_low", on ? "on" : "off");
+}
+
+
+bool hal_command(const char *command, uint32_t timeout_ms)
+{
+    log_event("command", command);
+    if (!cmd_engine_submit(command, timeout_ms)) {
+        counters.dropped++;
+        return false;
+    }
+    counters.commands++;
+    return true;
+}
+
+
+void hal_rc_set(const rc_setpoint_t *sp)
+{
+    char text[RC_FORMAT_MAX_LENGTH];
+
+    rc_setpoint = *sp;
+    counters.setpoints++;
+    rc_format(text, sp);
+    log_event("setpoint", text);
+}
+
+
+void hal_rc_enable(bool on)
+{
+    rc_enabled = on;
+}
+
+
+bool hal_link_connected(void)
+{
+    return true;
+}
+
+
+void hal_reset_wifi(void)
+{
+    log_event("reset_wifi", "");
+    restarted = true;
+}
+
+
+void hal_recording(bool on)
+{
+    log_event("recording", on ? "on" : "off");
+}
+
+
+void hal_replay_abort(void)
+{
+}
+
+
+bool hal_replay_running(void)
+{
+    return false;
+}
+
+
+// Command engine transport to the simulated drone
+
+static bool sim_send(const uint8_t *data, size_t length)
+{
+    counters.datagrams++;
+    sim_drone_receive(data, length, sim_ms);
+    return true;
+}
+
+
+static int sim_receive(uint8_t *data, size_t size)
+{
+    return sim_drone_answer(data, size, sim_ms);
+}
+
+
+static const cmd_transport_t simTransport = {sim_send, sim_receive, hal_millis};
+
+
+static void on_response(const char *command, cmd_result_t result, const char *response, uint32_t rtt_ms)
+{
+    char text[CMD_MAX_LENGTH + 32];
+
+    counters.results[result]++;
+    snprintf(text, sizeof(text), "%s,%s,%u", command, result_names[result], rtt_ms);
+    log_event("answer", text);
+    controller_on_response(command, result, response, rtt_ms);
+}
+
+
+// Synthetic gesture sequence: tilts held for 3 s with 0.5 s ramps
+static float smoothstep(float x)
+{
+    x = x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+    return x * x * (3.0f - 2.0f * x);
+}
+
+
+static void gesture(float t, float *roll, float *pitch)
+{
+    static const float tilts[][2] = {
+        {30, 0}, {0, -30}, {-30, 0}, {0, 30}, {20, 20}, {-45, 0}, {0, -45}
+    };
+    const float start = 10.0f, period = 6.0f, hold = 3.0f, ramp = 0.5f;
+
+    *roll = 0;
+    *pitch = 0;
+    if (t < start)
+        return;
+    int index = (int) ((t - start) / period);
+    if (index >= (int) (sizeof(tilts) / sizeof(tilts[0])))
+        return;
+    float local = t - start - index * period;
+    float level = smoothstep(local / ramp) * (1.0f - smoothstep((local - hold) / ramp));
+    *roll = tilts[index][0] * level;
+    *pitch = tilts[index][1] * level;
+}
+
+
+static void synthesize(std::vector<trace_sample_t> &trace, float seconds)
+{
+    const float d2r = M_PI / 180.0f;
+    const float dt = 1.0f / SYNTHETIC_RATE_HZ;
+    const float h = 1e-3f;
+
+    srand(1);
+    for (int i = 0; i < seconds * SYNTHETIC_RATE_HZ; i++) {
+        float t = i * dt;
+        float roll, pitch, roll_a, pitch_a, roll_b, pitch_b;
+        gesture(t, &roll, &pitch);
+        gesture(t - h, &roll_a, &pitch_a);
+        gesture(t + h, &roll_b, &pitch_b);
+        float droll = (roll_b - roll_a) / (2 * h);
+        float dpitch = (pitch_b - pitch_a) / (2 * h);
+        float sr = sinf(roll * d2r), cr = cosf(roll * d2r);
+        float sp = sinf(pitch * d2r), cp = cosf(pitch * d2r);
+        float n[6];
+        for (int k = 0; k < 6; k++)
+            n[k] = (rand() / (float) RAND_MAX) * 2.0f - 1.0f;
+
+        trace_sample_t s;
+        s.t_us = (uint32_t) (t * 1e6f);
+        // Gravity in the body frame and body rates, no yaw, plus noise
+        s.ax = -sp + 0.02f * n[0];
+        s.ay = sr * cp + 0.02f * n[1];
+        s.az = cr * cp + 0.02f * n[2];
+        s.gx = droll + 0.3f * n[3];
+        s.gy = dpitch * cr + 0.3f * n[4];
+        s.gz = -dpitch * sr + 0.3f * n[5];
+        trace.push_back(s);
+    }
+}
+
+
+static bool load(const char *path, std::vector<trace_sample_t> &trace)
+{
+    FILE *file = fopen(path, "r");
+    char line[256];
+    unsigned long first_us = 0;
+
+    if (file == NULL)
+        return false;
+    while (fgets(line, sizeof(line), file)) {
+        trace_sample_t s;
+        unsigned long t_us;
+        if (sscanf(line, "%lu,%f,%f,%f,%f,%f,%f", &t_us,
+                   &s.ax, &s.ay, &s.az, &s.gx, &s.gy, &s.gz) < 7)
+            continue;   // Header or comment
+        // Simulated time starts with the first sample
+        if (trace.empty())
+            first_us = t_us;
+        s.t_us = t_us - first_us;
+        trace.push_back(s);
+    }
+    fclose(file);
+    return !trace.empty();
+}
+
+
+// "<button>@<seconds>"
+static bool parse_press(const char *arg, press_t *press)
+{
+    const char *at = strchr(arg, '@');
+
+    if (at == NULL)
+        return false;
+    for (int i = 0; i < BUTTONS; i++) {
+        if (strlen(button_names[i]) == (size_t) (at - arg) &&
+            strncmp(arg, button_names[i], at - arg) == 0) {
+            press->button = (button_t) i;
+            press->time_ms = (uint32_t) (atof(at + 1) * 1000);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-p button@s ...] [-b batch] [-d s] [-o events.csv] [-q] [trace.csv]\n",
+            name);
+    exit(2);
+}
+
+
+int main(int argc, char **argv)
+{
+    std::vector<trace_sample_t> trace;
+    std::vector<press_t> presses;
+    int batch = 5;
+    float seconds = 60;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:b:d:o:q")) != -1) {
+        press_t press;
+        switch (opt) {
+            case 'p':
+                if (!parse_press(optarg, &press)) {
+                    fprintf(stderr, "bad press '%s'\n", optarg);
+                    usage(argv[0]);
+                }
+                presses.push_back(press);
+            break;
+
+            case 'b':
+                batch = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+
+            case 'd':
+                seconds = atof(optarg);
+            break;
+
+            case 'o':
+                events = fopen(optarg, "w");
+                if (events == NULL) {
+                    perror(optarg);
+                    return 1;
+                }
+                fprintf(events, "time_ms,event,detail\n");
+            break;
+
+            case 'q':
+                quiet = true;
+            break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind < argc) {
+        if (!load(argv[optind], trace)) {
+            fprintf(stderr, "cannot read trace %s\n", argv[optind]);
+            return 1;
+        }
+    }
+    else {
+        synthesize(trace, seconds);
+    }
+    uint32_t end_ms = trace.back().t_us / 1000;
+
+    // Default flight: takeoff, a button climb, land before the end
+    if (presses.empty()) {
+        presses.push_back({2000, BUTTON_TAKEOFF});
+        presses.push_back({8000, BUTTON_UP});
+        presses.push_back({9000, BUTTON_UP});
+        if (end_ms > 16000)
+            presses.push_back({end_ms - 8000, BUTTON_TAKEOFF});
+    }
+    std::stable_sort(presses.begin(), presses.end(),
+                     [](const press_t &a, const press_t &b) { return a.time_ms < b.time_ms; });
+
+    const sim_drone_config_t drone = {20, 4000, 3000, 15000, 90};
+    sim_drone_init(&drone);
+    cmd_engine_init(&simTransport, on_response);
+
+#ifdef IMU_FUSION_FIXED
+    mahony_fx_t fusion;
+    mahony_fx_init(&fusion, MAHONY_KP, MAHONY_KI, GYRO_LSB_PER_DPS);
+#else
+    mahony_t fusion;
+    mahony_init(&fusion, MAHONY_KP, MAHONY_KI);
+#endif
+    euler_t angles;
+    size_t next_sample = 0;
+    size_t next_press = 0;
+    int pending = 0;
+    uint32_t next_rc_ms = 0;
+    uint32_t next_state_ms = 0;
+    bool first_state = true;
+    const uint32_t rc_period_ms = 1000 / RC_STREAM_RATE_HZ;
+
+    double wall_start = now_s();
+    controller_start_session("TELLO-SIM");
+
+    for (sim_ms = 0; sim_ms <= end_ms && !restarted; sim_ms += SIM_STEP_MS) {
+        // IMU task: every sample that is due, fused with the trace's own spacing
+        while (next_sample < trace.size() && trace[next_sample].t_us <= sim_ms * 1000) {
+            const trace_sample_t &s = trace[next_sample];
+            uint32_t dt_us = next_sample > 0 ? s.t_us - trace[next_sample - 1].t_us : 0;
+#ifdef IMU_FUSION_FIXED
+            mahony_fx_update(&fusion, s.ax * ACC_LSB_PER_G, s.ay * ACC_LSB_PER_G, s.az * ACC_LSB_PER_G,
+                             s.gx * GYRO_LSB_PER_DPS, s.gy * GYRO_LSB_PER_DPS, s.gz * GYRO_LSB_PER_DPS,
+                             dt_us);
+#else
+            mahony_update(&fusion, s.ax, s.ay, s.az, s.gx, s.gy, s.gz, dt_us * 1e-6f);
+#endif
+            next_sample++;
+
+            // Control task: woken once per batch
+            if (++pending == batch) {
+                pending = 0;
+#ifdef IMU_FUSION_FIXED
+                mahony_fx_euler(&fusion, &angles);
+#else
+                mahony_euler(&fusion, &angles);
+#endif
+                controller_set_angles(lroundf(angles.roll), lroundf(angles.pitch), lroundf(angles.yaw));
+                controller_update();
+                counters.updates++;
+            }
+        }
+        while (next_press < presses.size() && presses[next_press].time_ms <= sim_ms) {
+            log_event("button", button_names[presses[next_press].button]);
+            controller_button(presses[next_press].button);
+            next_press++;
+        }
+
+        // Comms task: commands, answers and the state stream
+        cmd_engine_poll();
+        sim_drone_stats_t state;
+        sim_drone_get_stats(&state);
+        if (state.phase != DRONE_OFF && sim_ms >= next_state_ms) {
+            controller_on_battery(state.battery, first_state);
+            first_state = false;
+            next_state_ms = sim_ms + STATE_PERIOD_MS;
+        }
+
+        // rc streaming task: the latest setpoint at a fixed rate
+        if (!rc_enabled) {
+            next_rc_ms = sim_ms;
+        }
+        else if (sim_ms >= next_rc_ms) {
+            char packet[RC_FORMAT_MAX_LENGTH];
+            size_t length = rc_format(packet, &rc_setpoint);
+            sim_send((const uint8_t *) packet, length + 1);
+            next_rc_ms += rc_period_ms;
+        }
+
+        sim_drone_step(sim_ms);
+    }
+    double wall = now_s() - wall_start;
+
+    sim_drone_stats_t drone_stats;
+    sim_drone_get_stats(&drone_stats);
+    printf("sim: %.1f s simulated in %.3f s, %.0fx real time%s\n", sim_ms / 1000.0, wall,
+           wall > 0 ? sim_ms / 1000.0 / wall : 0.0, restarted ? " (stopped by WiFi reset)" : "");
+    printf("imu: %zu samples, %u control updates, batch %d\n", next_sample, counters.updates, batch);
+    printf("controller: %u setpoints, %u commands (%u dropped), %u screen updates, %s\n",
+           counters.setpoints, counters.commands, counters.dropped, counters.shows,
+           controller_in_flight() ? "in flight" : "on the ground");
+    cmd_engine_stats_t engine;
+    cmd_engine_get_stats(&engine);
+    printf("engine: depth max %u, %u answered, %u expired, %u stale answers, %u dropped, "
+           "%u priority (%u preempted)\n", engine.depth_max, engine.completed, engine.expired,
+           engine.stale, engine.dropped, engine.priority, engine.preempted);
+    printf("answers:");
+    for (int i = 0; i < CMD_RESULTS; i++)
+        printf(" %s %u", result_names[i], counters.results[i]);
+    printf("\n");
+    printf("drone: %s, %u flights, %u rc packets (%u ignored), max rc gap %u ms, "
+           "%u errors, %u emergencies, %u auto-lands\n",
+           sim_drone_phase_name(drone_stats.phase), drone_stats.flights, drone_stats.rc_packets,
+           drone_stats.rc_ignored, drone_stats.rc_gap_max_ms, drone_stats.errors,
+           drone_stats.emergencies, drone_stats.auto_lands);
+    printf("drone: at x %.0f y %.0f z %.0f cm, yaw %.0f deg, flown %.0f cm, battery %d%%\n",
+           drone_stats.x, drone_stats.y, drone_stats.z, drone_stats.yaw, drone_stats.distance,
+           drone_stats.battery);
+
+    if (events != NULL)
+        fclose(events);
+    return 0;
+}
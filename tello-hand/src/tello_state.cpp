@@ -0,0 +1,154 @@
+/*
+ * Tello state stream parser, see `tello_state.h`.
+ */
+
+#include <string.h>
+#include "tello_state.h"
+
+// Longest number the parser accepts, keeps the mantissa in 32 bit
+#define MAX_DIGITS  9
+
+typedef enum {
+    FIELD_INT16 = 0,
+    FIELD_FLOAT
+} field_type_t;
+
+typedef struct {
+    const char *key;
+    uint8_t key_length;
+    field_type_t type;
+    uint16_t offset;
+} field_t;
+
+#define FIELD(name, type) {#name, sizeof(#name) - 1, type, offsetof(tello_state_t, name)}
+
+// In the order the drone sends them; index i is bit (1 << i) of `fields`
+static const field_t fields[] = {
+    FIELD(pitch, FIELD_INT16),
+    FIELD(roll, FIELD_INT16),
+    FIELD(yaw, FIELD_INT16),
+    FIELD(vgx, FIELD_INT16),
+    FIELD(vgy, FIELD_INT16),
+    FIELD(vgz, FIELD_INT16),
+    FIELD(templ, FIELD_INT16),
+    FIELD(temph, FIELD_INT16),
+    FIELD(tof, FIELD_INT16),
+    FIELD(h, FIELD_INT16),
+    FIELD(bat, FIELD_INT16),
+    FIELD(baro, FIELD_FLOAT),
+    FIELD(time, FIELD_INT16),
+    FIELD(agx, FIELD_FLOAT),
+    FIELD(agy, FIELD_FLOAT),
+    FIELD(agz, FIELD_FLOAT)
+};
+#define FIELD_COUNT  (sizeof(fields) / sizeof(fields[0]))
+
+static const float decimal_scale[MAX_DIGITS + 1] = {
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f
+};
+
+
+// Fields come in a fixed order, so the one after the last match is tried first
+static int find_field(const char *key, size_t length, uint8_t *next)
+{
+    for (uint8_t n = 0; n < FIELD_COUNT; n++) {
+        uint8_t i = (*next + n) % FIELD_COUNT;
+        if (fields[i].key_length == length && memcmp(fields[i].key, key, length) == 0) {
+            *next = (i + 1) % FIELD_COUNT;
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+// [-]digits[.digits] -> mantissa and number of decimals
+static bool parse_number(const char *p, const char *end, int32_t *mantissa, uint8_t *decimals)
+{
+    bool negative = false;
+    bool fraction = false;
+    uint8_t digits = 0;
+    int32_t value = 0;
+
+    *decimals = 0;
+    if (p < end && *p == '-') {
+        negative = true;
+        p++;
+    }
+    for (; p < end; p++) {
+        if (*p == '.' && !fraction && digits > 0) {
+            fraction = true;
+            continue;
+        }
+        if (*p < '0' || *p > '9' || digits == MAX_DIGITS)
+            return false;
+        value = value * 10 + (*p - '0');
+        digits++;
+        if (fraction)
+            (*decimals)++;
+    }
+    if (digits == 0)
+        return false;
+    *mantissa = negative ? -value : value;
+    return true;
+}
+
+
+static bool store_field(const field_t *field, const char *value, const char *end,
+                        tello_state_t *state)
+{
+    int32_t mantissa;
+    uint8_t decimals;
+    uint8_t *target = (uint8_t *) state + field->offset;
+
+    if (!parse_number(value, end, &mantissa, &decimals))
+        return false;
+
+    if (field->type == FIELD_INT16) {
+        if (decimals > 0 || mantissa < INT16_MIN || mantissa > INT16_MAX)
+            return false;
+        int16_t number = mantissa;
+        memcpy(target, &number, sizeof(number));
+    }
+    else {
+        float number = mantissa / decimal_scale[decimals];
+        memcpy(target, &number, sizeof(number));
+    }
+    return true;
+}
+
+
+bool tello_state_parse(const char *data, size_t length, tello_state_t *state)
+{
+    const char *p = data;
+    const char *end = data + length;
+    uint32_t found = 0;
+    uint8_t next = 0;
+
+    while (p < end) {
+        const char *key = p;
+        while (p < end && *p != ':' && *p != ';')
+            p++;
+        if (p == end)
+            break;   // Trailing "\r\n" or truncated datagram
+        if (*p == ';') {
+            p++;     // Key without value
+            continue;
+        }
+
+        size_t key_length = p - key;
+        const char *value = ++p;
+        while (p < end && *p != ';')
+            p++;
+        if (p == end)
+            break;   // Value not terminated, datagram truncated
+
+        int index = find_field(key, key_length, &next);
+        if (index >= 0 && store_field(&fields[index], value, p, state))
+            found |= 1UL << index;
+        p++;
+    }
+
+    state->fields = found;
+    return found != 0;
+}
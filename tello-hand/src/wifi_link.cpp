@@ -0,0 +1,302 @@
+/*
+ * WiFi link state machine, see `wifi_link.h`.
+ */
+
+#include <stddef.h>
+#include <atomic>
+#include "spsc_ring.h"
+#include "wifi_link.h"
+
+static const link_io_t *io = NULL;
+static std::atomic<uint8_t> state{LINK_DOWN};
+static SpscRing<uint8_t, 8> events;          // WiFi event task -> link task
+static std::atomic<bool> acked{false};       // comms task -> link task
+static std::atomic<bool> rejoin{false};      // Any task -> link task
+
+static link_ap_t ap;
+static bool ap_valid = false;
+static uint8_t fast_failures = 0;
+static bool armed = false;                   // `deadline` applies
+static uint32_t deadline = 0;
+static bool answered = false;                // The drone answered on some link
+static bool joined_fast = false;
+
+// Drop being recovered from
+static bool recovering = false;
+static uint32_t lost_ms = 0;
+static uint32_t attempt_ms = 0;
+static uint32_t ip_ms = 0;
+static uint8_t attempts = 0;
+
+static link_stats_t stats = {};
+
+
+static void set_state(link_state_t next)
+{
+    state.store(next, std::memory_order_release);
+}
+
+
+static void arm(uint32_t at_ms)
+{
+    armed = true;
+    deadline = at_ms;
+}
+
+
+// Fast joins on the known channel first, then one full scan
+static void attempt(uint32_t now_ms)
+{
+    attempts++;
+    attempt_ms = now_ms;
+    if (ap_valid && fast_failures < LINK_FAST_ATTEMPTS) {
+        set_state(LINK_JOINING);
+        joined_fast = true;
+        arm(now_ms + LINK_FAST_TIMEOUT_MS);
+        io->join(&ap);
+        return;
+    }
+    fast_failures = 0;
+    set_state(LINK_SCANNING);
+    joined_fast = false;
+    arm(now_ms + LINK_SCAN_TIMEOUT_MS);
+    if (!io->join(NULL)) {
+        set_state(LINK_OFF);
+        armed = false;
+    }
+}
+
+
+static void attempt_failed(uint32_t now_ms)
+{
+    // A probe on one channel fails within a few 100 ms, while a brief
+    // drop may take a second or two to clear
+    bool fast = state.load(std::memory_order_relaxed) == LINK_JOINING;
+    if (fast)
+        fast_failures++;
+    set_state(LINK_DOWN);
+    arm(now_ms + (fast ? LINK_FAST_RETRY_MS : LINK_RETRY_MS));
+}
+
+
+static void on_up(uint32_t now_ms)
+{
+    switch (state.load(std::memory_order_relaxed)) {
+        case LINK_DOWN:
+        case LINK_JOINING:
+        case LINK_SCANNING:
+            ip_ms = now_ms;
+            fast_failures = 0;
+            set_state(LINK_SESSION);
+            acked.store(false, std::memory_order_relaxed);
+            arm(now_ms + LINK_SESSION_TIMEOUT_MS);
+            io->up(&ap, answered);
+            ap_valid = true;
+        break;
+
+        default:
+        break;
+    }
+}
+
+
+static void on_down(uint32_t now_ms)
+{
+    switch (state.load(std::memory_order_relaxed)) {
+        case LINK_UP:
+            recovering = true;
+            lost_ms = now_ms;
+            attempts = 0;
+            io->down();
+            attempt(now_ms);
+        break;
+
+        // A drop before the first answer belongs to the same recovery
+        case LINK_SESSION:
+            io->down();
+            attempt(now_ms);
+        break;
+
+        case LINK_JOINING:
+        case LINK_SCANNING:
+            attempt_failed(now_ms);
+        break;
+
+        default:
+        break;
+    }
+}
+
+
+static void on_ack(uint32_t now_ms)
+{
+    link_reconnect_t reconnect;
+
+    if (state.load(std::memory_order_relaxed) != LINK_SESSION)
+        return;
+    set_state(LINK_UP);
+    armed = false;
+    answered = true;
+    if (!recovering)
+        return;
+
+    recovering = false;
+    reconnect.down_ms = ip_ms - lost_ms;
+    reconnect.join_ms = ip_ms - attempt_ms;
+    reconnect.ack_ms = now_ms - ip_ms;
+    reconnect.total_ms = now_ms - lost_ms;
+    reconnect.attempts = attempts;
+    reconnect.fast = joined_fast;
+
+    stats.reconnects++;
+    if (joined_fast)
+        stats.fast++;
+    stats.last_ms = reconnect.total_ms;
+    if (reconnect.total_ms > stats.max_ms)
+        stats.max_ms = reconnect.total_ms;
+    io->report(&reconnect);
+}
+
+
+static void on_rejoin(uint32_t now_ms)
+{
+    switch (state.load(std::memory_order_relaxed)) {
+        case LINK_SESSION:
+        case LINK_UP:
+            io->down();
+        break;
+
+        default:
+        break;
+    }
+    io->leave();
+    // Not a drop: no recovery to report
+    recovering = false;
+    attempts = 0;
+    ap_valid = false;
+    fast_failures = 0;
+    set_state(LINK_DOWN);
+    arm(now_ms + LINK_RETRY_MS);
+}
+
+
+static void on_timeout(uint32_t now_ms)
+{
+    switch (state.load(std::memory_order_relaxed)) {
+        case LINK_DOWN:
+            attempt(now_ms);
+        break;
+
+        case LINK_JOINING:
+        case LINK_SCANNING:
+            attempt_failed(now_ms);
+        break;
+
+        // Joined, but the drone did not answer: the session starts again
+        case LINK_SESSION:
+            arm(now_ms + LINK_SESSION_TIMEOUT_MS);
+            io->session();
+        break;
+
+        default:
+            armed = false;
+        break;
+    }
+}
+
+
+void link_begin(const link_io_t *link_io, const link_ap_t *cached)
+{
+    io = link_io;
+    ap_valid = cached != NULL;
+    if (ap_valid)
+        ap = *cached;
+    fast_failures = 0;
+    answered = false;
+    recovering = false;
+    attempts = 0;
+    rejoin.store(false, std::memory_order_relaxed);
+    // The first link_poll() starts joining
+    armed = false;
+    set_state(LINK_DOWN);
+}
+
+
+void link_post(link_event_t event)
+{
+    if (event == LINK_EVENT_ACK)
+        acked.store(true, std::memory_order_release);
+    else
+        events.push(event);
+}
+
+
+void link_rejoin(void)
+{
+    rejoin.store(true, std::memory_order_release);
+}
+
+
+uint32_t link_poll(uint32_t now_ms)
+{
+    uint8_t event;
+
+    // Events first: a join that blocked for the config portal has its
+    // UP waiting behind an expired deadline
+    while (events.pop(event)) {
+        if (event == LINK_EVENT_UP)
+            on_up(now_ms);
+        else
+            on_down(now_ms);
+    }
+    if (acked.exchange(false, std::memory_order_acquire))
+        on_ack(now_ms);
+    if (rejoin.exchange(false, std::memory_order_acquire))
+        on_rejoin(now_ms);
+
+    link_state_t current = (link_state_t) state.load(std::memory_order_relaxed);
+    if (current == LINK_DOWN && !armed) {
+        attempt(now_ms);
+    }
+    else if (armed && (int32_t) (now_ms - deadline) >= 0) {
+        on_timeout(now_ms);
+    }
+
+    if (!armed)
+        return LINK_SESSION_TIMEOUT_MS;
+    int32_t wait = (int32_t) (deadline - now_ms);
+    return wait > 0 ? wait : 0;
+}
+
+
+link_state_t link_state(void)
+{
+    return (link_state_t) state.load(std::memory_order_acquire);
+}
+
+
+const char *link_state_name(link_state_t link)
+{
+    switch (link) {
+        case LINK_DOWN:
+            return "down";
+        case LINK_JOINING:
+            return "joining";
+        case LINK_SCANNING:
+            return "scanning";
+        case LINK_SESSION:
+            return "session";
+        case LINK_UP:
+            return "up";
+        case LINK_OFF:
+            return "off";
+        default:
+            return "?";
+    }
+}
+
+
+void link_get_stats(link_stats_t *out)
+{
+    *out = stats;
+}